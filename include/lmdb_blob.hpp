@@ -0,0 +1,348 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_BLOB_HPP
+#define LMDB_BLOB_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <functional>
+#include <istream>
+#include <ostream>
+
+namespace LMDB
+{
+    class BlobStore;
+
+    /**
+     * Describes how a blob is stored
+     */
+    struct BlobInfo
+    {
+        // the total size of the blob in bytes
+        uint64_t size = 0;
+
+        // the (uncompressed) size of every chunk but the last
+        uint32_t chunk_size = 0;
+
+        uint64_t chunks = 0;
+
+        // distinguishes the chunks of the blob from those of a previous (or concurrent) write of the same key
+        uint64_t generation = 0;
+    };
+
+    /**
+     * Reads a blob chunk by chunk from a consistent snapshot of the database
+     *
+     * Note: The reader keeps a read-only transaction open for as long as it exists, which prevents LMDB
+     * from reusing pages freed by later writes. Readers should not be held for longer than necessary.
+     */
+    class BlobReader
+    {
+        friend class BlobStore;
+
+      public:
+        BlobReader() = delete;
+
+        /**
+         * Retrieves a view of the (uncompressed) chunk
+         *
+         * Chunks stored uncompressed are zero-copy and remain valid for as long as the reader exists;
+         * compressed chunks are decompressed into a buffer that is reused by the next call to chunk()
+         * or read()
+         *
+         * @param index
+         * @return [error, data, length]
+         */
+        std::tuple<Error, const unsigned char *, size_t> chunk(uint64_t index);
+
+        /**
+         * Writes the remainder of the blob (from the current position) to the stream
+         *
+         * @param stream
+         * @return
+         */
+        Error copy_to(std::ostream &stream);
+
+        /**
+         * Returns the description of the blob
+         *
+         * @return
+         */
+        [[nodiscard]] BlobInfo info() const;
+
+        /**
+         * Returns the current position of the reader within the blob
+         *
+         * @return
+         */
+        [[nodiscard]] uint64_t position() const;
+
+        /**
+         * Reads up to length bytes from the current position of the reader and advances the position
+         *
+         * @param buffer
+         * @param length
+         * @return [error, number of bytes read (0 at the end of the blob)]
+         */
+        std::tuple<Error, size_t> read(void *buffer, size_t length);
+
+        /**
+         * Reads up to length bytes starting at the offset without changing the position of the reader
+         *
+         * @param offset
+         * @param buffer
+         * @param length
+         * @return [error, number of bytes read (0 at or beyond the end of the blob)]
+         */
+        std::tuple<Error, size_t> read_at(uint64_t offset, void *buffer, size_t length);
+
+        /**
+         * Moves the position of the reader to the offset (clamped to the size of the blob)
+         *
+         * @param offset
+         */
+        void seek(uint64_t offset);
+
+        /**
+         * Returns the total size of the blob in bytes
+         *
+         * @return
+         */
+        [[nodiscard]] uint64_t size() const;
+
+      private:
+        BlobReader(
+            std::shared_ptr<Transaction> txn,
+            std::shared_ptr<Database> db,
+            mdb_result_t key,
+            const BlobInfo &info);
+
+        std::shared_ptr<Transaction> txn;
+
+        std::shared_ptr<Database> db;
+
+        mdb_result_t key;
+
+        BlobInfo m_info;
+
+        uint64_t m_position = 0;
+
+        // holds the most recently decompressed chunk
+        mdb_result_t buffer;
+    };
+
+    /**
+     * Stores large values as a series of fixed-size chunks, each optionally compressed, so that
+     * blobs can be written from and read into streams without holding the whole value in memory.
+     *
+     * A blob is stored as a small manifest at the key itself, with its chunks at derived keys
+     * ("<key>\0<generation><index>"). Chunks are written in transactions of a bounded size and the
+     * manifest is written last (replacing the chunks of any previous blob), so readers only ever
+     * see complete blobs.
+     *
+     * Note: The database should be dedicated to blobs and must not have compression enabled, as
+     * chunks are compressed individually.
+     */
+    class BlobStore
+    {
+      public:
+        BlobStore() = delete;
+
+        /**
+         * Creates a blob store on top of the database
+         *
+         * @param db
+         * @param chunk_size the uncompressed size of each chunk
+         * @param compress whether chunks are compressed (if it makes them smaller)
+         */
+        explicit BlobStore(std::shared_ptr<Database> db, size_t chunk_size = 1024 * 1024, bool compress = true);
+
+        /**
+         * Deletes the blob and all of its chunks
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Deletes the blob and all of its chunks
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(key.data(), key.size());
+        }
+
+        /**
+         * Checks if a blob exists at the key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const void *key, size_t length);
+
+        /**
+         * Checks if a blob exists at the key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const KeyType &key)
+        {
+            return exists(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the description of the blob
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, BlobInfo> info(const void *key, size_t length);
+
+        /**
+         * Retrieves the description of the blob
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, BlobInfo> info(const KeyType &key)
+        {
+            return info(key.data(), key.size());
+        }
+
+        /**
+         * Writes the blob to the stream
+         *
+         * @param key
+         * @param length
+         * @param stream
+         * @return
+         */
+        Error read(const void *key, size_t length, std::ostream &stream);
+
+        /**
+         * Writes the blob to the stream
+         *
+         * @tparam KeyType
+         * @param key
+         * @param stream
+         * @return
+         */
+        template<typename KeyType> Error read(const KeyType &key, std::ostream &stream)
+        {
+            return read(key.data(), key.size(), stream);
+        }
+
+        /**
+         * Opens a reader for the blob
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, std::shared_ptr<BlobReader>> reader(const void *key, size_t length);
+
+        /**
+         * Opens a reader for the blob
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, std::shared_ptr<BlobReader>> reader(const KeyType &key)
+        {
+            return reader(key.data(), key.size());
+        }
+
+        /**
+         * Writes the blob from the producer, which is called to fill a buffer of up to the given
+         * length and returns how many bytes it wrote (less than the length at the end of the blob)
+         *
+         * @param key
+         * @param length
+         * @param producer
+         * @return
+         */
+        Error write(const void *key, size_t length, const std::function<size_t(unsigned char *, size_t)> &producer);
+
+        /**
+         * Writes the blob from the remainder of the stream
+         *
+         * @param key
+         * @param length
+         * @param stream
+         * @return
+         */
+        Error write(const void *key, size_t length, std::istream &stream);
+
+        /**
+         * Writes the blob from the remainder of the stream
+         *
+         * @tparam KeyType
+         * @param key
+         * @param stream
+         * @return
+         */
+        template<typename KeyType> Error write(const KeyType &key, std::istream &stream)
+        {
+            return write(key.data(), key.size(), stream);
+        }
+
+      private:
+        /**
+         * Writes a batch of chunks in a single transaction and, if it is the final batch, the manifest
+         *
+         * @param key
+         * @param info updated with the chunks written
+         * @param batch
+         * @param final
+         * @return
+         */
+        Error store(const mdb_result_t &key, BlobInfo &info, const std::vector<mdb_result_t> &batch, bool final);
+
+        std::shared_ptr<Database> db;
+
+        size_t chunk_size;
+
+        bool compress;
+    };
+} // namespace LMDB
+
+#endif // LMDB_BLOB_HPP
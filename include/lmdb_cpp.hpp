@@ -30,10 +30,21 @@
 #include "lmdb_errors.hpp"
 #include "thread_safe_map.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <lmdb.h>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 namespace LMDB
@@ -49,9 +60,373 @@ namespace LMDB
 
     class Cursor;
 
+    class Index;
+
+    class Watch;
+
+    class ReplicationFollower;
+
+    class OptimisticTransaction;
+
+    class WriteBuffer;
+
+    class ValueLog;
+
+    class BlobReader;
+
+    class BlobStore;
+
+    class DedupDatabase;
+
+    namespace Typed
+    {
+        template<typename Traits> class Database;
+
+        template<typename Traits> class Transaction;
+    } // namespace Typed
+
     // shorthand typedef
     typedef std::vector<unsigned char> mdb_result_t;
 
+    // a result allocated from a caller supplied memory resource (such as a per-request arena)
+    typedef std::pmr::vector<unsigned char> mdb_pmr_result_t;
+
+    /**
+     * Maps a primary key and its (uncompressed) value to zero or more secondary index keys
+     */
+    typedef std::function<std::vector<mdb_result_t>(const mdb_result_t &key, const mdb_result_t &value)>
+        index_extractor_t;
+
+    /**
+     * Combines the existing value of a key (nullptr if the key does not exist) with an operand
+     * to produce the new value of the key. See: lmdb_merge.hpp for the built-in operators.
+     *
+     * An operator rejects a malformed value or operand by throwing std::invalid_argument, which
+     * the merge methods return as LMDB_BAD_VALSIZE without writing the key.
+     */
+    typedef std::function<mdb_result_t(const mdb_result_t *existing, const mdb_result_t &operand)> merge_operator_t;
+
+    /**
+     * Called by Database::parallel_scan() for each entry with the bytes in the memory map itself.
+     * Returning false stops the scan on all workers.
+     */
+    typedef std::function<bool(size_t worker, const MDB_val &key, const MDB_val &value)> scan_visitor_t;
+
+    /**
+     * Called by Database::scan_keys() and Database::scan_values() for each key or value with the bytes in
+     * the memory map itself. Returning false stops the scan.
+     */
+    typedef std::function<bool(const MDB_val &data)> data_visitor_t;
+
+    /**
+     * The priority lanes in which in-process writers queue for the LMDB write transaction. A writer
+     * is granted the next write transaction only when no writer is waiting in a more urgent lane.
+     */
+    enum WritePriority : uint8_t
+    {
+        WRITE_PRIORITY_INTERACTIVE = 0,
+        WRITE_PRIORITY_NORMAL = 1,
+        WRITE_PRIORITY_BULK = 2
+    };
+
+    /**
+     * The type of mutation recorded in the change log
+     */
+    enum ChangeOperation : uint8_t
+    {
+        CHANGE_PUT = 1,
+        CHANGE_DEL = 2
+    };
+
+    /**
+     * A committed mutation read from the change log
+     */
+    struct ChangeRecord
+    {
+        // the position of the record in the change log
+        size_t sequence = 0;
+
+        // the ID of the transaction that made the change
+        size_t txn_id = 0;
+
+        MDB_dbi dbi = 0;
+
+        // the name of the database that was changed
+        std::string database;
+
+        ChangeOperation operation = CHANGE_PUT;
+
+        // the flags supplied with the put
+        unsigned int flags = 0;
+
+        mdb_result_t key;
+
+        /**
+         * For CHANGE_PUT, the (uncompressed) value written if the change log includes values.
+         * For CHANGE_DEL, if not empty, only this value was deleted from the key.
+         */
+        mdb_result_t value;
+    };
+
+    /**
+     * Decodes a number stored big-endian, whatever the byte order of the host
+     *
+     * @tparam T the arithmetic type of the number
+     * @param data
+     * @return
+     */
+    template<typename T> inline T decode_big_endian(const unsigned char *data)
+    {
+        typedef std::conditional_t<
+            sizeof(T) == 1,
+            uint8_t,
+            std::conditional_t<sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>
+            bits_t;
+
+        static_assert(sizeof(bits_t) == sizeof(T), "Only numbers of up to 8 bytes can be decoded");
+
+        bits_t bits = 0;
+
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            bits = static_cast<bits_t>((static_cast<uint64_t>(bits) << 8) | data[i]);
+        }
+
+        T number;
+
+        std::memcpy(&number, &bits, sizeof(T));
+
+        return number;
+    }
+
+    /**
+     * Describes the number aggregated by Database::aggregate()
+     *
+     * @tparam T the arithmetic type of the number
+     */
+    template<typename T> struct AggregateOptions
+    {
+        static_assert(std::is_arithmetic_v<T>, "Aggregates require an arithmetic type");
+
+        // whether the number is read from the key rather than the value
+        bool key = false;
+
+        // the offset of the number within the key or value
+        size_t offset = 0;
+
+        // whether the number is stored big-endian (as keys usually are so that they sort), otherwise it is
+        // stored in the byte order of the host (as MDB_INTEGERKEY keys are)
+        bool big_endian = false;
+
+        // if not empty, the ascending upper bounds of the histogram buckets
+        std::vector<T> histogram_bounds;
+    };
+
+    /**
+     * The result of Database::aggregate()
+     *
+     * @tparam T the arithmetic type of the number
+     */
+    template<typename T> struct Aggregate
+    {
+        // integers are summed as 64-bit integers and floating point numbers as doubles
+        typedef std::conditional_t<
+            std::is_floating_point_v<T>,
+            double,
+            std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>>
+            sum_type;
+
+        size_t count = 0;
+
+        // the number of entries too short to contain the number
+        size_t skipped = 0;
+
+        sum_type sum = 0;
+
+        T min = 0, max = 0;
+
+        /**
+         * histogram[i] counts the numbers less than histogram_bounds[i] (and not counted by an earlier
+         * bucket) with the final bucket counting the remainder
+         */
+        std::vector<size_t> histogram;
+    };
+
+    /**
+     * The result of Database::estimate_range()
+     */
+    struct RangeEstimate
+    {
+        // the estimated number of entries (including duplicates) in the range
+        size_t entries = 0;
+
+        // the estimated bytes of the keys and (stored) values in the range
+        size_t bytes = 0;
+
+        // whether the range was small enough to be counted rather than estimated
+        bool exact = false;
+    };
+
+    /**
+     * Holds the keys and/or values of a batch read in a single contiguous buffer with a table of
+     * offsets, rather than one heap allocation per entry.
+     *
+     * A result set can be passed to repeated batch reads: clear() keeps the memory already
+     * allocated, so once the buffer has grown to fit a batch, later batches allocate nothing.
+     *
+     * Note: Views into a result set are invalidated when it is cleared, refilled or destroyed.
+     */
+    class ResultSet
+    {
+        friend class Database;
+
+        friend class Cursor;
+
+      public:
+        /**
+         * A view of a key or value within the result set
+         */
+        struct view_t
+        {
+            const unsigned char *data = nullptr;
+
+            size_t size = 0;
+
+            [[nodiscard]] const unsigned char *begin() const
+            {
+                return data;
+            }
+
+            [[nodiscard]] bool empty() const
+            {
+                return size == 0;
+            }
+
+            [[nodiscard]] const unsigned char *end() const
+            {
+                return data + size;
+            }
+
+            /**
+             * Copies the view into a standalone result
+             *
+             * @return
+             */
+            [[nodiscard]] mdb_result_t to_result() const
+            {
+                return {begin(), end()};
+            }
+        };
+
+        /**
+         * An entry of the result set (for keys-only or values-only reads, the other view is empty)
+         */
+        struct entry_t
+        {
+            view_t key;
+
+            view_t value;
+        };
+
+        class const_iterator
+        {
+          public:
+            const_iterator(const ResultSet *results, size_t index): results(results), index(index) {}
+
+            entry_t operator*() const
+            {
+                return (*results)[index];
+            }
+
+            const_iterator &operator++()
+            {
+                ++index;
+
+                return *this;
+            }
+
+            bool operator==(const const_iterator &other) const
+            {
+                return index == other.index && results == other.results;
+            }
+
+            bool operator!=(const const_iterator &other) const
+            {
+                return !(*this == other);
+            }
+
+          private:
+            const ResultSet *results;
+
+            size_t index;
+        };
+
+        /**
+         * Retrieves the entry at the index
+         *
+         * @param index
+         * @return
+         */
+        entry_t operator[](size_t index) const;
+
+        [[nodiscard]] const_iterator begin() const;
+
+        /**
+         * Returns the number of bytes currently allocated for the keys and values
+         *
+         * @return
+         */
+        [[nodiscard]] size_t capacity() const;
+
+        /**
+         * Removes all entries while keeping the memory allocated for them
+         */
+        void clear();
+
+        [[nodiscard]] bool empty() const;
+
+        [[nodiscard]] const_iterator end() const;
+
+        /**
+         * Reserves memory for at least the specified number of entries and bytes of keys and values
+         *
+         * @param entries
+         * @param bytes
+         */
+        void reserve(size_t entries, size_t bytes);
+
+        /**
+         * Returns the number of entries in the result set
+         *
+         * @return
+         */
+        [[nodiscard]] size_t size() const;
+
+      private:
+        /**
+         * Appends an entry from the results of a LMDB call, uncompressing the value directly into
+         * the buffer if it is compressed. Keys are never compressed and are appended as they are.
+         *
+         * @param key
+         * @param value
+         */
+        void append(const MDB_val *key, const MDB_val *value);
+
+        /**
+         * Appends the data to the buffer, uncompressing it directly into the buffer if it is compressed
+         *
+         * @param data
+         * @param uncompress whether to uncompress the data if it is compressed
+         * @return [offset, length]
+         */
+        std::tuple<size_t, size_t> append_data(const MDB_val &data, bool uncompress);
+
+        mdb_result_t arena;
+
+        // [key offset, key length, value offset, value length] of each entry
+        std::vector<std::tuple<size_t, size_t, size_t, size_t>> offsets;
+    };
+
     /**
      * Wraps the LMDB C API into an OOP model that allows for opening and using
      * multiple environments and databases at once.
@@ -62,6 +437,8 @@ namespace LMDB
 
         friend class Transaction;
 
+        friend class Cursor;
+
       public:
         Environment() = delete;
 
@@ -79,6 +456,24 @@ namespace LMDB
          */
         Error copy(const std::string &path, unsigned int flags = 0);
 
+        /**
+         * Reads the change log starting at the specified sequence number
+         *
+         * @param from_sequence the first sequence number to return
+         * @param limit the maximum number of records to return
+         * @return
+         */
+        std::vector<ChangeRecord> changes(size_t from_sequence, size_t limit = 1000);
+
+        /**
+         * Acknowledges (truncates) all records in the change log up to, and including, the
+         * specified sequence number once they have been consumed
+         *
+         * @param sequence
+         * @return
+         */
+        Error acknowledge_changes(size_t sequence);
+
         /**
          * Opens a database (separate key space) in the environment as a logical
          * partitioning of data.
@@ -91,6 +486,31 @@ namespace LMDB
         std::shared_ptr<Database>
             database(const std::string &name = "", bool enable_compression = false, int flags = 0);
 
+        /**
+         * Enables change data capture for the environment.
+         *
+         * Once enabled, every put and delete made through Transaction, Database or Cursor appends a
+         * record to the change log database ("__changes") in the same transaction as the change itself.
+         * Records are keyed by an ever increasing sequence number (MDB_INTEGERKEY) so that appends are
+         * always at the end of the tree and consumers can tail the log using changes(). The highest
+         * sequence number assigned is kept in the log, so numbering continues after acknowledge_changes()
+         * has truncated every record. Sequence numbers may skip the changes of an aborted nested
+         * transaction, but are never reused.
+         *
+         * Note: The change log counts against the maximum number of databases in the environment and
+         * grows until records are truncated via acknowledge_changes().
+         *
+         * @param include_values whether the values written by puts are recorded in the log
+         */
+        void enable_change_log(bool include_values = true);
+
+        /**
+         * Returns if change data capture is enabled for the environment
+         *
+         * @return
+         */
+        [[nodiscard]] bool change_log_enabled() const;
+
         /**
          * Detects the current memory map size if it has been changed elsewhere
          * This requires that there are no open R/W transactions; otherwise, the method
@@ -178,6 +598,24 @@ namespace LMDB
          */
         std::tuple<Error, size_t> max_readers() const;
 
+        /**
+         * Returns the highest sequence number assigned in the change log
+         *
+         * Sequence numbers are never reused, so this is unchanged by acknowledge_changes(). If nothing
+         * has been logged, returns 0
+         *
+         * @return
+         */
+        std::tuple<Error, size_t> last_change_sequence();
+
+        /**
+         * Returns the ID of the most recently committed transaction in the environment,
+         * including transactions committed by other processes
+         *
+         * @return
+         */
+        std::tuple<Error, size_t> last_txn_id() const;
+
         /**
          * Returns the number of open R/W transactions in the environment
          *
@@ -208,6 +646,56 @@ namespace LMDB
          */
         static std::tuple<int, int, int> version();
 
+        /**
+         * Blocks until a write transaction newer than the specified transaction ID has been committed,
+         * or the timeout expires, instead of polling the database for changes.
+         *
+         * Commits made via this wrapper in this process wake waiters immediately. To also detect
+         * commits made by other processes, supply a poll interval at which the last committed
+         * transaction ID of the environment is checked.
+         *
+         * @param last_seen the ID of the last transaction the caller has seen
+         * @param timeout
+         * @param poll_interval if non-zero, how often to check for commits made by other processes
+         * @return the ID of the most recently committed transaction known (if it is not greater than
+         *   last_seen, the wait timed out)
+         */
+        size_t wait_for_commit(
+            size_t last_seen,
+            std::chrono::milliseconds timeout,
+            std::chrono::milliseconds poll_interval = std::chrono::milliseconds(0));
+
+        /**
+         * Registers a watch on the keys starting with the specified prefix in the database so that
+         * a waiter is only woken when a committed transaction wrote to (or deleted) a matching key.
+         *
+         * The watch remains registered for as long as the returned pointer is held.
+         *
+         * Note: Only changes made via Transaction (or Database) puts and deletes in this process
+         * trigger watches. Writes made via Cursor and by other processes do not.
+         *
+         * @param db
+         * @param prefix
+         * @param length
+         * @return
+         */
+        std::shared_ptr<Watch> watch(const std::shared_ptr<Database> &db, const void *prefix, size_t length);
+
+        /**
+         * Registers a watch on the keys starting with the specified prefix in the database so that
+         * a waiter is only woken when a committed transaction wrote to (or deleted) a matching key.
+         *
+         * @tparam KeyType
+         * @param db
+         * @param prefix
+         * @return
+         */
+        template<typename KeyType>
+        std::shared_ptr<Watch> watch(const std::shared_ptr<Database> &db, const KeyType &prefix)
+        {
+            return watch(db, prefix.data(), prefix.size());
+        }
+
       private:
         /**
          * Creates a new instance of an environment
@@ -217,6 +705,45 @@ namespace LMDB
          */
         Environment(std::string env_path, size_t growth_factor);
 
+        /**
+         * Appends a record of the change to the change log within the transaction specified
+         *
+         * @param txn
+         * @param db the database that was changed
+         * @param operation
+         * @param flags
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return
+         */
+        Error change_append(
+            MDB_txn *txn,
+            const Database &db,
+            ChangeOperation operation,
+            unsigned int flags,
+            const void *key,
+            size_t key_length,
+            const void *value,
+            size_t value_length);
+
+        /**
+         * Stores the highest sequence number assigned by the root R/W transaction specified (if it
+         * appended to the change log) in the transaction just before it commits
+         *
+         * @param txn
+         * @return the LMDB result
+         */
+        int change_commit(MDB_txn *txn);
+
+        /**
+         * Forgets the sequence numbers assigned by the root R/W transaction specified as it was aborted
+         *
+         * @param txn
+         */
+        void change_reset(MDB_txn *txn);
+
         /**
          * Converts the bytes of memory specified into LMDB pages (rounded up)
          *
@@ -235,17 +762,87 @@ namespace LMDB
          */
         void transaction_unregister();
 
-        std::shared_ptr<MDB_env *> env = std::make_shared<MDB_env *>();
-
-        static inline ThreadSafeMap<std::string, std::shared_ptr<Environment>> environments;
+        /**
+         * Notifies waiters that a write transaction has been committed and triggers the
+         * watches that match the keys written by the transaction
+         *
+         * @param txn_id
+         * @param touched the [dbi, key] pairs written by the transaction, if tracked
+         */
+        void commit_notify(size_t txn_id, const std::vector<std::tuple<MDB_dbi, mdb_result_t>> *touched);
 
-        std::string path;
+        /**
+         * Returns if any watches are currently registered in the environment
+         *
+         * @return
+         */
+        bool watching() const;
+
+        /**
+         * Waits in the lane of the specified priority for the in-process writer slot, which must be
+         * held by a root R/W transaction before it begins its LMDB write transaction
+         *
+         * @param priority
+         * @param timeout if std::chrono::milliseconds::max(), waits without a deadline
+         * @return whether the slot was acquired
+         */
+        bool writer_acquire(WritePriority priority, std::chrono::milliseconds timeout);
+
+        /**
+         * Returns if any writer is waiting in a lane more urgent than the priority specified
+         *
+         * @param priority
+         * @return
+         */
+        bool writer_contended(WritePriority priority) const;
+
+        /**
+         * Releases the in-process writer slot so that the next writer can be granted it
+         */
+        void writer_release();
+
+        std::shared_ptr<MDB_env *> env = std::make_shared<MDB_env *>();
+
+        static inline ThreadSafeMap<std::string, std::shared_ptr<Environment>> environments;
+
+        std::string path;
 
         size_t growth_factor = 0, open_txns = 0;
 
         mutable std::mutex mutex, txn_mutex;
 
         ThreadSafeMap<std::string, std::shared_ptr<Database>> databases;
+
+        std::shared_ptr<Database> change_db;
+
+        bool change_values = true;
+
+        /**
+         * The write transaction (by ID) that is appending to the change log and the next sequence
+         * number it assigns. Only the holder of the write transaction touches these.
+         */
+        size_t change_txn_id = 0, change_next_sequence = 0;
+
+        bool change_pending = false;
+
+        size_t last_commit = 0;
+
+        std::condition_variable commit_cv;
+
+        mutable std::mutex commit_mutex, watch_mutex;
+
+        std::vector<std::weak_ptr<Watch>> watches;
+
+        mutable std::mutex writer_mutex;
+
+        std::condition_variable writer_cv;
+
+        bool writer_held = false;
+
+        // the tickets of the writers waiting in each priority lane, in the order they arrived
+        std::deque<uint64_t> writer_lanes[WRITE_PRIORITY_BULK + 1];
+
+        uint64_t writer_ticket = 0;
     };
 
     /**
@@ -259,11 +856,78 @@ namespace LMDB
 
         friend class Cursor;
 
+        friend class Index;
+
+        friend class ReplicationFollower;
+
+        friend class OptimisticTransaction;
+
+        friend class WriteBuffer;
+
+        friend class ValueLog;
+
+        friend class BlobReader;
+
+        friend class BlobStore;
+
+        friend class DedupDatabase;
+
+        template<typename Traits> friend class Typed::Database;
+
+        template<typename Traits> friend class Typed::Transaction;
+
       public:
         Database() = delete;
 
         ~Database();
 
+        /**
+         * Computes the count, sum, min, max and (optionally) histogram of a fixed-width number in the
+         * keys or values of the range [begin, end) without copying any of them
+         *
+         * The numbers are read straight from the memory map through a cursor and gathered into small
+         * batches that are reduced by loops the compiler can vectorize.
+         *
+         * If begin_length is 0, the scan starts at the first key; if end_length is 0, the scan continues
+         * to the end of the database
+         *
+         * Note: Values cannot be aggregated if compression is enabled. Like cursors, aggregates do not
+         * filter expired keys.
+         *
+         * @tparam T
+         * @param options
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @return
+         */
+        template<typename T>
+        std::tuple<Error, Aggregate<T>> aggregate(
+            const AggregateOptions<T> &options,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0);
+
+        /**
+         * Computes the count, sum, min, max and (optionally) histogram of a fixed-width number in the
+         * keys or values of the range [begin, end) without copying any of them
+         *
+         * @tparam T
+         * @tparam KeyType
+         * @param options
+         * @param begin
+         * @param end
+         * @return
+         */
+        template<typename T, typename KeyType>
+        std::tuple<Error, Aggregate<T>>
+            aggregate(const AggregateOptions<T> &options, const KeyType &begin, const KeyType &end)
+        {
+            return aggregate(options, begin.data(), begin.size(), end.data(), end.size());
+        }
+
         /**
          * Returns if the database keys and values are compressed
          *
@@ -271,9 +935,58 @@ namespace LMDB
          */
         bool compressed() const;
 
+        /**
+         * Simplified compare-and-swap which opens a new transaction, replaces the value of the key
+         * with the desired value only if its current value matches the expected value, and commits
+         * the transaction.
+         *
+         * See: Transaction::compare_and_swap()
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param expected if nullptr, the key is expected to not exist
+         * @param expected_length
+         * @param desired
+         * @param desired_length
+         * @return [error, current value if LMDB_CONFLICT]
+         */
+        std::tuple<Error, mdb_result_t> compare_and_swap(
+            const void *key,
+            size_t key_length,
+            const void *expected,
+            size_t expected_length,
+            const void *desired,
+            size_t desired_length);
+
+        /**
+         * Simplified compare-and-swap which opens a new transaction, replaces the value of the key
+         * with the desired value only if its current value matches the expected value, and commits
+         * the transaction.
+         *
+         * @tparam KeyType
+         * @tparam ExpectedType
+         * @tparam DesiredType
+         * @param key
+         * @param expected
+         * @param desired
+         * @return [error, current value if LMDB_CONFLICT]
+         */
+        template<typename KeyType, typename ExpectedType, typename DesiredType>
+        std::tuple<Error, mdb_result_t>
+            compare_and_swap(const KeyType &key, const ExpectedType &expected, const DesiredType &desired)
+        {
+            return compare_and_swap(
+                key.data(), key.size(), expected.data(), expected.size(), desired.data(), desired.size());
+        }
+
         /**
          * Returns how many key/value pairs currently exist in the database
          *
+         * The count is read from the statistics of the database rather than by visiting its entries.
+         *
          * @return
          */
         size_t count();
@@ -304,7 +1017,7 @@ namespace LMDB
          */
         template<typename KeyType> Error del(const KeyType &key)
         {
-            return del(key.data(), key.size());
+            return del(static_cast<const void *>(key.data()), key.size());
         }
 
         /**
@@ -350,6 +1063,103 @@ namespace LMDB
          */
         Error drop(bool delete_db);
 
+        /**
+         * Registers a secondary index on the database. The extractor is called with every primary
+         * key/value written via Transaction::put() (or Database::put()) and the resulting index keys
+         * are maintained in a MDB_DUPSORT database in the same transaction as the primary write.
+         * Deletes via Transaction::del() (or Database::del()) remove the matching index entries.
+         *
+         * Indexes are registered per-process; existing data can be indexed with Index::backfill().
+         *
+         * Note: The index database is named "<database>:<index>" and counts against the maximum number
+         * of databases in the environment. Writes made directly via Cursor::put() or Cursor::del() are
+         * not reflected in the index. Primary keys must not exceed the environment maximum key size as
+         * they are stored as duplicate values in the index. Databases opened with MDB_DUPSORT cannot
+         * be indexed and will throw an exception.
+         *
+         * @param name
+         * @param extractor
+         * @return
+         */
+        std::shared_ptr<Index> create_index(const std::string &name, index_extractor_t extractor);
+
+        /**
+         * Enables per-key time-to-live (TTL) support for the database.
+         *
+         * Expiry times are kept in an index ordered by timestamp ("<database>:ttl") along with a
+         * reverse lookup of each key's expiry ("<database>:ttl_keys"); both are maintained in the same
+         * transaction as the writes to the database. Once enabled, Transaction::get() and
+         * Transaction::exists() treat expired keys as not found even before they have been purged.
+         *
+         * A put() without a TTL clears any TTL previously set for the key.
+         *
+         * Note: The TTL databases count against the maximum number of databases in the environment.
+         * Cursors, count(), list_keys() and get_all() do not filter expired keys.
+         */
+        void enable_ttl();
+
+        /**
+         * Enables version stamps for the keys in the database for use with put_if_version().
+         *
+         * The version of a key is the ID of the write transaction that last wrote it and is kept in
+         * "<database>:versions", which is maintained in the same transaction as the writes to the
+         * database. As transaction IDs only ever increase, a key that is deleted and written again
+         * never returns to a previous version. A key that does not exist has a version of 0.
+         *
+         * Existing keys are not stamped when versioning is enabled. A key that exists without a stamp
+         * (written before versioning was enabled, by another process, or via Cursor::put()) has the
+         * version UINT64_MAX until it is next written through a transaction.
+         *
+         * Note: The versions database counts against the maximum number of databases in the environment.
+         * Writes made directly via Cursor::put() or Cursor::del() do not update the version.
+         */
+        void enable_versioning();
+
+        /**
+         * Estimates the number of entries and bytes in the range [begin, end) without scanning it
+         *
+         * Ranges of at most samples * sample_size entries are counted exactly. Otherwise, LMDB does not
+         * expose the positions of keys within its pages, so the range is divided into samples slices of the
+         * key space (see split_points()) and up to sample_size entries are read from the start of each slice
+         * to measure the density of keys within it. The estimate takes O(samples * (log N + sample_size))
+         * regardless of the size of the range and is capped by the entries and pages reported by mdb_stat.
+         * Larger samples improve the accuracy for keys that are unevenly distributed.
+         *
+         * Values are neither copied nor decompressed (bytes counts the stored size of compressed values).
+         *
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @param samples
+         * @param sample_size
+         * @return
+         */
+        std::tuple<Error, RangeEstimate> estimate_range(
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0,
+            size_t samples = 16,
+            size_t sample_size = 32);
+
+        /**
+         * Estimates the number of entries and bytes in the range [begin, end) without scanning it
+         *
+         * @tparam KeyType
+         * @param begin
+         * @param end
+         * @param samples
+         * @param sample_size
+         * @return
+         */
+        template<typename KeyType>
+        std::tuple<Error, RangeEstimate>
+            estimate_range(const KeyType &begin, const KeyType &end, size_t samples = 16, size_t sample_size = 32)
+        {
+            return estimate_range(begin.data(), begin.size(), end.data(), end.size(), samples, sample_size);
+        }
+
         /**
          * Returns if the key exists in the database
          *
@@ -396,6 +1206,33 @@ namespace LMDB
             return get(key.data(), key.size());
         }
 
+        /**
+         * Simplified retrieval of the value at the specified key which opens a new
+         * readonly transaction and returns the value allocated from the memory resource
+         *
+         * @param key
+         * @param length
+         * @param resource
+         * @return
+         */
+        std::tuple<Error, mdb_pmr_result_t>
+            get(const void *key, size_t length, std::pmr::memory_resource *resource);
+
+        /**
+         * Simplified retrieval of the value at the specified key which opens a new
+         * readonly transaction and returns the value allocated from the memory resource
+         *
+         * @tparam KeyType
+         * @param key
+         * @param resource
+         * @return
+         */
+        template<typename KeyType>
+        std::tuple<Error, mdb_pmr_result_t> get(const KeyType &key, std::pmr::memory_resource *resource)
+        {
+            return get(key.data(), key.size(), resource);
+        }
+
         /**
          * Simplifies retrieval of all values for all keys in the database
          *
@@ -406,161 +1243,958 @@ namespace LMDB
         std::vector<mdb_result_t> get_all();
 
         /**
-         * Retrieves the database flags
+         * Retrieves all keys and values in the database into the result set (which is cleared first)
+         * in a single pass of a cursor
          *
+         * @param results
          * @return
          */
-        std::tuple<Error, unsigned int> get_flags();
+        Error get_all(ResultSet &results);
 
         /**
-         * Lists all keys in the database
+         * Retrieves the database flags
          *
-         * @param ignore_duplicates
          * @return
          */
-        std::vector<mdb_result_t> list_keys(bool ignore_duplicates = true);
+        std::tuple<Error, unsigned int> get_flags();
 
         /**
-         * Simplified put which opens a new transaction, puts the value, and then returns.
+         * Retrieves a previously registered secondary index
          *
-         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
-         * attempting to expand the database
+         * If the index has not been registered, will return a nullptr
          *
-         * @param key
-         * @param key_length
-         * @param value
-         * @param value_length
-         * @param flags
+         * @param name
          * @return
          */
-        Error put(const void *key, size_t key_length, const void *value, size_t value_length, int flags = 0);
+        std::shared_ptr<Index> index(const std::string &name);
 
         /**
-         * Simplified put which opens a new transaction, puts the value, and then returns.
-         *
-         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
-         * attempting to expand the database
+         * Lists all keys in the database without reading their values
          *
-         * @tparam KeyType
-         * @tparam ValueType
-         * @param key
-         * @param value
-         * @param flags
+         * @param ignore_duplicates
          * @return
          */
-        template<typename KeyType, typename ValueType>
-        Error put(const KeyType &key, const ValueType &value, int flags = 0)
-        {
-            return put(key.data(), key.size(), value.data(), value.size(), flags);
-        }
+        std::vector<mdb_result_t> list_keys(bool ignore_duplicates = true);
 
         /**
-         * Opens a transaction in the database
+         * Lists all keys in the database into the result set (which is cleared first) without reading
+         * their values
          *
-         * @param readonly
+         * @param results
+         * @param ignore_duplicates
          * @return
          */
-        std::shared_ptr<Transaction> transaction(bool readonly = false);
+        Error list_keys(ResultSet &results, bool ignore_duplicates = true);
 
-      private:
         /**
-         * Opens the database within the specified environment
+         * Lists all values (including duplicates) in the database into the result set (which is cleared
+         * first) in key order without copying the keys
          *
-         * @param environment
-         * @param name
-         * @param flags
-         * @param enable_compression
+         * @param results
+         * @return
          */
-        explicit Database(
-            std::shared_ptr<Environment> &environment,
-            const std::string &name = "",
-            int flags = MDB_CREATE,
-            bool enable_compression = false);
-
-        MDB_dbi dbi = 0;
-
-        std::string name;
-
-        bool compression = false;
-
-        std::shared_ptr<Environment> environment;
-
-        mutable std::mutex mutex;
-    };
-
-    /**
-     * Provides a transaction model for use within a LMDB database
-     *
-     * Please note: A transaction will abort() automatically if it has not been committed before
-     * it leaves the scope it was created in. This helps to maintain database integrity as if
-     * your work in pushing to a transaction fails and throws, the transaction will always be
-     * reverted.
-     */
-    class Transaction
-    {
-        friend class Database;
-
-        friend class Cursor;
-
-      public:
-        Transaction() = delete;
-
-        ~Transaction();
+        Error list_values(ResultSet &results);
 
         /**
-         * Aborts the currently open transaction
+         * Simplified atomic read-modify-write which opens a new transaction, merges the operand
+         * into the current value of the key using the operator, and commits the transaction.
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param operand
+         * @param operand_length
+         * @param merge_operator
+         * @return
          */
-        void abort();
+        Error merge(
+            const void *key,
+            size_t key_length,
+            const void *operand,
+            size_t operand_length,
+            const merge_operator_t &merge_operator);
 
         /**
-         * Commits the currently open transaction
+         * Simplified atomic read-modify-write which opens a new transaction, merges the operand
+         * into the current value of the key using the operator, and commits the transaction.
          *
+         * @tparam KeyType
+         * @tparam OperandType
+         * @param key
+         * @param operand
+         * @param merge_operator
          * @return
          */
-        Error commit();
+        template<typename KeyType, typename OperandType>
+        Error merge(const KeyType &key, const OperandType &operand, const merge_operator_t &merge_operator)
+        {
+            return merge(key.data(), key.size(), operand.data(), operand.size(), merge_operator);
+        }
 
         /**
-         * Opens a LMDB cursor within the transaction
+         * Merges a batch of [key, operand] pairs in a single write transaction.
+         *
+         * Operands for the same key are first folded together in memory (in the order supplied)
+         * so that each key is read and written in the B-tree only once, in key order.
          *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param operations
+         * @param merge_operator
          * @return
          */
-        std::shared_ptr<Cursor> cursor();
+        Error merge_batch(
+            const std::vector<std::tuple<mdb_result_t, mdb_result_t>> &operations,
+            const merge_operator_t &merge_operator);
 
         /**
-         * Deletes the provided key
+         * Scans the keys in the range [begin, end) with multiple threads, each within its own read-only
+         * transaction, calling the visitor (concurrently) for every entry
          *
-         * @param key
-         * @param length
-         * @return
+         * The range is divided at estimated split points (see split_points()) into more ranges than
+         * there are threads, and idle threads take the next unscanned range so that skewed ranges do
+         * not leave threads waiting on the slowest one. The transactions of all of the threads are
+         * verified to be of the same snapshot (and reopened if a write was committed in between them)
+         * so the scan is consistent.
+         *
+         * If begin_length is 0, the scan starts at the first key; if end_length is 0, the scan continues
+         * to the end of the database; if threads is 0, the hardware concurrency is used
+         *
+         * Note: Like cursors, scans do not filter expired keys.
+         *
+         * @param visitor
+         * @param threads
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @return LMDB_CONFLICT if a consistent snapshot could not be obtained
          */
-        Error del(const void *key, size_t length);
+        Error parallel_scan(
+            const scan_visitor_t &visitor,
+            size_t threads = 0,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0);
 
         /**
-         * Deletes the provided key
+         * Deletes expired keys (oldest expiry first) in a single write transaction
          *
-         * @tparam KeyType
-         * @param key
-         * @return
+         * @param limit the maximum number of keys to delete
+         * @return [error, number of keys deleted]
          */
-        template<typename KeyType> Error del(const KeyType &key)
-        {
-            return del(key.data(), key.size());
-        }
+        std::tuple<Error, size_t> purge_expired(size_t limit = 1000);
 
         /**
-         * Deletes the provided key with the provided value.
+         * Simplified put which opens a new transaction, puts the value, and then returns.
          *
-         * If the database supports sorted duplicates and the data parameter is NULL, all of the duplicate data items
-         * for the key will be deleted. Otherwise, if the data parameter is non-NULL only the matching data item will
-         * be deleted.
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
          *
          * @param key
          * @param key_length
          * @param value
          * @param value_length
+         * @param flags
          * @return
          */
-        Error del(const void *key, size_t key_length, const void *value, size_t value_length);
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length, int flags = 0);
+
+        /**
+         * Simplified put which opens a new transaction, puts the value only if the key does not
+         * already exist, and then returns.
+         *
+         * See: Transaction::put_if_absent()
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return [error, current value if LMDB_KEYEXIST]
+         */
+        std::tuple<Error, mdb_result_t>
+            put_if_absent(const void *key, size_t key_length, const void *value, size_t value_length);
+
+        /**
+         * Simplified put which opens a new transaction, puts the value only if the key does not
+         * already exist, and then returns.
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @return [error, current value if LMDB_KEYEXIST]
+         */
+        template<typename KeyType, typename ValueType>
+        std::tuple<Error, mdb_result_t> put_if_absent(const KeyType &key, const ValueType &value)
+        {
+            return put_if_absent(key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Simplified put which opens a new transaction, puts the value only if the current version
+         * of the key matches the specified version, and then returns.
+         *
+         * See: Transaction::put_if_version()
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param expected_version
+         * @param value
+         * @param value_length
+         * @return [error, new version or current version if LMDB_CONFLICT, current value if LMDB_CONFLICT]
+         */
+        std::tuple<Error, uint64_t, mdb_result_t> put_if_version(
+            const void *key,
+            size_t key_length,
+            uint64_t expected_version,
+            const void *value,
+            size_t value_length);
+
+        /**
+         * Simplified put which opens a new transaction, puts the value only if the current version
+         * of the key matches the specified version, and then returns.
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param expected_version
+         * @param value
+         * @return [error, new version or current version if LMDB_CONFLICT, current value if LMDB_CONFLICT]
+         */
+        template<typename KeyType, typename ValueType>
+        std::tuple<Error, uint64_t, mdb_result_t>
+            put_if_version(const KeyType &key, uint64_t expected_version, const ValueType &value)
+        {
+            return put_if_version(key.data(), key.size(), expected_version, value.data(), value.size());
+        }
+
+        /**
+         * Simplified put which opens a new transaction, puts the value with the specified time-to-live,
+         * and then returns.
+         *
+         * Requires that enable_ttl() has been called on the database
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @param ttl
+         * @param flags
+         * @return
+         */
+        Error put(
+            const void *key,
+            size_t key_length,
+            const void *value,
+            size_t value_length,
+            std::chrono::milliseconds ttl,
+            int flags = 0);
+
+        /**
+         * Simplified put which opens a new transaction, puts the value with the specified time-to-live,
+         * and then returns.
+         *
+         * Requires that enable_ttl() has been called on the database
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @param ttl
+         * @param flags
+         * @return
+         */
+        template<typename KeyType, typename ValueType>
+        Error put(const KeyType &key, const ValueType &value, std::chrono::milliseconds ttl, int flags = 0)
+        {
+            return put(key.data(), key.size(), value.data(), value.size(), ttl, flags);
+        }
+
+        /**
+         * Simplified put which opens a new transaction, puts the value, and then returns.
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @param flags
+         * @return
+         */
+        template<typename KeyType, typename ValueType>
+        Error put(const KeyType &key, const ValueType &value, int flags = 0)
+        {
+            return put(key.data(), key.size(), value.data(), value.size(), flags);
+        }
+
+        /**
+         * Retrieves approximately uniform random entries (with replacement) into the result set (which
+         * is cleared first) from a single snapshot of the database
+         *
+         * Each sample descends the tree to a random position interpolated between the first and last keys
+         * (see split_points()). As sparse regions of the key space are landed in more often than dense ones,
+         * the group of entries at the position is then accepted with a probability proportional to its size
+         * over the gap to the preceding key, and an entry is chosen from the group at random. This takes
+         * O(n log N) as long as no region of the keys is more than 4 times denser than average.
+         *
+         * Denser keys are under-sampled, and fewer than n entries are returned if too many samples are
+         * rejected. Reversed keys cannot be sampled.
+         *
+         * @param n
+         * @param results
+         * @return
+         */
+        Error sample(size_t n, ResultSet &results);
+
+        /**
+         * Scans the keys in the range [begin, end) and copies only the entries for which the predicate
+         * returns true into the result set (which is cleared first)
+         *
+         * The predicate is called as bool(const MDB_val &key, const MDB_val &value) with the bytes in the
+         * memory map itself (values are still compressed if compression is enabled), so entries that do
+         * not match are never copied. See lmdb_predicates.hpp for built-in predicates.
+         *
+         * If begin_length is 0, the scan starts at the first key; if end_length is 0, the scan continues
+         * to the end of the database; if limit is 0, all matching entries are returned
+         *
+         * Note: Like cursors, scans do not filter expired keys.
+         *
+         * @tparam Predicate
+         * @param results
+         * @param predicate
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @param limit
+         * @return
+         */
+        template<typename Predicate>
+        Error scan(
+            ResultSet &results,
+            const Predicate &predicate,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0,
+            size_t limit = 0);
+
+        /**
+         * Scans the keys in the range [begin, end) and copies only the entries for which the predicate
+         * returns true into the result set (which is cleared first)
+         *
+         * @tparam Predicate
+         * @tparam KeyType
+         * @param results
+         * @param predicate
+         * @param begin
+         * @param end
+         * @param limit
+         * @return
+         */
+        template<typename Predicate, typename KeyType>
+        Error scan(
+            ResultSet &results,
+            const Predicate &predicate,
+            const KeyType &begin,
+            const KeyType &end,
+            size_t limit = 0)
+        {
+            return scan(results, predicate, begin.data(), begin.size(), end.data(), end.size(), limit);
+        }
+
+        /**
+         * Visits the keys in the range [begin, end) with the bytes in the memory map itself without
+         * reading their values, so that neither the values nor their overflow pages are touched
+         *
+         * If begin_length is 0, the scan starts at the first key; if end_length is 0, the scan continues
+         * to the end of the database
+         *
+         * @param visitor
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @param ignore_duplicates whether keys with duplicate values are visited only once
+         * @return
+         */
+        Error scan_keys(
+            const data_visitor_t &visitor,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0,
+            bool ignore_duplicates = true);
+
+        /**
+         * Visits the values (including duplicates) of the keys in the range [begin, end) with the bytes in
+         * the memory map itself (values are still compressed if compression is enabled) without copying
+         * the keys
+         *
+         * If begin_length is 0, the scan starts at the first key; if end_length is 0, the scan continues
+         * to the end of the database
+         *
+         * @param visitor
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @return
+         */
+        Error scan_values(
+            const data_visitor_t &visitor,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0);
+
+        /**
+         * Estimates the keys that divide the range [begin, end) into the specified number of partitions
+         * of approximately equal size
+         *
+         * LMDB does not expose its branch pages, so the split points are interpolated between the first
+         * and last keys of the range (numerically for MDB_INTEGERKEY databases, otherwise on the bytes
+         * following their common prefix) and then positioned on existing keys. The partitions are only
+         * as even as the keys are evenly distributed.
+         *
+         * @param partitions
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @return up to partitions - 1 distinct keys in ascending order
+         */
+        std::vector<mdb_result_t> split_points(
+            size_t partitions,
+            const void *begin = nullptr,
+            size_t begin_length = 0,
+            const void *end = nullptr,
+            size_t end_length = 0);
+
+        /**
+         * Starts a background thread that periodically purges expired keys in bounded chunks.
+         *
+         * To stay out of the way of other writers, a sweep is skipped (and an in progress sweep
+         * stops between chunks) while other R/W transactions are open in the environment.
+         *
+         * Requires that enable_ttl() has been called on the database
+         *
+         * @param interval how often to sweep for expired keys
+         * @param chunk_size the maximum number of keys to delete per write transaction
+         */
+        void start_ttl_sweeper(
+            std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+            size_t chunk_size = 1000);
+
+        /**
+         * Stops the background TTL sweeper thread, if running
+         */
+        void stop_ttl_sweeper();
+
+        /**
+         * Opens a transaction in the database
+         *
+         * @param readonly
+         * @return
+         */
+        std::shared_ptr<Transaction> transaction(bool readonly = false);
+
+        /**
+         * Opens a R/W transaction in the database, waiting no longer than the timeout specified for
+         * the other writers in this process that are ahead of us in the queue for the write transaction.
+         *
+         * Writers are granted the write transaction in priority order (first come, first served within
+         * a priority) so that interactive writes are not stuck behind queued bulk writes. Long running
+         * bulk writers should check Transaction::should_yield() at chunk boundaries and commit so that
+         * waiting writers of a higher priority can go next.
+         *
+         * Note: The deadline applies to writers within this process. LMDB does not provide a way to
+         * bound the wait for a write transaction held by another process.
+         *
+         * @param timeout if std::chrono::milliseconds::max(), waits without a deadline
+         * @param priority
+         * @return [error, transaction] LMDB_TIMEOUT if the deadline passed before the transaction was opened
+         */
+        std::tuple<Error, std::shared_ptr<Transaction>>
+            transaction(std::chrono::milliseconds timeout, WritePriority priority = WRITE_PRIORITY_NORMAL);
+
+        /**
+         * Returns if TTL support has been enabled for the database
+         *
+         * @return
+         */
+        [[nodiscard]] bool ttl_enabled() const;
+
+        /**
+         * Retrieves the current version of the key, 0 if the key does not exist (see enable_versioning())
+         *
+         * Requires that enable_versioning() has been called on the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, uint64_t> version(const void *key, size_t length);
+
+        /**
+         * Retrieves the current version of the key, 0 if the key does not exist (see enable_versioning())
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, uint64_t> version(const KeyType &key)
+        {
+            return version(key.data(), key.size());
+        }
+
+        /**
+         * Returns if version stamps have been enabled for the database
+         *
+         * @return
+         */
+        [[nodiscard]] bool versioned() const;
+
+      private:
+        /**
+         * Shared state between the database and its TTL sweeper thread so that the thread
+         * can be signalled to stop even if it outlives the database instance
+         */
+        struct ttl_sweeper_state_t
+        {
+            std::mutex mutex;
+
+            std::condition_variable cv;
+
+            bool stop = false;
+        };
+
+        /**
+         * Opens the database within the specified environment
+         *
+         * @param environment
+         * @param name
+         * @param flags
+         * @param enable_compression
+         */
+        explicit Database(
+            std::shared_ptr<Environment> &environment,
+            const std::string &name = "",
+            int flags = MDB_CREATE,
+            bool enable_compression = false);
+
+        MDB_dbi dbi = 0;
+
+        std::string name;
+
+        bool compression = false;
+
+        std::shared_ptr<Environment> environment;
+
+        ThreadSafeMap<std::string, std::shared_ptr<Index>> indexes;
+
+        std::shared_ptr<Database> ttl_db, ttl_keys_db;
+
+        std::shared_ptr<Database> versions_db;
+
+        std::shared_ptr<ttl_sweeper_state_t> ttl_sweeper_state;
+
+        std::thread ttl_sweeper;
+
+        mutable std::mutex mutex;
+    };
+
+    /**
+     * Provides a secondary index over a database that is maintained automatically as
+     * values are written to and deleted from the primary database
+     */
+    class Index
+    {
+        friend class Database;
+
+        friend class Transaction;
+
+      public:
+        Index() = delete;
+
+        /**
+         * Builds the index entries for all existing data in the primary database.
+         *
+         * The key space of the primary database is divided between multiple threads (see
+         * Database::split_points()) to run the extractor in parallel. Each thread reads its range in
+         * bounded chunks and writes each chunk to the index in a sorted write transaction before
+         * reading the next, so memory use stays bounded; any primary value that changed since it was
+         * read is re-extracted during the write so that the index is not left with stale entries.
+         *
+         * @param threads the number of threads to use, if 0, uses the hardware concurrency
+         * @return the first error encountered by any of the threads
+         */
+        Error backfill(size_t threads = 0);
+
+        /**
+         * Returns the number of primary keys referenced by the specified index key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        size_t count(const void *key, size_t length);
+
+        /**
+         * Returns the number of primary keys referenced by the specified index key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> size_t count(const KeyType &key)
+        {
+            return count(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the primary keys referenced by the specified index key without reading
+         * the primary database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::vector<mdb_result_t> lookup(const void *key, size_t length);
+
+        /**
+         * Retrieves the primary keys referenced by the specified index key without reading
+         * the primary database
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::vector<mdb_result_t> lookup(const KeyType &key)
+        {
+            return lookup(key.data(), key.size());
+        }
+
+        /**
+         * Returns the name of the index
+         *
+         * @return
+         */
+        [[nodiscard]] std::string name() const;
+
+        /**
+         * Scans the index for all index keys in the range [begin, end) and returns
+         * the matching [index key, primary key] pairs in index order
+         *
+         * If end_length is 0, the scan continues to the end of the index
+         *
+         * @param begin
+         * @param begin_length
+         * @param end
+         * @param end_length
+         * @param limit if non-zero, the maximum number of pairs to return
+         * @return
+         */
+        std::vector<std::tuple<mdb_result_t, mdb_result_t>> range(
+            const void *begin,
+            size_t begin_length,
+            const void *end,
+            size_t end_length,
+            size_t limit = 0);
+
+        /**
+         * Scans the index for all index keys in the range [begin, end) and returns
+         * the matching [index key, primary key] pairs in index order
+         *
+         * @tparam KeyType
+         * @param begin
+         * @param end
+         * @param limit if non-zero, the maximum number of pairs to return
+         * @return
+         */
+        template<typename KeyType>
+        std::vector<std::tuple<mdb_result_t, mdb_result_t>>
+            range(const KeyType &begin, const KeyType &end, size_t limit = 0)
+        {
+            return range(begin.data(), begin.size(), end.data(), end.size(), limit);
+        }
+
+      private:
+        /**
+         * Creates a new index over the named primary database
+         *
+         * @param environment
+         * @param primary the name of the primary database
+         * @param name
+         * @param extractor
+         */
+        Index(
+            std::shared_ptr<Environment> &environment,
+            std::string primary,
+            std::string name,
+            index_extractor_t extractor);
+
+        /**
+         * Adds the index entries for the primary key/value within the transaction specified
+         *
+         * @param txn
+         * @param key
+         * @param value
+         * @return
+         */
+        Error insert(MDB_txn *txn, const mdb_result_t &key, const mdb_result_t &value);
+
+        /**
+         * Removes the index entries for the primary key/value within the transaction specified
+         *
+         * @param txn
+         * @param key
+         * @param value
+         * @return
+         */
+        Error remove(MDB_txn *txn, const mdb_result_t &key, const mdb_result_t &value);
+
+        std::shared_ptr<Environment> environment;
+
+        std::shared_ptr<Database> db;
+
+        std::string primary, m_name;
+
+        index_extractor_t extractor;
+    };
+
+    /**
+     * A registration for notifications of committed changes to keys that start with
+     * a given prefix in a database. See: Environment::watch()
+     */
+    class Watch
+    {
+        friend class Environment;
+
+      public:
+        Watch() = delete;
+
+        /**
+         * Returns the number of matching commits that have occurred since the last wait
+         *
+         * @return
+         */
+        size_t pending() const;
+
+        /**
+         * Blocks until a transaction that changed a matching key has been committed since
+         * the last call, or until the timeout expires
+         *
+         * Note: Wakeups may be spurious in that a nested transaction that changed a matching key
+         * may have been aborted before its parent was committed.
+         *
+         * @param timeout
+         * @return true if a matching commit occurred, false if the timeout expired
+         */
+        bool wait(std::chrono::milliseconds timeout);
+
+      private:
+        /**
+         * Creates a new watch for the prefix in the database specified
+         *
+         * @param dbi
+         * @param prefix
+         */
+        Watch(MDB_dbi dbi, mdb_result_t prefix);
+
+        /**
+         * Returns if the key written in the database matches the watch
+         *
+         * @param key_dbi
+         * @param key
+         * @return
+         */
+        [[nodiscard]] bool matches(MDB_dbi key_dbi, const mdb_result_t &key) const;
+
+        /**
+         * Wakes any waiters of the watch
+         */
+        void trigger();
+
+        MDB_dbi dbi = 0;
+
+        mdb_result_t prefix;
+
+        size_t triggered = 0;
+
+        mutable std::mutex mutex;
+
+        std::condition_variable cv;
+    };
+
+    /**
+     * Provides a transaction model for use within a LMDB database
+     *
+     * Please note: A transaction will abort() automatically if it has not been committed before
+     * it leaves the scope it was created in. This helps to maintain database integrity as if
+     * your work in pushing to a transaction fails and throws, the transaction will always be
+     * reverted.
+     */
+    class Transaction
+    {
+        friend class Environment;
+
+        friend class Database;
+
+        friend class Cursor;
+
+        friend class Index;
+
+        friend class ReplicationFollower;
+
+        friend class OptimisticTransaction;
+
+        friend class ValueLog;
+
+        friend class BlobReader;
+
+        friend class BlobStore;
+
+        friend class DedupDatabase;
+
+        template<typename Traits> friend class Typed::Transaction;
+
+      public:
+        Transaction() = delete;
+
+        ~Transaction();
+
+        /**
+         * Aborts the currently open transaction
+         */
+        void abort();
+
+        /**
+         * Begins a nested (child) transaction within this transaction.
+         *
+         * Changes made in the child are only visible to this transaction once the child is committed, and
+         * aborting the child rolls back only the changes made within it. While a child transaction is open,
+         * this (parent) transaction must not be used. If this transaction is committed, LMDB commits any open
+         * children first; if it is aborted, any open children are aborted with it.
+         *
+         * Note: Not available for readonly transactions or environments opened with MDB_WRITEMAP
+         *
+         * @return
+         */
+        std::shared_ptr<Transaction> begin_nested();
+
+        /**
+         * Commits the currently open transaction
+         *
+         * @return
+         */
+        Error commit();
+
+        /**
+         * Replaces the value of the key with the desired value only if its current value matches the
+         * expected value. If it does not, LMDB_CONFLICT is returned along with the current value so
+         * that the caller does not need to look it up again.
+         *
+         * Any time-to-live already set for the key is kept.
+         *
+         * Note: Not intended for use with MDB_DUPSORT databases. You must check for MDB_MAP_FULL or
+         * MDB_TXN_FULL response values and handle those yourself as you will very likely need to abort
+         * the current transaction and expand the LMDB environment before re-attempting the transaction.
+         *
+         * @param key
+         * @param key_length
+         * @param expected if nullptr, the key is expected to not exist
+         * @param expected_length
+         * @param desired
+         * @param desired_length
+         * @return [error, current value if LMDB_CONFLICT]
+         */
+        std::tuple<Error, mdb_result_t> compare_and_swap(
+            const void *key,
+            size_t key_length,
+            const void *expected,
+            size_t expected_length,
+            const void *desired,
+            size_t desired_length);
+
+        /**
+         * Replaces the value of the key with the desired value only if its current value matches the
+         * expected value
+         *
+         * @tparam KeyType
+         * @tparam ExpectedType
+         * @tparam DesiredType
+         * @param key
+         * @param expected
+         * @param desired
+         * @return [error, current value if LMDB_CONFLICT]
+         */
+        template<typename KeyType, typename ExpectedType, typename DesiredType>
+        std::tuple<Error, mdb_result_t>
+            compare_and_swap(const KeyType &key, const ExpectedType &expected, const DesiredType &desired)
+        {
+            return compare_and_swap(
+                key.data(), key.size(), expected.data(), expected.size(), desired.data(), desired.size());
+        }
+
+        /**
+         * Opens a LMDB cursor within the transaction
+         *
+         * @return
+         */
+        std::shared_ptr<Cursor> cursor();
+
+        /**
+         * Deletes the provided key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Deletes the provided key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Deletes the provided key with the provided value.
+         *
+         * If the database supports sorted duplicates and the data parameter is NULL, all of the duplicate data items
+         * for the key will be deleted. Otherwise, if the data parameter is non-NULL only the matching data item will
+         * be deleted.
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return
+         */
+        Error del(const void *key, size_t key_length, const void *value, size_t value_length);
 
         /**
          * Deletes the provided key with the provided value.
@@ -575,64 +2209,246 @@ namespace LMDB
          * @param value
          * @return
          */
-        template<typename KeyType, typename ValueType> Error del(const KeyType &key, const ValueType &value)
+        template<typename KeyType, typename ValueType> Error del(const KeyType &key, const ValueType &value)
+        {
+            return del(key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Checks if the given key exists in the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const void *key, size_t length);
+
+        /**
+         * Checks if the given key exists in the database
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const KeyType &key)
+        {
+            return exists(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the value stored with the specified key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+
+        /**
+         * Retrieves the value stored with the specified key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        {
+            return get(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the value stored with the specified key, allocated from the memory resource
+         *
+         * @param key
+         * @param length
+         * @param resource
+         * @return
+         */
+        std::tuple<Error, mdb_pmr_result_t>
+            get(const void *key, size_t length, std::pmr::memory_resource *resource);
+
+        /**
+         * Retrieves the value stored with the specified key, allocated from the memory resource
+         *
+         * @tparam KeyType
+         * @param key
+         * @param resource
+         * @return
+         */
+        template<typename KeyType>
+        std::tuple<Error, mdb_pmr_result_t> get(const KeyType &key, std::pmr::memory_resource *resource)
+        {
+            return get(key.data(), key.size(), resource);
+        }
+
+        /**
+         * Returns the transaction ID
+         *
+         * If a 0 value is returned, the transaction is complete [abort() or commit() has been used]
+         *
+         * @return
+         */
+        [[nodiscard]] std::tuple<Error, size_t> id() const;
+
+        /**
+         * Merges the operand into the current value of the key using the operator and writes
+         * the result back to the key within the transaction
+         *
+         * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
+         * yourself as you will very likely need to abort the current transaction and expand
+         * the LMDB environment before re-attempting the transaction.
+         *
+         * @param key
+         * @param key_length
+         * @param operand
+         * @param operand_length
+         * @param merge_operator
+         * @return
+         */
+        Error merge(
+            const void *key,
+            size_t key_length,
+            const void *operand,
+            size_t operand_length,
+            const merge_operator_t &merge_operator);
+
+        /**
+         * Merges the operand into the current value of the key using the operator and writes
+         * the result back to the key within the transaction
+         *
+         * @tparam KeyType
+         * @tparam OperandType
+         * @param key
+         * @param operand
+         * @param merge_operator
+         * @return
+         */
+        template<typename KeyType, typename OperandType>
+        Error merge(const KeyType &key, const OperandType &operand, const merge_operator_t &merge_operator)
+        {
+            return merge(key.data(), key.size(), operand.data(), operand.size(), merge_operator);
+        }
+
+        /**
+         * Puts the specified value with the specified key in the database using the specified flag(s)
+         *
+         * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
+         * yourself as you will very likely need to abort the current transaction and expand
+         * the LMDB environment before re-attempting the transaction.
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @param flags
+         * @return
+         */
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length, int flags = 0);
+
+        /**
+         * Puts the specified value with the specified key in the database using the specified flag(s)
+         *
+         * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
+         * yourself as you will very likely need to abort the current transaction and expand
+         * the LMDB environment before re-attempting the transaction.
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @param flags
+         * @return
+         */
+        template<typename KeyType, typename ValueType>
+        Error put(const KeyType &key, const ValueType &value, int flags = 0)
         {
-            return del(key.data(), key.size(), value.data(), value.size());
+            return put(key.data(), key.size(), value.data(), value.size(), flags);
         }
 
         /**
-         * Checks if the given key exists in the database
+         * Puts the specified value with the specified key in the database only if the key does not
+         * already exist (MDB_NOOVERWRITE). If it does, LMDB_KEYEXIST is returned along with the
+         * existing value as provided by LMDB so that no second lookup is required.
+         *
+         * Keys that have expired (TTL) but have not yet been purged are treated as not existing.
+         *
+         * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
+         * yourself as you will very likely need to abort the current transaction and expand
+         * the LMDB environment before re-attempting the transaction.
          *
          * @param key
-         * @param length
-         * @return
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return [error, current value if LMDB_KEYEXIST]
          */
-        bool exists(const void *key, size_t length);
+        std::tuple<Error, mdb_result_t>
+            put_if_absent(const void *key, size_t key_length, const void *value, size_t value_length);
 
         /**
-         * Checks if the given key exists in the database
+         * Puts the specified value with the specified key in the database only if the key does not
+         * already exist
          *
          * @tparam KeyType
+         * @tparam ValueType
          * @param key
-         * @return
+         * @param value
+         * @return [error, current value if LMDB_KEYEXIST]
          */
-        template<typename KeyType> bool exists(const KeyType &key)
+        template<typename KeyType, typename ValueType>
+        std::tuple<Error, mdb_result_t> put_if_absent(const KeyType &key, const ValueType &value)
         {
-            return exists(key.data(), key.size());
+            return put_if_absent(key.data(), key.size(), value.data(), value.size());
         }
 
         /**
-         * Retrieves the value stored with the specified key
+         * Puts the specified value with the specified key in the database only if the current version
+         * of the key matches the specified version (use 0 to require that the key does not exist). If
+         * it does not, LMDB_CONFLICT is returned along with the current version and value.
+         *
+         * Requires that enable_versioning() has been called on the database
+         *
+         * Note: Not intended for use with MDB_DUPSORT databases. You must check for MDB_MAP_FULL or
+         * MDB_TXN_FULL response values and handle those yourself as you will very likely need to abort
+         * the current transaction and expand the LMDB environment before re-attempting the transaction.
          *
          * @param key
-         * @param length
-         * @return
+         * @param key_length
+         * @param expected_version
+         * @param value
+         * @param value_length
+         * @return [error, new version or current version if LMDB_CONFLICT, current value if LMDB_CONFLICT]
          */
-        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+        std::tuple<Error, uint64_t, mdb_result_t> put_if_version(
+            const void *key,
+            size_t key_length,
+            uint64_t expected_version,
+            const void *value,
+            size_t value_length);
 
         /**
-         * Retrieves the value stored with the specified key
+         * Puts the specified value with the specified key in the database only if the current version
+         * of the key matches the specified version
          *
          * @tparam KeyType
+         * @tparam ValueType
          * @param key
-         * @return
+         * @param expected_version
+         * @param value
+         * @return [error, new version or current version if LMDB_CONFLICT, current value if LMDB_CONFLICT]
          */
-        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        template<typename KeyType, typename ValueType>
+        std::tuple<Error, uint64_t, mdb_result_t>
+            put_if_version(const KeyType &key, uint64_t expected_version, const ValueType &value)
         {
-            return get(key.data(), key.size());
+            return put_if_version(key.data(), key.size(), expected_version, value.data(), value.size());
         }
 
-        /**
-         * Returns the transaction ID
-         *
-         * If a 0 value is returned, the transaction is complete [abort() or commit() has been used]
-         *
-         * @return
-         */
-        [[nodiscard]] std::tuple<Error, size_t> id() const;
-
         /**
          * Puts the specified value with the specified key in the database using the specified flag(s)
+         * that will expire after the specified time-to-live.
+         *
+         * Requires that enable_ttl() has been called on the database
          *
          * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
          * yourself as you will very likely need to abort the current transaction and expand
@@ -642,31 +2458,45 @@ namespace LMDB
          * @param key_length
          * @param value
          * @param value_length
+         * @param ttl
          * @param flags
          * @return
          */
-        Error put(const void *key, size_t key_length, const void *value, size_t value_length, int flags = 0);
+        Error put(
+            const void *key,
+            size_t key_length,
+            const void *value,
+            size_t value_length,
+            std::chrono::milliseconds ttl,
+            int flags = 0);
 
         /**
          * Puts the specified value with the specified key in the database using the specified flag(s)
+         * that will expire after the specified time-to-live.
          *
-         * Note: You must check for MDB_MAP_FULL or MDB_TXN_FULL response values and handle those
-         * yourself as you will very likely need to abort the current transaction and expand
-         * the LMDB environment before re-attempting the transaction.
+         * Requires that enable_ttl() has been called on the database
          *
          * @tparam KeyType
          * @tparam ValueType
          * @param key
          * @param value
+         * @param ttl
          * @param flags
          * @return
          */
         template<typename KeyType, typename ValueType>
-        Error put(const KeyType &key, const ValueType &value, int flags = 0)
+        Error put(const KeyType &key, const ValueType &value, std::chrono::milliseconds ttl, int flags = 0)
         {
-            return put(key.data(), key.size(), value.data(), value.size(), flags);
+            return put(key.data(), key.size(), value.data(), value.size(), ttl, flags);
         }
 
+        /**
+         * Returns if the transaction is a nested (child) transaction
+         *
+         * @return
+         */
+        [[nodiscard]] bool nested() const;
+
         /**
          * Returns if the transaction is readonly or not
          *
@@ -686,6 +2516,38 @@ namespace LMDB
          */
         void reset();
 
+        /**
+         * Returns if a writer of a higher priority than this transaction is waiting for the write
+         * transaction, in which case a bulk writer should commit at the next chunk boundary and open
+         * a new transaction (which queues behind the waiting writer).
+         *
+         * @return
+         */
+        [[nodiscard]] bool should_yield() const;
+
+        /**
+         * Retrieves the current version of the key, 0 if the key does not exist (see enable_versioning())
+         *
+         * Requires that enable_versioning() has been called on the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, uint64_t> version(const void *key, size_t length);
+
+        /**
+         * Retrieves the current version of the key, 0 if the key does not exist (see enable_versioning())
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, uint64_t> version(const KeyType &key)
+        {
+            return version(key.data(), key.size());
+        }
+
       private:
         /**
          * Constructs a new transaction in the environment specified
@@ -707,18 +2569,148 @@ namespace LMDB
             std::shared_ptr<Database> &database,
             bool readonly = false);
 
+        /**
+         * Constructs a new nested transaction within the parent transaction chain specified
+         *
+         * @param environment
+         * @param database
+         * @param ancestors the transaction handles of the parent, grandparent, etc.
+         */
+        Transaction(
+            std::shared_ptr<Environment> &environment,
+            std::shared_ptr<Database> &database,
+            std::vector<std::shared_ptr<MDB_txn *>> ancestors);
+
+        /**
+         * Constructs a new R/W transaction in the environment and database specified once the writer
+         * slot has already been acquired at the priority specified
+         *
+         * @param environment
+         * @param database
+         * @param priority
+         */
+        Transaction(
+            std::shared_ptr<Environment> &environment,
+            std::shared_ptr<Database> &database,
+            WritePriority priority);
+
+        /**
+         * Returns if this transaction, and every transaction it is nested within, is still open
+         *
+         * @return
+         */
+        [[nodiscard]] bool active() const;
+
         /**
          * Sets up the transaction via the multiple entry methods
          */
         void txn_setup();
 
+        /**
+         * Directs subsequent operations in the transaction to the specified database so that
+         * changes to multiple databases can be applied atomically
+         *
+         * @param database
+         */
+        void use(std::shared_ptr<Database> &database);
+
+        /**
+         * Records that the key was written in the transaction so that watches can be triggered
+         * once the transaction is committed
+         *
+         * @param key
+         */
+        void touch(const mdb_result_t &key);
+
+        /**
+         * Returns if the key has an expiry (TTL) that has already passed
+         *
+         * @param i_key
+         * @return
+         */
+        bool expired(MDB_val &i_key);
+
+        /**
+         * Replaces the expiry (TTL) of the key in the TTL databases
+         *
+         * @param key
+         * @param expires the expiry time in milliseconds since the epoch, if 0, the key does not expire
+         * @return
+         */
+        Error ttl_update(const mdb_result_t &key, uint64_t expires);
+
+        /**
+         * Stamps the key with the ID of this transaction as its version in the versions database
+         *
+         * @param key
+         * @param removed if true, the key no longer exists and its version is removed
+         * @return
+         */
+        Error version_update(const mdb_result_t &key, bool removed);
+
+        /**
+         * Writes the key/value to the database while maintaining the secondary indexes and TTL databases
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @param flags
+         * @param expires the expiry time in milliseconds since the epoch, if 0, the key does not expire,
+         *   if UINT64_MAX, the existing expiry of the key is kept
+         * @param existing if not nullptr, receives the existing value when the write fails with LMDB_KEYEXIST
+         * @return
+         */
+        Error write(
+            const void *key,
+            size_t key_length,
+            const void *value,
+            size_t value_length,
+            int flags,
+            uint64_t expires,
+            mdb_result_t *existing = nullptr);
+
+        /**
+         * Reads the current value of the key (if any) prior to a write so that
+         * the secondary indexes can be updated once the write succeeds
+         *
+         * @param i_key
+         * @return [found, value]
+         */
+        std::tuple<bool, mdb_result_t> index_prepare(MDB_val &i_key);
+
+        /**
+         * Updates the secondary indexes of the database after a successful write
+         *
+         * @param key
+         * @param old_found
+         * @param old_value
+         * @param new_value if nullptr, the key (or value) was deleted
+         * @return
+         */
+        Error index_update(
+            const mdb_result_t &key,
+            bool old_found,
+            const mdb_result_t &old_value,
+            const mdb_result_t *new_value);
+
         std::shared_ptr<MDB_txn *> txn;
 
+        std::vector<std::shared_ptr<MDB_txn *>> ancestors;
+
+        // the [dbi, key] pairs written by the transaction (and its children), only tracked when watched
+        std::shared_ptr<std::vector<std::tuple<MDB_dbi, mdb_result_t>>> touched;
+
         std::shared_ptr<Environment> environment;
 
         std::shared_ptr<Database> db;
 
         bool m_readonly = false;
+
+        WritePriority priority = WRITE_PRIORITY_NORMAL;
+
+        // if the transaction holds the in-process writer slot of the environment
+        bool writer_slot = false;
     };
 
     /**
@@ -783,6 +2775,44 @@ namespace LMDB
             return get(key.data(), key.size(), op);
         }
 
+        /**
+         * Retrieve key/value pairs by cursor, allocated from the memory resource.
+         *
+         * @param op
+         * @param resource
+         * @return
+         */
+        std::tuple<Error, mdb_pmr_result_t, mdb_pmr_result_t>
+            get(const MDB_cursor_op &op, std::pmr::memory_resource *resource);
+
+        /**
+         * Retrieve key/value pairs by cursor, allocated from the memory resource.
+         *
+         * @param key
+         * @param length
+         * @param op
+         * @param resource
+         * @return
+         */
+        std::tuple<Error, mdb_pmr_result_t, mdb_pmr_result_t>
+            get(const void *key, size_t length, const MDB_cursor_op &op, std::pmr::memory_resource *resource);
+
+        /**
+         * Retrieve key/value pairs by cursor, allocated from the memory resource.
+         *
+         * @tparam KeyType
+         * @param key
+         * @param op
+         * @param resource
+         * @return
+         */
+        template<typename KeyType>
+        std::tuple<Error, mdb_pmr_result_t, mdb_pmr_result_t>
+            get(const KeyType &key, const MDB_cursor_op &op, std::pmr::memory_resource *resource)
+        {
+            return get(key.data(), key.size(), op, resource);
+        }
+
         /**
          * Retrieve multiple values for a single key from the database
          *
@@ -809,6 +2839,35 @@ namespace LMDB
             return get_all(key.data(), key.size());
         }
 
+        /**
+         * Retrieve multiple values for a single key from the database into the result set (which
+         * is cleared first)
+         *
+         * Requires that MDB_DUPSORT was used when opening the database
+         *
+         * @param key
+         * @param length
+         * @param results
+         * @return
+         */
+        Error get_all(const void *key, size_t length, ResultSet &results);
+
+        /**
+         * Retrieve multiple values for a single key from the database into the result set (which
+         * is cleared first)
+         *
+         * Requires that MDB_DUPSORT was used when opening the database
+         *
+         * @tparam KeyType
+         * @param key
+         * @param results
+         * @return
+         */
+        template<typename KeyType> Error get_all(const KeyType &key, ResultSet &results)
+        {
+            return get_all(key.data(), key.size(), results);
+        }
+
         /**
          * Puts the specified value with the specified key in the database using the specified flag(s)
          * and places the cursor at the position of the new item or, near it upon failure.
@@ -879,6 +2938,173 @@ namespace LMDB
 
         bool m_readonly = false;
     };
+
+    template<typename T>
+    std::tuple<Error, Aggregate<T>> Database::aggregate(
+        const AggregateOptions<T> &options,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length)
+    {
+        // the number of values gathered before they are reduced
+        constexpr size_t batch_size = 256;
+
+        Aggregate<T> aggregate;
+
+        if (!options.key && compressed())
+        {
+            return {Error(LMDB_INCOMPATIBLE, "Compressed values cannot be aggregated", __LINE__, __FILE__), aggregate};
+        }
+
+        aggregate.histogram.resize((options.histogram_bounds.empty()) ? 0 : options.histogram_bounds.size() + 1);
+
+        aggregate.min = std::numeric_limits<T>::max();
+
+        aggregate.max = std::numeric_limits<T>::lowest();
+
+        T batch[batch_size];
+
+        size_t batched = 0;
+
+        const auto reduce = [&]()
+        {
+            auto sum = typename Aggregate<T>::sum_type(0);
+
+            auto min = aggregate.min, max = aggregate.max;
+
+            for (size_t i = 0; i < batched; ++i)
+            {
+                sum += batch[i];
+
+                min = (batch[i] < min) ? batch[i] : min;
+
+                max = (batch[i] > max) ? batch[i] : max;
+            }
+
+            aggregate.sum += sum;
+
+            aggregate.min = min;
+
+            aggregate.max = max;
+
+            for (size_t i = 0; i < batched && !aggregate.histogram.empty(); ++i)
+            {
+                const auto bucket =
+                    std::upper_bound(options.histogram_bounds.begin(), options.histogram_bounds.end(), batch[i])
+                    - options.histogram_bounds.begin();
+
+                aggregate.histogram[bucket]++;
+            }
+
+            aggregate.count += batched;
+
+            batched = 0;
+        };
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        MDB_val key = {begin_length, const_cast<void *>(begin)}, value, i_end = {end_length, const_cast<void *>(end)};
+
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT))
+        {
+            if (end_length != 0 && mdb_cmp(*txn->txn, dbi, &key, &i_end) >= 0)
+            {
+                break;
+            }
+
+            const auto &field = (options.key) ? key : value;
+
+            if (field.mv_size < options.offset + sizeof(T))
+            {
+                aggregate.skipped++;
+
+                continue;
+            }
+
+            const auto bytes = static_cast<const unsigned char *>(field.mv_data) + options.offset;
+
+            if (options.big_endian)
+            {
+                batch[batched++] = decode_big_endian<T>(bytes);
+            }
+            else
+            {
+                std::memcpy(&batch[batched++], bytes, sizeof(T));
+            }
+
+            if (batched == batch_size)
+            {
+                reduce();
+            }
+        }
+
+        reduce();
+
+        if (aggregate.count == 0)
+        {
+            aggregate.min = aggregate.max = 0;
+        }
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return {Error(result, mdb_strerror(result), __LINE__, __FILE__), aggregate};
+        }
+
+        return {Error(), aggregate};
+    }
+
+    template<typename Predicate>
+    Error Database::scan(
+        ResultSet &results,
+        const Predicate &predicate,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length,
+        size_t limit)
+    {
+        results.clear();
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        MDB_val key = {begin_length, const_cast<void *>(begin)}, value, i_end = {end_length, const_cast<void *>(end)};
+
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT))
+        {
+            if (end_length != 0 && mdb_cmp(*txn->txn, dbi, &key, &i_end) >= 0)
+            {
+                break;
+            }
+
+            if (!predicate(static_cast<const MDB_val &>(key), static_cast<const MDB_val &>(value)))
+            {
+                continue;
+            }
+
+            results.append(&key, &value);
+
+            if (limit != 0 && results.size() >= limit)
+            {
+                break;
+            }
+        }
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+        }
+
+        return Error();
+    }
 } // namespace LMDB
 
 #endif
@@ -0,0 +1,257 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_DEDUP_HPP
+#define LMDB_DEDUP_HPP
+
+#include "lmdb_cpp.hpp"
+
+namespace LMDB
+{
+    /**
+     * The space saved by a deduplicated database
+     */
+    struct DedupStats
+    {
+        // the number of distinct values stored in the content database
+        size_t contents = 0;
+
+        // the bytes of the deduplicated values as seen by the keys that reference them
+        size_t logical_bytes = 0;
+
+        // the bytes of the distinct values actually stored
+        size_t stored_bytes = 0;
+
+        // logical_bytes - stored_bytes
+        size_t saved_bytes = 0;
+    };
+
+    /**
+     * Stores values at or above the threshold only once, no matter how many keys they are put at.
+     *
+     * Such values are hashed (with CRC32C, using the SSE 4.2 or ARMv8 CRC instructions when the
+     * target supports them) and stored in "<database>:content" along with a count of the keys that
+     * reference them; the database itself only holds a reference to the content. Hash collisions
+     * are resolved by comparing the values byte for byte.
+     *
+     * Reference counts (and the statistics) are updated in the same transaction as the keys, so a
+     * deduplicated put() or del() can be combined with other changes in a caller's transaction.
+     *
+     * Note: The database must not have compression enabled and must only be written to via the
+     * deduplicated database. Secondary indexes and merge operators on the database see the references
+     * rather than the values. The content database counts against the maximum number of databases in
+     * the environment.
+     */
+    class DedupDatabase
+    {
+      public:
+        DedupDatabase() = delete;
+
+        /**
+         * Opens (or creates) the content database for the database
+         *
+         * Throws std::invalid_argument if the database (or its content database) has compression enabled
+         *
+         * @param db
+         * @param threshold values of at least this many bytes are deduplicated
+         */
+        explicit DedupDatabase(std::shared_ptr<Database> db, size_t threshold = 1024);
+
+        /**
+         * Deletes the key and releases its reference to the content of its value
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Deletes the key and releases its reference to the content of its value within the
+         * transaction (which must have been opened on the database)
+         *
+         * @param txn
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(Transaction &txn, const void *key, size_t length);
+
+        /**
+         * Deletes the key and releases its reference to the content of its value
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Checks if the key exists
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const void *key, size_t length);
+
+        /**
+         * Checks if the key exists
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const KeyType &key)
+        {
+            return exists(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the value of the key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+
+        /**
+         * Retrieves the value of the key within the transaction (which must have been opened on the database)
+         *
+         * @param txn
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(Transaction &txn, const void *key, size_t length);
+
+        /**
+         * Retrieves the value of the key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        {
+            return get(key.data(), key.size());
+        }
+
+        /**
+         * Puts the value at the key, deduplicating it if it is at or above the threshold
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return
+         */
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length);
+
+        /**
+         * Puts the value at the key within the transaction (which must have been opened on the database),
+         * deduplicating it if it is at or above the threshold
+         *
+         * @param txn
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return
+         */
+        Error put(Transaction &txn, const void *key, size_t key_length, const void *value, size_t value_length);
+
+        /**
+         * Puts the value at the key, deduplicating it if it is at or above the threshold
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @return
+         */
+        template<typename KeyType, typename ValueType> Error put(const KeyType &key, const ValueType &value)
+        {
+            return put(key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Retrieves the space saved by deduplication
+         *
+         * @return
+         */
+        std::tuple<Error, DedupStats> stats();
+
+      private:
+        /**
+         * Finds (or stores) the content of the value and adds a reference to it
+         *
+         * @param txn
+         * @param value
+         * @param length
+         * @return [error, the key of the content]
+         */
+        std::tuple<Error, mdb_result_t> acquire(Transaction &txn, const unsigned char *value, size_t length);
+
+        /**
+         * Removes a reference to the content, deleting the content once nothing references it
+         *
+         * @param txn
+         * @param content_key
+         * @return
+         */
+        Error release(Transaction &txn, const mdb_result_t &content_key);
+
+        /**
+         * Applies the changes to the statistics of the content database within the transaction
+         *
+         * @param txn
+         * @param contents
+         * @param logical_bytes
+         * @param stored_bytes
+         * @return
+         */
+        Error account(Transaction &txn, int64_t contents, int64_t logical_bytes, int64_t stored_bytes);
+
+        std::shared_ptr<Database> db;
+
+        std::shared_ptr<Database> content_db;
+
+        size_t threshold;
+    };
+} // namespace LMDB
+
+#endif // LMDB_DEDUP_HPP
@@ -35,6 +35,8 @@ namespace LMDB
     {
         SUCCESS = 0,
 
+        LMDB_TIMEOUT = -40003,
+        LMDB_CONFLICT = -40002,
         LMDB_ENV_NOT_OPEN = -40001,
         /**
          * Do not change LMDB values as they map directly to LMDB return codes
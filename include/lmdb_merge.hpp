@@ -0,0 +1,95 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_MERGE_HPP
+#define LMDB_MERGE_HPP
+
+#include "lmdb_cpp.hpp"
+
+namespace LMDB::Merge
+{
+    /**
+     * Encodes a signed 64-bit integer as a value for use with the integer merge operators
+     * (8 bytes, little-endian)
+     *
+     * @param value
+     * @return
+     */
+    mdb_result_t encode_int64(int64_t value);
+
+    /**
+     * Decodes a signed 64-bit integer value as used by the integer merge operators
+     *
+     * @param value
+     * @return
+     */
+    int64_t decode_int64(const mdb_result_t &value);
+
+    /**
+     * Adds the operand to the existing value, treating a missing key as 0
+     *
+     * Values and operands are signed 64-bit integers. See: encode_int64()
+     *
+     * @return
+     */
+    merge_operator_t add_int64();
+
+    /**
+     * Keeps the larger of the existing value and the operand
+     *
+     * Values and operands are signed 64-bit integers. See: encode_int64()
+     *
+     * @return
+     */
+    merge_operator_t max_int64();
+
+    /**
+     * Keeps the smaller of the existing value and the operand
+     *
+     * Values and operands are signed 64-bit integers. See: encode_int64()
+     *
+     * @return
+     */
+    merge_operator_t min_int64();
+
+    /**
+     * Appends the bytes of the operand to the end of the existing value
+     *
+     * @return
+     */
+    merge_operator_t append();
+
+    /**
+     * Treats the value as a sorted set of fixed-width items and adds the items in the operand
+     * to it, keeping the set sorted and free of duplicates
+     *
+     * @param width the size of each item in bytes
+     * @return
+     */
+    merge_operator_t set_union(size_t width);
+} // namespace LMDB::Merge
+
+#endif // LMDB_MERGE_HPP
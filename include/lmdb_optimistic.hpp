@@ -0,0 +1,248 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_OPTIMISTIC_HPP
+#define LMDB_OPTIMISTIC_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <functional>
+#include <map>
+
+namespace LMDB
+{
+    /**
+     * Provides an optimistic transaction across one or more databases of an environment
+     *
+     * Reads are served from a readonly snapshot and recorded in a read set (the version of each key
+     * if versioning is enabled on the database, otherwise a hash of its value) while writes are buffered
+     * in memory, so no write lock is held while the application computes its updates. commit() then
+     * opens a write transaction, validates that none of the keys read have changed since they were read,
+     * and applies the buffered writes. If any have changed, nothing is written and LMDB_CONFLICT is returned.
+     *
+     * Use OptimisticTransaction::run() to automatically retry the transaction on conflict.
+     *
+     * Note: Instances are not thread-safe and are intended to be used by a single thread. Reads of keys
+     * that have been written (or deleted) within the transaction return the buffered value.
+     */
+    class OptimisticTransaction
+    {
+      public:
+        OptimisticTransaction() = delete;
+
+        /**
+         * Creates a new optimistic transaction in the specified environment
+         *
+         * @param environment
+         */
+        explicit OptimisticTransaction(std::shared_ptr<Environment> environment);
+
+        ~OptimisticTransaction();
+
+        /**
+         * Discards the read set and buffered writes and releases the read snapshot
+         */
+        void abort();
+
+        /**
+         * Validates the read set and applies the buffered writes in a single write transaction
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * The transaction is complete once commit() returns, regardless of the result.
+         *
+         * @return LMDB_CONFLICT if a key that was read has since been changed
+         */
+        Error commit();
+
+        /**
+         * Buffers the deletion of the key from the database
+         *
+         * @param db
+         * @param key
+         * @param length
+         */
+        void del(const std::shared_ptr<Database> &db, const void *key, size_t length);
+
+        /**
+         * Buffers the deletion of the key from the database
+         *
+         * @tparam KeyType
+         * @param db
+         * @param key
+         */
+        template<typename KeyType> void del(const std::shared_ptr<Database> &db, const KeyType &key)
+        {
+            del(db, static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Checks if the given key exists in the database and records it in the read set
+         *
+         * @param db
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const std::shared_ptr<Database> &db, const void *key, size_t length);
+
+        /**
+         * Checks if the given key exists in the database and records it in the read set
+         *
+         * @tparam KeyType
+         * @param db
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const std::shared_ptr<Database> &db, const KeyType &key)
+        {
+            return exists(db, key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the value stored with the specified key and records it in the read set
+         *
+         * @param db
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const std::shared_ptr<Database> &db, const void *key, size_t length);
+
+        /**
+         * Retrieves the value stored with the specified key and records it in the read set
+         *
+         * @tparam KeyType
+         * @param db
+         * @param key
+         * @return
+         */
+        template<typename KeyType>
+        std::tuple<Error, mdb_result_t> get(const std::shared_ptr<Database> &db, const KeyType &key)
+        {
+            return get(db, key.data(), key.size());
+        }
+
+        /**
+         * Buffers a put of the specified value with the specified key in the database
+         *
+         * @param db
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         */
+        void put(
+            const std::shared_ptr<Database> &db,
+            const void *key,
+            size_t key_length,
+            const void *value,
+            size_t value_length);
+
+        /**
+         * Buffers a put of the specified value with the specified key in the database
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param db
+         * @param key
+         * @param value
+         */
+        template<typename KeyType, typename ValueType>
+        void put(const std::shared_ptr<Database> &db, const KeyType &key, const ValueType &value)
+        {
+            put(db, key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Runs the body in a new optimistic transaction and commits it, retrying the whole
+         * transaction (including the body) on conflict
+         *
+         * If the body returns an error, the transaction is aborted and the error returned.
+         *
+         * @param environment
+         * @param body
+         * @param max_attempts
+         * @return LMDB_CONFLICT if every attempt conflicted
+         */
+        static Error run(
+            std::shared_ptr<Environment> environment,
+            const std::function<Error(OptimisticTransaction &)> &body,
+            size_t max_attempts = 10);
+
+      private:
+        /**
+         * The state of a key when it was first read
+         */
+        struct read_entry_t
+        {
+            std::shared_ptr<Database> db;
+
+            bool found = false;
+
+            // the version of the key, or a hash of its value if versioning is not enabled
+            uint64_t stamp = 0;
+        };
+
+        /**
+         * A buffered write of a key
+         */
+        struct write_entry_t
+        {
+            std::shared_ptr<Database> db;
+
+            bool deleted = false;
+
+            mdb_result_t value;
+        };
+
+        /**
+         * Reads the current state of the key via the transaction
+         *
+         * @param txn
+         * @param db
+         * @param key
+         * @param value if not nullptr, receives the value of the key
+         * @return [error, found, stamp]
+         */
+        static std::tuple<Error, bool, uint64_t> read_stamp(
+            Transaction &txn,
+            std::shared_ptr<Database> db,
+            const mdb_result_t &key,
+            mdb_result_t *value);
+
+        std::shared_ptr<Environment> environment;
+
+        std::shared_ptr<Transaction> snapshot;
+
+        std::map<std::tuple<MDB_dbi, mdb_result_t>, read_entry_t> reads;
+
+        std::map<std::tuple<MDB_dbi, mdb_result_t>, write_entry_t> writes;
+    };
+} // namespace LMDB
+
+#endif // LMDB_OPTIMISTIC_HPP
@@ -0,0 +1,253 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_PREDICATES_HPP
+#define LMDB_PREDICATES_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Built-in predicates for Database::scan() that are evaluated directly on the bytes in the memory map.
+ *
+ * Byte comparisons and searches are done with memcmp() / memchr(), which the C library implements with
+ * the widest vector instructions available on the target, rather than byte by byte.
+ */
+namespace LMDB::Predicates
+{
+    /**
+     * Which part of an entry a predicate is evaluated on
+     */
+    enum PredicateTarget : uint8_t
+    {
+        PREDICATE_KEY = 0,
+        PREDICATE_VALUE = 1
+    };
+
+    /**
+     * Matches entries in which the bytes at the offset equal the expected bytes
+     */
+    class FieldEquals
+    {
+      public:
+        FieldEquals(PredicateTarget target, size_t offset, const void *expected, size_t length):
+            target(target), offset(offset)
+        {
+            const auto bytes = static_cast<const unsigned char *>(expected);
+
+            this->expected.assign(bytes, bytes + length);
+        }
+
+        template<typename BytesType>
+        FieldEquals(PredicateTarget target, size_t offset, const BytesType &expected):
+            FieldEquals(target, offset, expected.data(), expected.size())
+        {
+        }
+
+        bool operator()(const MDB_val &key, const MDB_val &value) const
+        {
+            const auto &field = (target == PREDICATE_KEY) ? key : value;
+
+            if (field.mv_size < offset + expected.size())
+            {
+                return false;
+            }
+
+            const auto bytes = static_cast<const unsigned char *>(field.mv_data) + offset;
+
+            return expected.empty() || std::memcmp(bytes, expected.data(), expected.size()) == 0;
+        }
+
+      private:
+        PredicateTarget target;
+
+        size_t offset;
+
+        mdb_result_t expected;
+    };
+
+    /**
+     * Matches entries in which the number at the offset is within [min, max]
+     *
+     * @tparam T
+     */
+    template<typename T> class FieldRange
+    {
+        static_assert(std::is_arithmetic_v<T>, "FieldRange requires an arithmetic type");
+
+      public:
+        /**
+         * @param target
+         * @param offset
+         * @param min
+         * @param max
+         * @param big_endian whether the number is stored big-endian (as keys usually are so that they sort),
+         * otherwise it is stored in the byte order of the host (as MDB_INTEGERKEY keys are)
+         */
+        FieldRange(PredicateTarget target, size_t offset, T min, T max, bool big_endian = false):
+            target(target), offset(offset), min(min), max(max), big_endian(big_endian)
+        {
+        }
+
+        bool operator()(const MDB_val &key, const MDB_val &value) const
+        {
+            const auto &field = (target == PREDICATE_KEY) ? key : value;
+
+            if (field.mv_size < offset + sizeof(T))
+            {
+                return false;
+            }
+
+            const auto bytes = static_cast<const unsigned char *>(field.mv_data) + offset;
+
+            T number;
+
+            if (big_endian)
+            {
+                number = decode_big_endian<T>(bytes);
+            }
+            else
+            {
+                std::memcpy(&number, bytes, sizeof(T));
+            }
+
+            return number >= min && number <= max;
+        }
+
+      private:
+        PredicateTarget target;
+
+        size_t offset;
+
+        T min, max;
+
+        bool big_endian;
+    };
+
+    /**
+     * Matches entries that contain the pattern anywhere in the key or value
+     */
+    class Contains
+    {
+      public:
+        Contains(PredicateTarget target, const void *pattern, size_t length): target(target)
+        {
+            const auto bytes = static_cast<const unsigned char *>(pattern);
+
+            this->pattern.assign(bytes, bytes + length);
+        }
+
+        template<typename BytesType>
+        Contains(PredicateTarget target, const BytesType &pattern): Contains(target, pattern.data(), pattern.size())
+        {
+        }
+
+        bool operator()(const MDB_val &key, const MDB_val &value) const
+        {
+            const auto &field = (target == PREDICATE_KEY) ? key : value;
+
+            if (pattern.empty())
+            {
+                return true;
+            }
+
+            if (field.mv_size < pattern.size())
+            {
+                return false;
+            }
+
+            auto position = static_cast<const unsigned char *>(field.mv_data);
+
+            const auto last = position + (field.mv_size - pattern.size());
+
+            // find each candidate by its first byte, then compare the rest
+            while (position <= last)
+            {
+                position =
+                    static_cast<const unsigned char *>(std::memchr(position, pattern[0], (last - position) + 1));
+
+                if (position == nullptr)
+                {
+                    return false;
+                }
+
+                if (std::memcmp(position + 1, pattern.data() + 1, pattern.size() - 1) == 0)
+                {
+                    return true;
+                }
+
+                ++position;
+            }
+
+            return false;
+        }
+
+      private:
+        PredicateTarget target;
+
+        mdb_result_t pattern;
+    };
+
+    /**
+     * Matches entries that match all of the predicates
+     *
+     * @tparam Predicates
+     * @param predicates
+     * @return
+     */
+    template<typename... Predicates> auto all_of(Predicates... predicates)
+    {
+        return [=](const MDB_val &key, const MDB_val &value) { return (predicates(key, value) && ...); };
+    }
+
+    /**
+     * Matches entries that match any of the predicates
+     *
+     * @tparam Predicates
+     * @param predicates
+     * @return
+     */
+    template<typename... Predicates> auto any_of(Predicates... predicates)
+    {
+        return [=](const MDB_val &key, const MDB_val &value) { return (predicates(key, value) || ...); };
+    }
+
+    /**
+     * Matches entries that do not match the predicate
+     *
+     * @tparam Predicate
+     * @param predicate
+     * @return
+     */
+    template<typename Predicate> auto negate(Predicate predicate)
+    {
+        return [=](const MDB_val &key, const MDB_val &value) { return !predicate(key, value); };
+    }
+} // namespace LMDB::Predicates
+
+#endif // LMDB_PREDICATES_HPP
@@ -0,0 +1,182 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_REPLICATION_HPP
+#define LMDB_REPLICATION_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <chrono>
+#include <istream>
+#include <mutex>
+#include <ostream>
+
+namespace LMDB
+{
+    /**
+     * Describes how far a follower is behind its leader
+     */
+    struct ReplicationLag
+    {
+        // the sequence number of the last change applied by the follower
+        size_t applied_sequence = 0;
+
+        // the most recent sequence number the leader has reported
+        size_t leader_sequence = 0;
+
+        // the number of changes the follower has yet to apply
+        size_t records = 0;
+
+        // how long ago the last change applied was shipped by the leader, or 0 if the follower is caught up
+        std::chrono::milliseconds time = std::chrono::milliseconds(0);
+    };
+
+    /**
+     * Ships the change log of an environment to a follower environment in another process
+     * via any byte stream (such as a regular file, a named pipe, or a socket wrapped in a stream)
+     *
+     * Requires that the change log has been enabled on the environment with values included.
+     * See: Environment::enable_change_log()
+     */
+    class ReplicationLeader
+    {
+      public:
+        ReplicationLeader() = delete;
+
+        /**
+         * Creates a new leader that ships the changes after the specified sequence number
+         *
+         * @param environment
+         * @param from_sequence the changes after this sequence number will be shipped
+         */
+        explicit ReplicationLeader(std::shared_ptr<Environment> environment, size_t from_sequence = 0);
+
+        /**
+         * Writes the next batch of changes from the change log to the stream followed by a heartbeat
+         * that reports the latest sequence number of the leader so the follower can compute its lag.
+         *
+         * If acknowledge is set, the shipped changes are truncated from the change log once they
+         * have been written to the stream.
+         *
+         * @param output
+         * @param max_records the maximum number of changes to ship
+         * @param acknowledge
+         * @return [error, number of changes shipped]
+         */
+        std::tuple<Error, size_t> ship(std::ostream &output, size_t max_records = 1000, bool acknowledge = false);
+
+        /**
+         * Returns the sequence number of the last change shipped
+         *
+         * @return
+         */
+        [[nodiscard]] size_t shipped_sequence() const;
+
+      private:
+        std::shared_ptr<Environment> environment;
+
+        size_t shipped = 0;
+
+        mutable std::mutex mutex;
+    };
+
+    /**
+     * Applies the change stream written by a ReplicationLeader to a follower environment
+     *
+     * The sequence number of the last change applied is stored in the "__replication" database
+     * of the follower in the same transaction as the changes themselves so that changes are applied
+     * exactly once even if the follower restarts and the stream is replayed.
+     *
+     * Note: Databases that require flags (such as MDB_DUPSORT) or compression must be opened
+     * on the follower with the same options before changes to them are applied.
+     */
+    class ReplicationFollower
+    {
+      public:
+        ReplicationFollower() = delete;
+
+        /**
+         * Creates a new follower for the specified environment
+         *
+         * @param environment
+         */
+        explicit ReplicationFollower(std::shared_ptr<Environment> environment);
+
+        /**
+         * Reads changes from the stream and applies them in batched write transactions until the
+         * stream has no further complete frames or the maximum number of changes has been applied
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the batch after
+         * attempting to expand the database
+         *
+         * If the stream contains an invalid frame or change (including a frame whose checksum does not
+         * match), the changes before it are applied, the stream is left positioned at it, and
+         * LMDB_CORRUPTED is returned.
+         *
+         * @param input
+         * @param batch_size the maximum number of changes to apply per write transaction
+         * @param max_records if non-zero, the maximum number of changes to apply before returning
+         * @return [error, number of changes applied]
+         */
+        std::tuple<Error, size_t> apply(std::istream &input, size_t batch_size = 1000, size_t max_records = 0);
+
+        /**
+         * Returns the sequence number of the last change applied
+         *
+         * @return
+         */
+        [[nodiscard]] size_t applied_sequence() const;
+
+        /**
+         * Returns how far the follower is behind its leader, as of the last heartbeat received
+         *
+         * @return
+         */
+        [[nodiscard]] ReplicationLag lag() const;
+
+      private:
+        /**
+         * Applies the batch of changes in a single write transaction
+         *
+         * @param batch
+         * @return
+         */
+        Error apply_batch(const std::vector<std::tuple<uint64_t, ChangeRecord>> &batch);
+
+        std::shared_ptr<Environment> environment;
+
+        std::shared_ptr<Database> state_db;
+
+        size_t applied = 0, leader_sequence = 0;
+
+        // when the last change applied was shipped by the leader (in milliseconds since the epoch)
+        uint64_t applied_time = 0;
+
+        mutable std::mutex mutex;
+    };
+} // namespace LMDB
+
+#endif // LMDB_REPLICATION_HPP
@@ -0,0 +1,403 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_SHARDED_HPP
+#define LMDB_SHARDED_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <queue>
+#include <string>
+
+namespace LMDB
+{
+    class ShardedDatabase;
+
+    /**
+     * Orders keys the way LMDB does for a database with the specified flags: numerically for
+     * MDB_INTEGERKEY, by their bytes from last to first for MDB_REVERSEKEY, otherwise lexicographically
+     */
+    struct ShardKeyCompare
+    {
+        unsigned int flags = 0;
+
+        /**
+         * Compares the keys
+         *
+         * @param a
+         * @param b
+         * @return < 0 if a sorts before b, 0 if they are equal, > 0 if a sorts after b
+         */
+        [[nodiscard]] int compare(const mdb_result_t &a, const mdb_result_t &b) const;
+
+        bool operator()(const mdb_result_t &a, const mdb_result_t &b) const
+        {
+            return compare(a, b) < 0;
+        }
+    };
+
+    /**
+     * Iterates over the key/value pairs of every shard of a sharded database in key order
+     * by merging the (ordered) cursors of each shard
+     *
+     * Each shard is read from its own readonly snapshot that is held open for the lifetime
+     * of the iterator.
+     */
+    class ShardedIterator
+    {
+        friend class ShardedDatabase;
+
+      public:
+        ShardedIterator() = delete;
+
+        /**
+         * Retrieves the next key/value pair in key order
+         *
+         * @return [error, key, value] LMDB_NOTFOUND once all of the shards have been exhausted
+         */
+        std::tuple<Error, mdb_result_t, mdb_result_t> next();
+
+      private:
+        /**
+         * The current key/value pair of a shard cursor
+         */
+        struct head_t
+        {
+            mdb_result_t key, value;
+
+            size_t shard = 0;
+        };
+
+        /**
+         * Orders the heads so that the smallest key (and then the lowest shard) is at the top of the queue
+         */
+        struct head_greater_t
+        {
+            ShardKeyCompare compare;
+
+            bool operator()(const head_t &a, const head_t &b) const
+            {
+                const auto result = compare.compare(a.key, b.key);
+
+                return (result != 0) ? result > 0 : a.shard > b.shard;
+            }
+        };
+
+        /**
+         * Opens a cursor in each of the databases positioned at the first key at or after the
+         * beginning key specified
+         *
+         * @param databases
+         * @param compare the order of the keys in the databases
+         * @param begin if nullptr, starts from the first key of each shard
+         * @param length
+         */
+        ShardedIterator(
+            const std::vector<std::shared_ptr<Database>> &databases,
+            ShardKeyCompare compare,
+            const void *begin,
+            size_t length);
+
+        /**
+         * Moves the cursor of the shard and pushes its new position (if any)
+         *
+         * @param shard
+         * @param error
+         * @param key
+         * @param value
+         */
+        void push(size_t shard, const Error &error, mdb_result_t key, mdb_result_t value);
+
+        std::vector<std::shared_ptr<Transaction>> transactions;
+
+        std::vector<std::shared_ptr<Cursor>> cursors;
+
+        std::priority_queue<head_t, std::vector<head_t>, head_greater_t> heads;
+    };
+
+    /**
+     * Partitions the keys of a database across multiple environments (separate files) so that
+     * writes to different shards can proceed in parallel as LMDB permits only one writer per environment
+     *
+     * Keys are assigned to shards either by a (stable) hash of the key or by ranges of keys.
+     *
+     * Note: Operations that span shards (such as put_batch) are atomic per shard only.
+     */
+    class ShardedDatabase
+    {
+      public:
+        ShardedDatabase() = delete;
+
+        /**
+         * Creates a hash partitioned database across the environments specified
+         *
+         * @param environments
+         * @param name
+         * @param enable_compression
+         * @param flags
+         */
+        explicit ShardedDatabase(
+            std::vector<std::shared_ptr<Environment>> environments,
+            const std::string &name = "",
+            bool enable_compression = false,
+            int flags = 0);
+
+        /**
+         * Creates a range partitioned database across the environments specified. Shard i holds
+         * the keys less than split_keys[i] (and at or after split_keys[i - 1]) in the order of the
+         * keys of the database (see ShardKeyCompare).
+         *
+         * @param environments
+         * @param split_keys the sorted boundaries between the shards, one fewer than the number of environments
+         * @param name
+         * @param enable_compression
+         * @param flags
+         */
+        ShardedDatabase(
+            std::vector<std::shared_ptr<Environment>> environments,
+            std::vector<mdb_result_t> split_keys,
+            const std::string &name = "",
+            bool enable_compression = false,
+            int flags = 0);
+
+        /**
+         * Opens (or creates) a hash partitioned database with the specified number of shards where
+         * each shard is stored in its own environment at "<path>.<shard>"
+         *
+         * @param path
+         * @param shards
+         * @param name
+         * @param enable_compression
+         * @param flags
+         * @return
+         */
+        static std::shared_ptr<ShardedDatabase> open(
+            const std::string &path,
+            size_t shards,
+            const std::string &name = "",
+            bool enable_compression = false,
+            int flags = 0);
+
+        /**
+         * Returns how many key/value pairs currently exist across all of the shards
+         *
+         * @return
+         */
+        size_t count();
+
+        /**
+         * Retrieves the database of the specified shard
+         *
+         * @param shard
+         * @return
+         */
+        std::shared_ptr<Database> database(size_t shard) const;
+
+        /**
+         * Deletes the given key and its value from its shard
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Deletes the given key and its value from its shard
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Deletes the given keys with a single write transaction per shard, with the shards
+         * written in parallel. Keys that do not exist are ignored.
+         *
+         * @param keys
+         * @return
+         */
+        Error del_batch(const std::vector<mdb_result_t> &keys);
+
+        /**
+         * Returns if the key exists in its shard
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const void *key, size_t length);
+
+        /**
+         * Returns if the key exists in its shard
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const KeyType &key)
+        {
+            return exists(key.data(), key.size());
+        }
+
+        /**
+         * Retrieves the value at the specified key from its shard
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+
+        /**
+         * Retrieves the value at the specified key from its shard
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        {
+            return get(key.data(), key.size());
+        }
+
+        /**
+         * Creates an iterator over the key/value pairs of all of the shards in key order
+         *
+         * @param begin if nullptr, starts from the first key
+         * @param length
+         * @return
+         */
+        std::shared_ptr<ShardedIterator> iterator(const void *begin = nullptr, size_t length = 0);
+
+        /**
+         * Creates an iterator over the key/value pairs of all of the shards in key order
+         * starting from the first key at or after the key specified
+         *
+         * @tparam KeyType
+         * @param begin
+         * @return
+         */
+        template<typename KeyType> std::shared_ptr<ShardedIterator> iterator(const KeyType &begin)
+        {
+            return iterator(begin.data(), begin.size());
+        }
+
+        /**
+         * Puts the value at the specified key in its shard
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @param flags
+         * @return
+         */
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length, int flags = 0);
+
+        /**
+         * Puts the value at the specified key in its shard
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @param flags
+         * @return
+         */
+        template<typename KeyType, typename ValueType>
+        Error put(const KeyType &key, const ValueType &value, int flags = 0)
+        {
+            return put(key.data(), key.size(), value.data(), value.size(), flags);
+        }
+
+        /**
+         * Puts the [key, value] pairs with a single write transaction per shard, with the shards
+         * written in parallel
+         *
+         * @param pairs
+         * @return
+         */
+        Error put_batch(const std::vector<std::tuple<mdb_result_t, mdb_result_t>> &pairs);
+
+        /**
+         * Returns the shard that the key is stored in
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        [[nodiscard]] size_t shard(const void *key, size_t length) const;
+
+        /**
+         * Returns the shard that the key is stored in
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> [[nodiscard]] size_t shard(const KeyType &key) const
+        {
+            return shard(key.data(), key.size());
+        }
+
+        /**
+         * Returns the number of shards
+         *
+         * @return
+         */
+        [[nodiscard]] size_t shards() const;
+
+      private:
+        /**
+         * A write to apply to a shard, if value is nullptr the key is deleted
+         */
+        typedef std::tuple<const mdb_result_t *, const mdb_result_t *> batch_op_t;
+
+        /**
+         * Applies the writes to each shard in a single write transaction per shard, running
+         * the shards in parallel
+         *
+         * @param ops
+         * @return
+         */
+        Error apply_batch(const std::vector<batch_op_t> &ops);
+
+        std::vector<std::shared_ptr<Environment>> environments;
+
+        std::vector<std::shared_ptr<Database>> databases;
+
+        std::vector<mdb_result_t> split_keys;
+
+        ShardKeyCompare compare;
+    };
+} // namespace LMDB
+
+#endif // LMDB_SHARDED_HPP
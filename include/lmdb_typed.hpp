@@ -0,0 +1,817 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_TYPED_HPP
+#define LMDB_TYPED_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A typed layer over LMDB::Database where the key codec, value codec, compression and duplicate mode
+ * are compile-time traits rather than runtime properties of the database.
+ *
+ * For a database without indexes, TTLs, versioning, watches or a change log, reads and writes go
+ * straight to mdb_get() / mdb_put() with the encoded key and value: there is no check of the
+ * compression setting and values are only (strictly) uncompressed when the traits say they are
+ * compressed. Databases that do have such features use the regular transaction methods so that
+ * they are kept up to date.
+ *
+ * Duplicate sorted traits add a multimap API: counting, visiting and bulk reading the values of a key.
+ */
+namespace LMDB::Typed
+{
+    // the DBI flags that are persisted with a database and must match the traits
+    inline constexpr unsigned int persistent_flags =
+        MDB_REVERSEKEY | MDB_DUPSORT | MDB_INTEGERKEY | MDB_DUPFIXED | MDB_INTEGERDUP | MDB_REVERSEDUP;
+
+    /**
+     * Encodes raw bytes as themselves
+     */
+    struct BytesCodec
+    {
+        typedef mdb_result_t value_type;
+
+        // the flags required when used as the key codec
+        static constexpr unsigned int key_flags = 0;
+
+        // the flags required when used as the value codec of a duplicate sorted database
+        static constexpr unsigned int dup_flags = 0;
+
+        static MDB_val encode(const value_type &value)
+        {
+            return {value.size(), const_cast<unsigned char *>(value.data())};
+        }
+
+        static bool decode(const MDB_val &value, value_type &result)
+        {
+            const auto bytes = static_cast<const unsigned char *>(value.mv_data);
+
+            result.assign(bytes, bytes + value.mv_size);
+
+            return true;
+        }
+    };
+
+    /**
+     * Encodes a string as its characters
+     */
+    struct StringCodec
+    {
+        typedef std::string value_type;
+
+        static constexpr unsigned int key_flags = 0;
+
+        static constexpr unsigned int dup_flags = 0;
+
+        static MDB_val encode(const value_type &value)
+        {
+            return {value.size(), const_cast<char *>(value.data())};
+        }
+
+        static bool decode(const MDB_val &value, value_type &result)
+        {
+            result.assign(static_cast<const char *>(value.mv_data), value.mv_size);
+
+            return true;
+        }
+    };
+
+    /**
+     * Encodes a trivially copyable type as its (native) in-memory representation
+     *
+     * @tparam T
+     */
+    template<typename T> struct FixedCodec
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "FixedCodec requires a trivially copyable type");
+
+        typedef T value_type;
+
+        static constexpr unsigned int key_flags = 0;
+
+        static constexpr unsigned int dup_flags = MDB_DUPFIXED;
+
+        static MDB_val encode(const value_type &value)
+        {
+            return {sizeof(T), const_cast<T *>(&value)};
+        }
+
+        static bool decode(const MDB_val &value, value_type &result)
+        {
+            if (value.mv_size != sizeof(T))
+            {
+                return false;
+            }
+
+            std::memcpy(&result, value.mv_data, sizeof(T));
+
+            return true;
+        }
+    };
+
+    /**
+     * Encodes a native integer that LMDB compares numerically (MDB_INTEGERKEY / MDB_INTEGERDUP)
+     *
+     * @tparam T
+     */
+    template<typename T> struct IntegerCodec : FixedCodec<T>
+    {
+        static_assert(
+            std::is_same_v<T, unsigned int> || std::is_same_v<T, size_t>,
+            "LMDB integer keys must be unsigned int or size_t");
+
+        static constexpr unsigned int key_flags = MDB_INTEGERKEY;
+
+        static constexpr unsigned int dup_flags = MDB_DUPFIXED | MDB_INTEGERDUP;
+    };
+
+    /**
+     * The compile-time description of a database
+     *
+     * @tparam KeyCodec
+     * @tparam ValueCodec
+     * @tparam Compressed whether values are snappy compressed
+     * @tparam DupSort whether keys may have multiple (sorted) values
+     */
+    template<typename KeyCodec, typename ValueCodec, bool Compressed = false, bool DupSort = false> struct Traits
+    {
+        static_assert(!(Compressed && DupSort), "Compressed values would not sort as duplicates");
+
+        typedef KeyCodec key_codec;
+
+        typedef ValueCodec value_codec;
+
+        typedef typename KeyCodec::value_type key_type;
+
+        typedef typename ValueCodec::value_type value_type;
+
+        static constexpr bool compressed = Compressed;
+
+        static constexpr bool dupsort = DupSort;
+
+        static constexpr unsigned int flags = KeyCodec::key_flags | (DupSort ? MDB_DUPSORT | ValueCodec::dup_flags : 0);
+    };
+
+    namespace detail
+    {
+        /**
+         * Snappy compresses the input into the output
+         *
+         * @param input
+         * @param output
+         */
+        void compress(const MDB_val &input, std::string &output);
+
+        /**
+         * Uncompresses the snappy compressed input into the output
+         *
+         * @param input
+         * @param output
+         * @return whether the input was valid snappy data
+         */
+        bool uncompress(const MDB_val &input, std::string &output);
+    } // namespace detail
+
+    template<typename Traits> class Database;
+
+    /**
+     * A transaction on a typed database
+     *
+     * @tparam Traits
+     */
+    template<typename Traits> class Transaction
+    {
+        friend class Database<Traits>;
+
+      public:
+        typedef typename Traits::key_type key_type;
+
+        typedef typename Traits::value_type value_type;
+
+        Transaction() = delete;
+
+        /**
+         * Aborts the transaction
+         */
+        void abort()
+        {
+            txn->abort();
+        }
+
+        /**
+         * Commits the transaction
+         *
+         * @return
+         */
+        Error commit()
+        {
+            return txn->commit();
+        }
+
+        /**
+         * Counts the values of the key via mdb_cursor_count()
+         *
+         * @param key
+         * @return [error, count]
+         */
+        std::tuple<Error, size_t> count(const key_type &key)
+        {
+            static_assert(Traits::dupsort, "Counting values requires a duplicate sorted database");
+
+            MDB_cursor *cursor = nullptr;
+
+            MDB_val i_value;
+
+            auto error = seek(cursor, key, nullptr, i_value);
+
+            size_t count = 0;
+
+            if (!error)
+            {
+                const auto result = mdb_cursor_count(cursor, &count);
+
+                error = Error(result, mdb_strerror(result), __LINE__, __FILE__);
+
+                mdb_cursor_close(cursor);
+            }
+
+            return {error, count};
+        }
+
+        /**
+         * Deletes the key (and all of its values)
+         *
+         * @param key
+         * @return
+         */
+        Error del(const key_type &key)
+        {
+            auto i_key = Traits::key_codec::encode(key);
+
+            if (!plain_writes)
+            {
+                return txn->del(static_cast<const void *>(i_key.mv_data), i_key.mv_size);
+            }
+
+            const auto result = mdb_del(*txn->txn, db->dbi, &i_key, nullptr);
+
+            return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+        }
+
+        /**
+         * Deletes a single value of the key
+         *
+         * @param key
+         * @param value
+         * @return
+         */
+        Error del(const key_type &key, const value_type &value)
+        {
+            static_assert(Traits::dupsort, "Deleting a single value requires a duplicate sorted database");
+
+            auto i_key = Traits::key_codec::encode(key);
+
+            auto i_value = Traits::value_codec::encode(value);
+
+            if (!plain_writes)
+            {
+                return txn->del(
+                    static_cast<const void *>(i_key.mv_data), i_key.mv_size, i_value.mv_data, i_value.mv_size);
+            }
+
+            const auto result = mdb_del(*txn->txn, db->dbi, &i_key, &i_value);
+
+            return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+        }
+
+        /**
+         * Visits the values of the key in order with the bytes in the memory map itself
+         *
+         * For DUPFIXED databases, the values are read a page at a time via MDB_GET_MULTIPLE and
+         * MDB_NEXT_MULTIPLE. Returning false from the visitor stops the iteration.
+         *
+         * @param key
+         * @param visitor
+         * @return
+         */
+        Error duplicates(const key_type &key, const data_visitor_t &visitor)
+        {
+            return visit(key, nullptr, nullptr, visitor);
+        }
+
+        /**
+         * Visits the values of the key in the range [from, to) in order with the bytes in the memory map
+         * itself, starting from the first value at or after from via MDB_GET_BOTH_RANGE
+         *
+         * @param key
+         * @param from
+         * @param to
+         * @param visitor
+         * @return
+         */
+        Error duplicates(
+            const key_type &key,
+            const value_type &from,
+            const value_type &to,
+            const data_visitor_t &visitor)
+        {
+            return visit(key, &from, &to, visitor);
+        }
+
+        /**
+         * Retrieves the value of the key (the first value for duplicate sorted databases)
+         *
+         * @param key
+         * @return
+         */
+        std::tuple<Error, value_type> get(const key_type &key)
+        {
+            auto i_key = Traits::key_codec::encode(key);
+
+            value_type result {};
+
+            // keys with a TTL may have expired, which only the regular transaction knows how to check
+            if (!plain_reads)
+            {
+                auto [error, value] = txn->get(static_cast<const void *>(i_key.mv_data), i_key.mv_size);
+
+                if (!error && !Traits::value_codec::decode({value.size(), value.data()}, result))
+                {
+                    error = Error(LMDB_BAD_VALSIZE, "The value could not be decoded", __LINE__, __FILE__);
+                }
+
+                return {error, result};
+            }
+
+            MDB_val value;
+
+            const auto code = mdb_get(*txn->txn, db->dbi, &i_key, &value);
+
+            if (code != MDB_SUCCESS)
+            {
+                return {Error(code, mdb_strerror(code), __LINE__, __FILE__), result};
+            }
+
+            if constexpr (Traits::compressed)
+            {
+                if (!detail::uncompress(value, scratch))
+                {
+                    return {Error(LMDB_CORRUPTED, "The value could not be uncompressed", __LINE__, __FILE__), result};
+                }
+
+                value = {scratch.size(), scratch.data()};
+            }
+
+            if (!Traits::value_codec::decode(value, result))
+            {
+                return {Error(LMDB_BAD_VALSIZE, "The value could not be decoded", __LINE__, __FILE__), result};
+            }
+
+            return {Error(), result};
+        }
+
+        /**
+         * Retrieves all of the values of the key in order (in bulk for DUPFIXED databases)
+         *
+         * @param key
+         * @return
+         */
+        std::tuple<Error, std::vector<value_type>> get_all(const key_type &key)
+        {
+            std::vector<value_type> results;
+
+            bool decoded = true;
+
+            auto error = visit(
+                key,
+                nullptr,
+                nullptr,
+                [&](const MDB_val &value)
+                {
+                    decoded = Traits::value_codec::decode(value, results.emplace_back());
+
+                    return decoded;
+                });
+
+            if (!error && !decoded)
+            {
+                error = Error(LMDB_BAD_VALSIZE, "The value could not be decoded", __LINE__, __FILE__);
+            }
+
+            return {error, std::move(results)};
+        }
+
+        /**
+         * Puts the value at the key using the specified flag(s)
+         *
+         * @param key
+         * @param value
+         * @param flags
+         * @return
+         */
+        Error put(const key_type &key, const value_type &value, int flags = 0)
+        {
+            auto i_key = Traits::key_codec::encode(key);
+
+            auto i_value = Traits::value_codec::encode(value);
+
+            // the regular transaction also maintains indexes, TTLs, versions, watches and the change log
+            if (!plain_writes)
+            {
+                return txn->put(
+                    static_cast<const void *>(i_key.mv_data), i_key.mv_size, i_value.mv_data, i_value.mv_size, flags);
+            }
+
+            if constexpr (Traits::compressed)
+            {
+                detail::compress(i_value, scratch);
+
+                i_value = {scratch.size(), scratch.data()};
+            }
+
+            const auto result = mdb_put(*txn->txn, db->dbi, &i_key, &i_value, flags);
+
+            return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+        }
+
+        /**
+         * Returns the underlying transaction so that changes can be combined with those to other databases
+         *
+         * @return
+         */
+        [[nodiscard]] std::shared_ptr<LMDB::Transaction> transaction() const
+        {
+            return txn;
+        }
+
+      private:
+        Transaction(std::shared_ptr<LMDB::Transaction> transaction, std::shared_ptr<LMDB::Database> database):
+            txn(std::move(transaction)), db(std::move(database))
+        {
+            plain_reads = !db->ttl_db;
+
+            plain_writes = plain_reads && !db->versions_db && db->indexes.size() == 0 && !txn->touched
+                           && !db->environment->change_log_enabled();
+        }
+
+        /**
+         * Opens a cursor positioned on the first value of the key (at or after from, if not nullptr)
+         * which the caller must close if no error is returned
+         *
+         * @param cursor
+         * @param key
+         * @param from
+         * @param i_value the value at the cursor
+         * @return
+         */
+        Error seek(MDB_cursor *&cursor, const key_type &key, const value_type *from, MDB_val &i_value)
+        {
+            auto i_key = Traits::key_codec::encode(key);
+
+            if (!plain_reads && txn->expired(i_key))
+            {
+                return Error(MDB_NOTFOUND, mdb_strerror(MDB_NOTFOUND), __LINE__, __FILE__);
+            }
+
+            auto result = mdb_cursor_open(*txn->txn, db->dbi, &cursor);
+
+            if (result != MDB_SUCCESS)
+            {
+                return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+            }
+
+            if (from)
+            {
+                i_value = Traits::value_codec::encode(*from);
+            }
+
+            result = mdb_cursor_get(cursor, &i_key, &i_value, (from) ? MDB_GET_BOTH_RANGE : MDB_SET);
+
+            if (result != MDB_SUCCESS)
+            {
+                mdb_cursor_close(cursor);
+
+                cursor = nullptr;
+            }
+
+            return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+        }
+
+        /**
+         * Visits the values of the key in the range [from, to) (either bound may be nullptr)
+         *
+         * @param key
+         * @param from
+         * @param to
+         * @param visitor
+         * @return
+         */
+        Error visit(const key_type &key, const value_type *from, const value_type *to, const data_visitor_t &visitor)
+        {
+            static_assert(Traits::dupsort, "Iterating values requires a duplicate sorted database");
+
+            MDB_cursor *cursor = nullptr;
+
+            MDB_val i_key, i_value, i_from = {0, nullptr}, i_to = {0, nullptr};
+
+            if (const auto error = seek(cursor, key, from, i_value); error)
+            {
+                return error;
+            }
+
+            if (from)
+            {
+                i_from = Traits::value_codec::encode(*from);
+            }
+
+            if (to)
+            {
+                i_to = Traits::value_codec::encode(*to);
+            }
+
+            auto result = MDB_SUCCESS;
+
+            if constexpr ((Traits::flags & MDB_DUPFIXED) != 0)
+            {
+                // every value has the size of the one at the cursor
+                const auto size = i_value.mv_size;
+
+                MDB_val block = {0, nullptr};
+
+                result = mdb_cursor_get(cursor, &i_key, &block, MDB_GET_MULTIPLE);
+
+                // a single value is not stored as duplicates, so there is no page of them to return
+                if (result == MDB_SUCCESS && block.mv_data == nullptr)
+                {
+                    block = i_value;
+                }
+
+                bool more = true;
+
+                for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor, &i_key, &block, MDB_NEXT_MULTIPLE))
+                {
+                    // a page is returned from its first value, which may be before from
+                    for (size_t offset = 0; more && size != 0 && offset + size <= block.mv_size; offset += size)
+                    {
+                        MDB_val value = {size, static_cast<unsigned char *>(block.mv_data) + offset};
+
+                        if (from && mdb_dcmp(*txn->txn, db->dbi, &value, &i_from) < 0)
+                        {
+                            continue;
+                        }
+
+                        more = !(to && mdb_dcmp(*txn->txn, db->dbi, &value, &i_to) >= 0) && visitor(value);
+                    }
+
+                    if (!more)
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT_DUP))
+                {
+                    if ((to && mdb_dcmp(*txn->txn, db->dbi, &i_value, &i_to) >= 0) || !visitor(i_value))
+                    {
+                        break;
+                    }
+                }
+            }
+
+            mdb_cursor_close(cursor);
+
+            if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+            {
+                return Error(result, mdb_strerror(result), __LINE__, __FILE__);
+            }
+
+            return Error();
+        }
+
+        std::shared_ptr<LMDB::Transaction> txn;
+
+        std::shared_ptr<LMDB::Database> db;
+
+        bool plain_reads = false;
+
+        bool plain_writes = false;
+
+        // holds the (un)compressed value of the last operation
+        std::string scratch;
+    };
+
+    /**
+     * A database whose key and value types, compression and duplicate mode are fixed at compile time
+     *
+     * @tparam Traits
+     */
+    template<typename Traits> class Database
+    {
+      public:
+        typedef typename Traits::key_type key_type;
+
+        typedef typename Traits::value_type value_type;
+
+        Database() = delete;
+
+        /**
+         * Opens (or creates) the named database in the environment and validates that the flags
+         * persisted with the database (and the compression of a previously opened handle) match the traits
+         *
+         * @param environment
+         * @param name
+         */
+        explicit Database(const std::shared_ptr<Environment> &environment, const std::string &name = ""):
+            db(environment->database(name, Traits::compressed, Traits::flags))
+        {
+            if (db->compressed() != Traits::compressed)
+            {
+                throw std::runtime_error("LMDB named database [" + name + "] is open with a different compression");
+            }
+
+            const auto [error, flags] = db->get_flags();
+
+            if (error)
+            {
+                throw std::runtime_error("Could not read the flags of LMDB named database [" + name + "]");
+            }
+
+            if ((flags & persistent_flags) != Traits::flags)
+            {
+                throw std::runtime_error("LMDB named database [" + name + "] was created with different flags");
+            }
+        }
+
+        /**
+         * Counts the values of the key in a new readonly transaction
+         *
+         * @param key
+         * @return [error, count]
+         */
+        std::tuple<Error, size_t> count(const key_type &key)
+        {
+            return transaction(true)->count(key);
+        }
+
+        /**
+         * Returns the underlying database
+         *
+         * @return
+         */
+        [[nodiscard]] std::shared_ptr<LMDB::Database> database() const
+        {
+            return db;
+        }
+
+        /**
+         * Deletes the key (and all of its values) in a new transaction
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @return
+         */
+        Error del(const key_type &key)
+        {
+        try_again:
+            auto txn = transaction();
+
+            auto error = txn->del(key);
+
+            if (!error)
+            {
+                error = txn->commit();
+            }
+
+            if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+            {
+                txn->abort();
+
+                if (!db->environment->expand())
+                {
+                    goto try_again;
+                }
+            }
+
+            return error;
+        }
+
+        /**
+         * Visits the values of the key in a new readonly transaction (see Transaction::duplicates())
+         *
+         * @param key
+         * @param visitor
+         * @return
+         */
+        Error duplicates(const key_type &key, const data_visitor_t &visitor)
+        {
+            return transaction(true)->duplicates(key, visitor);
+        }
+
+        /**
+         * Retrieves the value of the key in a new readonly transaction
+         *
+         * @param key
+         * @return
+         */
+        std::tuple<Error, value_type> get(const key_type &key)
+        {
+            return transaction(true)->get(key);
+        }
+
+        /**
+         * Retrieves all of the values of the key in a new readonly transaction
+         *
+         * @param key
+         * @return
+         */
+        std::tuple<Error, std::vector<value_type>> get_all(const key_type &key)
+        {
+            return transaction(true)->get_all(key);
+        }
+
+        /**
+         * Puts the value at the key in a new transaction
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param value
+         * @param flags
+         * @return
+         */
+        Error put(const key_type &key, const value_type &value, int flags = 0)
+        {
+        try_again:
+            auto txn = transaction();
+
+            auto error = txn->put(key, value, flags);
+
+            if (!error)
+            {
+                error = txn->commit();
+            }
+
+            if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+            {
+                txn->abort();
+
+                if (!db->environment->expand())
+                {
+                    goto try_again;
+                }
+            }
+
+            return error;
+        }
+
+        /**
+         * Opens a transaction on the database
+         *
+         * @param readonly
+         * @return
+         */
+        std::shared_ptr<Transaction<Traits>> transaction(bool readonly = false)
+        {
+            return std::shared_ptr<Transaction<Traits>>(new Transaction<Traits>(db->transaction(readonly), db));
+        }
+
+      private:
+        std::shared_ptr<LMDB::Database> db;
+    };
+} // namespace LMDB::Typed
+
+#endif // LMDB_TYPED_HPP
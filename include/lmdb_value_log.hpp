@@ -0,0 +1,368 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_VALUE_LOG_HPP
+#define LMDB_VALUE_LOG_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+namespace LMDB
+{
+    class ValueLog;
+
+    /**
+     * A read-only view of a value that remains valid for as long as the view exists, even if the
+     * value is later overwritten, deleted, or relocated by garbage collection
+     */
+    class BlobView
+    {
+        friend class ValueLog;
+
+      public:
+        BlobView() = default;
+
+        /**
+         * Returns a pointer to the bytes of the value
+         *
+         * @return
+         */
+        [[nodiscard]] const unsigned char *data() const;
+
+        /**
+         * Returns if the value is empty
+         *
+         * @return
+         */
+        [[nodiscard]] bool empty() const;
+
+        /**
+         * Returns the size of the value in bytes
+         *
+         * @return
+         */
+        [[nodiscard]] size_t size() const;
+
+      private:
+        // keeps the memory that the view points into alive (a mapping of the blob log or a copy of the value)
+        std::shared_ptr<const void> owner;
+
+        const unsigned char *m_data = nullptr;
+
+        size_t m_size = 0;
+    };
+
+    /**
+     * The configuration of a value log
+     */
+    struct ValueLogOptions
+    {
+        // the base path of the blob log segments, which are stored at "<path>.<segment>"
+        std::string path;
+
+        // values of at least this many bytes are stored in the blob log rather than in the database
+        size_t threshold = 4096;
+
+        // once the active segment reaches this size, a new segment is started
+        size_t segment_size = 64 * 1024 * 1024;
+
+        // whether blobs are synced to disk before the transaction that references them is committed
+        bool sync = true;
+    };
+
+    /**
+     * The space used by the segments of a value log
+     */
+    struct ValueLogStats
+    {
+        size_t segments = 0;
+
+        // the bytes of values written to the segments
+        size_t total_bytes = 0;
+
+        // the bytes of values in the segments that are still referenced by the database
+        size_t live_bytes = 0;
+    };
+
+    /**
+     * Separates large values from the keys of a database (WiscKey-style): values at or above the threshold
+     * are appended to a blob log and only a small pointer to the value is stored in the database, so that
+     * updates to the B-tree do not copy (and fragment) large overflow pages.
+     *
+     * The total and live bytes of each segment of the log are tracked in "<database>:blobs" in the same
+     * transaction as the pointers themselves, and garbage_collect() rewrites the live values of mostly
+     * dead segments into the active segment before deleting them.
+     *
+     * Reads are zero-copy via a memory map of the segment on POSIX systems (on Windows, values are read
+     * into memory instead).
+     *
+     * Note: The database must only be written to via the value log. Secondary indexes and merge operators
+     * on the database see the pointers rather than the values. The blobs database counts against the
+     * maximum number of databases in the environment.
+     */
+    class ValueLog
+    {
+      public:
+        ValueLog() = delete;
+
+        /**
+         * Opens (or creates) the value log for the database
+         *
+         * Throws std::invalid_argument if the database has compression enabled, as the stored pointers
+         * and inline values are read back as they are
+         *
+         * @param db
+         * @param options
+         */
+        ValueLog(std::shared_ptr<Database> db, ValueLogOptions options);
+
+        /**
+         * Stops the background garbage collector, if running
+         */
+        ~ValueLog();
+
+        /**
+         * Deletes the key and its value
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Deletes the key and its value
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Rewrites the live values of every (inactive) segment in which at least the specified ratio
+         * of the bytes written are no longer referenced, then deletes the segment
+         *
+         * Pointers are updated in write transactions of at most chunk_size values so that other writers
+         * are not held up for long. A segment that still has live bytes accounted to it once its values
+         * have been rewritten is kept, and LMDB_CORRUPTED is returned.
+         *
+         * @param min_garbage_ratio
+         * @param chunk_size
+         * @return [error, number of segments reclaimed]
+         */
+        std::tuple<Error, size_t> garbage_collect(double min_garbage_ratio = 0.5, size_t chunk_size = 1000);
+
+        /**
+         * Retrieves (a copy of) the value of the key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+
+        /**
+         * Retrieves (a copy of) the value of the key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        {
+            return get(key.data(), key.size());
+        }
+
+        /**
+         * Puts the value at the key, storing the value in the blob log if it is at or above the threshold
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return LMDB_BAD_VALSIZE if the value is longer than UINT32_MAX bytes and would go to the blob log
+         */
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length);
+
+        /**
+         * Puts the value at the key, storing the value in the blob log if it is at or above the threshold
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @return
+         */
+        template<typename KeyType, typename ValueType> Error put(const KeyType &key, const ValueType &value)
+        {
+            return put(key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Starts a background thread that periodically runs garbage_collect()
+         *
+         * @param interval
+         * @param min_garbage_ratio
+         */
+        void start_gc(
+            std::chrono::milliseconds interval = std::chrono::milliseconds(60000),
+            double min_garbage_ratio = 0.5);
+
+        /**
+         * Retrieves the space used by the segments of the value log
+         *
+         * @return
+         */
+        std::tuple<Error, ValueLogStats> stats();
+
+        /**
+         * Stops the background garbage collector, if running
+         */
+        void stop_gc();
+
+        /**
+         * Retrieves a zero-copy view of the value of the key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, BlobView> view(const void *key, size_t length);
+
+        /**
+         * Retrieves a zero-copy view of the value of the key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, BlobView> view(const KeyType &key)
+        {
+            return view(key.data(), key.size());
+        }
+
+      private:
+        struct mapping_t;
+
+        /**
+         * Appends the key and value to the active segment of the blob log
+         *
+         * @param key
+         * @param value
+         * @param length
+         * @return [error, pointer to the value as stored in the database]
+         */
+        std::tuple<Error, mdb_result_t> append(const mdb_result_t &key, const void *value, size_t length);
+
+        /**
+         * Updates the total and live bytes of the segment within the transaction
+         *
+         * @param txn
+         * @param segment
+         * @param total the change in the total bytes of the segment
+         * @param live the change in the live bytes of the segment
+         * @return
+         */
+        Error account(Transaction &txn, uint32_t segment, int64_t total, int64_t live);
+
+        /**
+         * Replaces (or deletes, if the value is nullptr) the stored value of the key within the
+         * transaction and accounts for the blob (if any) that it previously pointed to
+         *
+         * @param txn
+         * @param key
+         * @param value
+         * @return
+         */
+        Error replace(Transaction &txn, const mdb_result_t &key, const mdb_result_t *value);
+
+        /**
+         * Reads the value that the stored value of a key refers to
+         *
+         * @param stored
+         * @return
+         */
+        std::tuple<Error, BlobView> resolve(mdb_result_t stored);
+
+        /**
+         * Rewrites the live values of the segment into the active segment and deletes the segment
+         *
+         * @param segment
+         * @param chunk_size
+         * @return
+         */
+        Error collect(uint32_t segment, size_t chunk_size);
+
+        /**
+         * Returns the path of the segment
+         *
+         * @param segment
+         * @return
+         */
+        [[nodiscard]] std::string segment_path(uint32_t segment) const;
+
+        std::shared_ptr<Database> db, blobs_db;
+
+        ValueLogOptions options;
+
+        uint32_t active_segment = 0;
+
+        uint64_t active_size = 0;
+
+        std::FILE *active_file = nullptr;
+
+        std::map<uint32_t, std::shared_ptr<mapping_t>> mappings;
+
+        // protects the active segment and the mappings
+        std::mutex mutex;
+
+        // only one garbage collection runs at a time
+        std::mutex gc_mutex;
+
+        std::mutex gc_thread_mutex;
+
+        std::condition_variable gc_cv;
+
+        bool gc_stop = false;
+
+        std::thread gc_thread;
+    };
+} // namespace LMDB
+
+#endif // LMDB_VALUE_LOG_HPP
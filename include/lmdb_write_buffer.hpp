@@ -0,0 +1,277 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_WRITE_BUFFER_HPP
+#define LMDB_WRITE_BUFFER_HPP
+
+#include "lmdb_cpp.hpp"
+
+#include <cstdio>
+#include <map>
+#include <shared_mutex>
+#include <string>
+
+namespace LMDB
+{
+    /**
+     * How the writes held in a write buffer are protected against process failure before they are flushed
+     */
+    enum WriteBufferDurability : uint8_t
+    {
+        // writes that have not been flushed are lost if the process exits without flushing
+        BUFFER_VOLATILE = 0,
+        // writes are appended to a write-ahead log which survives a process crash, a write that cannot be
+        // logged is refused
+        BUFFER_WAL = 1,
+        // writes are appended to a write-ahead log which is synced to disk on every write
+        BUFFER_WAL_SYNC = 2
+    };
+
+    /**
+     * The thresholds and durability of a write buffer
+     */
+    struct WriteBufferOptions
+    {
+        // flush once the keys and values held in the buffer reach this many bytes
+        size_t max_bytes = 4 * 1024 * 1024;
+
+        // flush once the oldest write held in the buffer is this old, if 0, the buffer is only flushed by size
+        std::chrono::milliseconds max_age = std::chrono::milliseconds(1000);
+
+        WriteBufferDurability durability = BUFFER_VOLATILE;
+
+        // the path to the write-ahead log, required unless the durability is BUFFER_VOLATILE
+        std::string wal_path;
+    };
+
+    /**
+     * Absorbs puts and deletes for a database in a sorted in-memory buffer (memtable) and applies
+     * them to the database in a single write transaction (in key order) once the buffer reaches its
+     * size or age threshold, amortizing the cost of each commit across many small writes.
+     *
+     * Reads through the buffer see the buffered writes merged over the contents of the database.
+     *
+     * If a write-ahead log is used, any writes left in it by a previous process are loaded into the
+     * buffer when it is created and the log is truncated each time the buffer is flushed. Each record
+     * carries a CRC32C so that a torn or corrupted tail left by a crash is detected and cut off.
+     *
+     * Note: Writes made directly to the database are not visible to the buffer and will be overwritten
+     * by buffered writes to the same keys when the buffer is flushed.
+     */
+    class WriteBuffer
+    {
+      public:
+        WriteBuffer() = delete;
+
+        /**
+         * Creates a new write buffer in front of the database specified
+         *
+         * @param db
+         * @param options
+         */
+        explicit WriteBuffer(std::shared_ptr<Database> db, WriteBufferOptions options = WriteBufferOptions());
+
+        /**
+         * Stops the background flusher and flushes any writes remaining in the buffer
+         */
+        ~WriteBuffer();
+
+        /**
+         * Returns the number of bytes of keys and values currently held in the buffer
+         *
+         * @return
+         */
+        [[nodiscard]] size_t bytes() const;
+
+        /**
+         * Buffers the deletion of the key
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        Error del(const void *key, size_t length);
+
+        /**
+         * Buffers the deletion of the key
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> Error del(const KeyType &key)
+        {
+            return del(static_cast<const void *>(key.data()), key.size());
+        }
+
+        /**
+         * Returns if the key exists in the buffer or in the database
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        bool exists(const void *key, size_t length);
+
+        /**
+         * Returns if the key exists in the buffer or in the database
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> bool exists(const KeyType &key)
+        {
+            return exists(key.data(), key.size());
+        }
+
+        /**
+         * Applies the writes held in the buffer to the database in a single write transaction
+         *
+         * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+         * attempting to expand the database
+         *
+         * @return
+         */
+        Error flush();
+
+        /**
+         * Retrieves the value of the key from the buffer, or from the database if the key has not been buffered
+         *
+         * @param key
+         * @param length
+         * @return
+         */
+        std::tuple<Error, mdb_result_t> get(const void *key, size_t length);
+
+        /**
+         * Retrieves the value of the key from the buffer, or from the database if the key has not been buffered
+         *
+         * @tparam KeyType
+         * @param key
+         * @return
+         */
+        template<typename KeyType> std::tuple<Error, mdb_result_t> get(const KeyType &key)
+        {
+            return get(key.data(), key.size());
+        }
+
+        /**
+         * Buffers a put of the value at the key. If the buffer has reached its size threshold, it
+         * is flushed before returning.
+         *
+         * @param key
+         * @param key_length
+         * @param value
+         * @param value_length
+         * @return
+         */
+        Error put(const void *key, size_t key_length, const void *value, size_t value_length);
+
+        /**
+         * Buffers a put of the value at the key
+         *
+         * @tparam KeyType
+         * @tparam ValueType
+         * @param key
+         * @param value
+         * @return
+         */
+        template<typename KeyType, typename ValueType> Error put(const KeyType &key, const ValueType &value)
+        {
+            return put(key.data(), key.size(), value.data(), value.size());
+        }
+
+        /**
+         * Returns the number of keys currently held in the buffer
+         *
+         * @return
+         */
+        [[nodiscard]] size_t size() const;
+
+      private:
+        /**
+         * A buffered write of a key
+         */
+        struct entry_t
+        {
+            bool deleted = false;
+
+            mdb_result_t value;
+        };
+
+        /**
+         * Applies the buffered writes to the database, the write mutex must be held
+         *
+         * @return
+         */
+        Error flush_locked();
+
+        /**
+         * Buffers the write (and appends it to the write-ahead log), the write mutex must be held
+         *
+         * @param key
+         * @param entry
+         * @return
+         */
+        Error record(mdb_result_t key, entry_t entry);
+
+        /**
+         * Loads the writes left in the write-ahead log by a previous process into the buffer and
+         * truncates the log after the last valid record
+         */
+        void replay();
+
+        std::shared_ptr<Database> db;
+
+        WriteBufferOptions options;
+
+        std::map<mdb_result_t, entry_t> buffer;
+
+        size_t buffer_bytes = 0;
+
+        // when the oldest write currently held in the buffer was made
+        std::chrono::steady_clock::time_point oldest;
+
+        std::FILE *wal = nullptr;
+
+        // serializes writers (and the write-ahead log) with flushes
+        std::mutex write_mutex;
+
+        // protects the buffer itself so that readers can proceed while a flush is in progress
+        mutable std::shared_mutex buffer_mutex;
+
+        std::mutex flusher_mutex;
+
+        std::condition_variable flusher_cv;
+
+        bool flusher_stop = false;
+
+        std::thread flusher;
+    };
+} // namespace LMDB
+
+#endif // LMDB_WRITE_BUFFER_HPP
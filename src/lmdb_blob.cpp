@@ -0,0 +1,615 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_blob.hpp"
+#include "lmdb_internal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <snappy.h>
+#include <stdexcept>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_CHUNK_RAW 0x00
+#define LMDB_CHUNK_SNAPPY 0x01
+#define LMDB_BLOB_MANIFEST_SIZE 28 // [size (8)] [chunk size (4)] [chunks (8)] [generation (8)]
+#define LMDB_BLOB_BATCH_BYTES (16 * 1024 * 1024) // the (stored) bytes of chunks written per transaction
+
+namespace LMDB
+{
+    /**
+     * Builds the key of a chunk of a blob such that the chunks sort in order after the manifest
+     *
+     * @param key
+     * @param generation
+     * @param index
+     * @return
+     */
+    static inline mdb_result_t chunk_key(const mdb_result_t &key, uint64_t generation, uint64_t index)
+    {
+        auto result = key;
+
+        result.reserve(key.size() + 1 + 2 * sizeof(uint64_t));
+
+        result.push_back(0x00);
+
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            result.push_back(static_cast<unsigned char>(generation >> shift));
+        }
+
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            result.push_back(static_cast<unsigned char>(index >> shift));
+        }
+
+        return result;
+    }
+
+    /**
+     * Encodes a chunk for storage, compressing it only if that makes it smaller
+     *
+     * @param data
+     * @param length
+     * @param compress
+     * @return
+     */
+    static inline mdb_result_t encode_chunk(const unsigned char *data, size_t length, bool compress)
+    {
+        mdb_result_t result;
+
+        if (compress)
+        {
+            size_t compressed_length = 0;
+
+            result.resize(1 + snappy::MaxCompressedLength(length));
+
+            snappy::RawCompress(
+                reinterpret_cast<const char *>(data),
+                length,
+                reinterpret_cast<char *>(result.data() + 1),
+                &compressed_length);
+
+            if (compressed_length < length)
+            {
+                result[0] = LMDB_CHUNK_SNAPPY;
+
+                result.resize(1 + compressed_length);
+
+                return result;
+            }
+
+            result.clear();
+        }
+
+        result.reserve(1 + length);
+
+        result.push_back(LMDB_CHUNK_RAW);
+
+        result.insert(result.end(), data, data + length);
+
+        return result;
+    }
+
+    /**
+     * Encodes the manifest of a blob
+     *
+     * @param info
+     * @return
+     */
+    static inline mdb_result_t encode_manifest(const BlobInfo &info)
+    {
+        mdb_result_t result;
+
+        result.reserve(LMDB_BLOB_MANIFEST_SIZE);
+
+        append_le<uint64_t>(result, info.size);
+
+        append_le<uint32_t>(result, info.chunk_size);
+
+        append_le<uint64_t>(result, info.chunks);
+
+        append_le<uint64_t>(result, info.generation);
+
+        return result;
+    }
+
+    /**
+     * Reads the manifest of a blob directly from the transaction
+     *
+     * The manifest is read without going through Transaction::get() so that it is never mistaken for
+     * snappy compressed data.
+     *
+     * @param txn
+     * @param dbi
+     * @param key
+     * @return [error, manifest]
+     */
+    static inline std::tuple<Error, BlobInfo> load_manifest(MDB_txn *txn, MDB_dbi dbi, const mdb_result_t &key)
+    {
+        BlobInfo info;
+
+        MDB_val i_key = {key.size(), (void *)key.data()}, value;
+
+        const auto result = mdb_get(txn, dbi, &i_key, &value);
+
+        if (result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), info};
+        }
+
+        if (value.mv_size != LMDB_BLOB_MANIFEST_SIZE)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The value is not a blob manifest"), info};
+        }
+
+        const auto data = static_cast<const unsigned char *>(value.mv_data);
+
+        info.size = read_le<uint64_t>(data);
+
+        info.chunk_size = read_le<uint32_t>(data + 8);
+
+        info.chunks = read_le<uint64_t>(data + 12);
+
+        info.generation = read_le<uint64_t>(data + 20);
+
+        if (info.chunk_size == 0)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob manifest has no chunk size"), info};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), info};
+    }
+
+    /**
+     * Deletes the chunks of a blob within the transaction
+     *
+     * @param txn
+     * @param key
+     * @param info
+     * @return
+     */
+    static inline Error remove_chunks(Transaction &txn, const mdb_result_t &key, const BlobInfo &info)
+    {
+        for (uint64_t i = 0; i < info.chunks; ++i)
+        {
+            const auto error = txn.del(chunk_key(key, info.generation, i));
+
+            if (error && error != LMDB_NOTFOUND)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    BlobReader::BlobReader(
+        std::shared_ptr<Transaction> txn,
+        std::shared_ptr<Database> db,
+        mdb_result_t key,
+        const BlobInfo &info):
+        txn(std::move(txn)), db(std::move(db)), key(std::move(key)), m_info(info)
+    {
+    }
+
+    std::tuple<Error, const unsigned char *, size_t> BlobReader::chunk(uint64_t index)
+    {
+        if (index >= m_info.chunks)
+        {
+            return {MAKE_LMDB_ERROR(LMDB_NOTFOUND), nullptr, 0};
+        }
+
+        const auto i_key = chunk_key(key, m_info.generation, index);
+
+        MDB_val mdb_key = {i_key.size(), (void *)i_key.data()}, value;
+
+        const auto result = mdb_get(*txn->txn, db->dbi, &mdb_key, &value);
+
+        if (result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), nullptr, 0};
+        }
+
+        const auto data = static_cast<const unsigned char *>(value.mv_data);
+
+        if (value.mv_size == 0)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob chunk is empty"), nullptr, 0};
+        }
+
+        if (data[0] == LMDB_CHUNK_RAW)
+        {
+            return {MAKE_LMDB_ERROR(SUCCESS), data + 1, value.mv_size - 1};
+        }
+
+        const auto compressed = reinterpret_cast<const char *>(data + 1);
+
+        size_t length = 0;
+
+        if (data[0] != LMDB_CHUNK_SNAPPY || !snappy::GetUncompressedLength(compressed, value.mv_size - 1, &length))
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob chunk could not be decoded"), nullptr, 0};
+        }
+
+        buffer.resize(length);
+
+        if (!snappy::RawUncompress(compressed, value.mv_size - 1, reinterpret_cast<char *>(buffer.data())))
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob chunk could not be decompressed"), nullptr, 0};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), buffer.data(), buffer.size()};
+    }
+
+    Error BlobReader::copy_to(std::ostream &stream)
+    {
+        while (m_position < m_info.size)
+        {
+            const auto index = m_position / m_info.chunk_size;
+
+            const auto within = m_position % m_info.chunk_size;
+
+            const auto [error, data, length] = chunk(index);
+
+            if (error)
+            {
+                return error;
+            }
+
+            if (within >= length)
+            {
+                return MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob chunk is shorter than expected");
+            }
+
+            stream.write(reinterpret_cast<const char *>(data + within), static_cast<std::streamsize>(length - within));
+
+            if (!stream)
+            {
+                return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not write the blob to the stream");
+            }
+
+            m_position += length - within;
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    BlobInfo BlobReader::info() const
+    {
+        return m_info;
+    }
+
+    uint64_t BlobReader::position() const
+    {
+        return m_position;
+    }
+
+    std::tuple<Error, size_t> BlobReader::read(void *buffer, size_t length)
+    {
+        const auto [error, read] = read_at(m_position, buffer, length);
+
+        m_position += read;
+
+        return {error, read};
+    }
+
+    std::tuple<Error, size_t> BlobReader::read_at(uint64_t offset, void *buffer, size_t length)
+    {
+        auto output = static_cast<unsigned char *>(buffer);
+
+        size_t read = 0;
+
+        while (read < length && offset < m_info.size)
+        {
+            const auto [error, data, chunk_length] = chunk(offset / m_info.chunk_size);
+
+            if (error)
+            {
+                return {error, read};
+            }
+
+            const auto within = offset % m_info.chunk_size;
+
+            if (within >= chunk_length)
+            {
+                return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob chunk is shorter than expected"), read};
+            }
+
+            const auto count = std::min<uint64_t>(length - read, chunk_length - within);
+
+            std::memcpy(output + read, data + within, count);
+
+            read += count;
+
+            offset += count;
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), read};
+    }
+
+    void BlobReader::seek(uint64_t offset)
+    {
+        m_position = std::min(offset, m_info.size);
+    }
+
+    uint64_t BlobReader::size() const
+    {
+        return m_info.size;
+    }
+
+    BlobStore::BlobStore(std::shared_ptr<Database> db, size_t chunk_size, bool compress):
+        db(std::move(db)), chunk_size(chunk_size), compress(compress)
+    {
+        if (chunk_size == 0 || chunk_size > UINT32_MAX)
+        {
+            throw std::invalid_argument("The chunk size of a blob store must be between 1 and 2^32 - 1 bytes");
+        }
+
+        if (this->db->compressed())
+        {
+            throw std::invalid_argument("A blob store cannot use a database with compression enabled");
+        }
+    }
+
+    Error BlobStore::del(const void *key, size_t length)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        const auto i_key = mdb_result_t(key_bytes, key_bytes + length);
+
+    try_again:
+        auto txn = db->transaction();
+
+        auto [error, info] = load_manifest(*txn->txn, db->dbi, i_key);
+
+        if (!error)
+        {
+            error = remove_chunks(*txn, i_key, info);
+        }
+
+        if (!error)
+        {
+            error = txn->del(i_key);
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    bool BlobStore::exists(const void *key, size_t length)
+    {
+        return db->exists(key, length);
+    }
+
+    std::tuple<Error, BlobInfo> BlobStore::info(const void *key, size_t length)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        auto txn = db->transaction(true);
+
+        return load_manifest(*txn->txn, db->dbi, mdb_result_t(key_bytes, key_bytes + length));
+    }
+
+    Error BlobStore::read(const void *key, size_t length, std::ostream &stream)
+    {
+        const auto [error, blob] = reader(key, length);
+
+        if (error)
+        {
+            return error;
+        }
+
+        return blob->copy_to(stream);
+    }
+
+    std::tuple<Error, std::shared_ptr<BlobReader>> BlobStore::reader(const void *key, size_t length)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        auto i_key = mdb_result_t(key_bytes, key_bytes + length);
+
+        auto txn = db->transaction(true);
+
+        const auto [error, info] = load_manifest(*txn->txn, db->dbi, i_key);
+
+        if (error)
+        {
+            return {error, nullptr};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), std::shared_ptr<BlobReader>(new BlobReader(txn, db, std::move(i_key), info))};
+    }
+
+    Error BlobStore::store(const mdb_result_t &key, BlobInfo &info, const std::vector<mdb_result_t> &batch, bool final)
+    {
+    try_again:
+        auto txn = db->transaction();
+
+        Error error;
+
+        // the id of the transaction that writes the first chunk is unique to this write of the blob
+        if (info.chunks == 0)
+        {
+            std::tie(error, info.generation) = txn->id();
+        }
+
+        for (size_t i = 0; i < batch.size() && !error; ++i)
+        {
+            error = txn->put(chunk_key(key, info.generation, info.chunks + i), batch[i]);
+        }
+
+        if (!error && final)
+        {
+            const auto [previous_error, previous] = load_manifest(*txn->txn, db->dbi, key);
+
+            if (!previous_error)
+            {
+                error = remove_chunks(*txn, key, previous);
+            }
+
+            auto manifest = info;
+
+            manifest.chunks += batch.size();
+
+            if (!error)
+            {
+                error = txn->put(key, encode_manifest(manifest));
+            }
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        if (!error)
+        {
+            info.chunks += batch.size();
+        }
+
+        return error;
+    }
+
+    Error BlobStore::write(
+        const void *key,
+        size_t length,
+        const std::function<size_t(unsigned char *, size_t)> &producer)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        const auto i_key = mdb_result_t(key_bytes, key_bytes + length);
+
+        BlobInfo info;
+
+        info.chunk_size = static_cast<uint32_t>(chunk_size);
+
+        std::vector<mdb_result_t> batch;
+
+        size_t batch_bytes = 0;
+
+        mdb_result_t buffer(chunk_size);
+
+        Error error;
+
+        while (!error)
+        {
+            const auto read = producer(buffer.data(), buffer.size());
+
+            const auto last = read < buffer.size();
+
+            if (read != 0)
+            {
+                batch.push_back(encode_chunk(buffer.data(), read, compress));
+
+                batch_bytes += batch.back().size();
+
+                info.size += read;
+            }
+
+            if (last)
+            {
+                error = store(i_key, info, batch, true);
+
+                if (!error)
+                {
+                    return MAKE_LMDB_ERROR(SUCCESS);
+                }
+
+                break;
+            }
+
+            if (batch_bytes >= LMDB_BLOB_BATCH_BYTES)
+            {
+                error = store(i_key, info, batch, false);
+
+                batch.clear();
+
+                batch_bytes = 0;
+            }
+        }
+
+        // clean up the chunks of the incomplete blob that were already committed
+        if (info.chunks != 0)
+        {
+            auto txn = db->transaction();
+
+            if (!remove_chunks(*txn, i_key, info))
+            {
+                txn->commit();
+            }
+        }
+
+        return error;
+    }
+
+    Error BlobStore::write(const void *key, size_t length, std::istream &stream)
+    {
+        return write(
+            key,
+            length,
+            [&stream](unsigned char *buffer, size_t buffer_length)
+            {
+                size_t read = 0;
+
+                // fill the whole chunk, as a short read signals the end of the blob
+                while (read < buffer_length && stream)
+                {
+                    stream.read(
+                        reinterpret_cast<char *>(buffer + read), static_cast<std::streamsize>(buffer_length - read));
+
+                    read += static_cast<size_t>(stream.gcount());
+                }
+
+                return read;
+            });
+    }
+} // namespace LMDB
@@ -25,11 +25,21 @@
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "lmdb_cpp.hpp"
+#include "lmdb_internal.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cppfs/FileHandle.h>
 #include <cppfs/fs.h>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <random>
 #include <snappy.h>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
 #include <utility>
 
 #define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
@@ -47,6 +57,17 @@
             goto label;                                   \
         }                                                 \
     }
+#define LMDB_INDEX_BACKFILL_CHUNK 10000
+#define LMDB_TTL_KEEP UINT64_MAX // leaves the existing TTL of a key untouched
+#define LMDB_VERSION_UNSTAMPED UINT64_MAX // the version of a key that exists but was never stamped
+#define LMDB_CHANGE_LOG_NAME "__changes"
+#define LMDB_CHANGE_TRUNCATE_CHUNK 10000
+#define LMDB_CHANGE_SEQUENCE_KEY 0 // holds the highest sequence number assigned, records start at 1
+#define LMDB_PARALLEL_SCAN_RANGES_PER_THREAD 4
+#define LMDB_PARALLEL_SCAN_ATTEMPTS 10
+#define LMDB_SAMPLE_DENSITY_BOUND 4
+#define LMDB_SAMPLE_ATTEMPTS 64 // per sample requested
+#define LMDB_SAMPLE_GROUP_LIMIT 256
 #define LMDB_LOAD_VALUE(input, length, output, compressed)      \
     auto output##_temp = load_value(input, length, compressed); \
     auto output = load_val(output##_temp)
@@ -124,765 +145,3920 @@ namespace LMDB
         return result;
     }
 
+    /**
+     * Retrieves the length that the value would uncompress to if it is (plausibly) snappy compressed
+     *
+     * No snappy element expands to more than 64 times its size, so a larger claimed length cannot be
+     * valid and we reject it rather than allocating a buffer to fit it.
+     *
+     * @param value
+     * @param length
+     * @return
+     */
+    static inline bool uncompressed_length(const MDB_val &value, size_t &length)
+    {
+        return snappy::GetUncompressedLength(static_cast<const char *>(value.mv_data), value.mv_size, &length)
+               && length <= value.mv_size * 64;
+    }
+
+    /**
+     * Loads the results of a LMDB call into a buffer allocated from the memory resource, uncompressing
+     * it directly into the buffer if it is snappy compressed (as load_result() does)
+     *
+     * @param value
+     * @param resource
+     * @return
+     */
+    static inline mdb_pmr_result_t load_result(const MDB_val &value, std::pmr::memory_resource *resource)
+    {
+        mdb_pmr_result_t result(resource);
+
+        size_t length = 0;
+
+        if (uncompressed_length(value, length))
+        {
+            result.resize(length);
+
+            if (snappy::RawUncompress(
+                    static_cast<const char *>(value.mv_data), value.mv_size, reinterpret_cast<char *>(result.data())))
+            {
+                return result;
+            }
+        }
+
+        const auto bytes = static_cast<const unsigned char *>(value.mv_data);
+
+        result.assign(bytes, bytes + value.mv_size);
+
+        return result;
+    }
+
+    /**
+     * Hashes the raw bytes of a LMDB value so that we can detect if it has changed
+     *
+     * @param value
+     * @return
+     */
+    static inline size_t hash_val(const MDB_val &value)
+    {
+        return std::hash<std::string_view>()(
+            std::string_view(static_cast<const char *>(value.mv_data), value.mv_size));
+    }
+
+    /**
+     * Encodes a 64-bit unsigned integer as big-endian bytes so that the values sort numerically
+     * when used as keys with the default LMDB key comparison
+     *
+     * @param value
+     * @return
+     */
+    static inline mdb_result_t encode_u64(uint64_t value)
+    {
+        mdb_result_t result(sizeof(uint64_t));
+
+        for (size_t i = 0; i < sizeof(uint64_t); ++i)
+        {
+            result[i] = static_cast<unsigned char>(value >> (8 * (sizeof(uint64_t) - 1 - i)));
+        }
+
+        return result;
+    }
+
+    /**
+     * Decodes a 64-bit unsigned integer from big-endian bytes
+     *
+     * @param value
+     * @return
+     */
+    static inline uint64_t decode_u64(const MDB_val &value)
+    {
+        uint64_t result = 0;
+
+        const auto data = static_cast<const unsigned char *>(value.mv_data);
+
+        for (size_t i = 0; i < value.mv_size && i < sizeof(uint64_t); ++i)
+        {
+            result = (result << 8) | data[i];
+        }
+
+        return result;
+    }
+
+    /**
+     * Loads a change log sequence number (MDB_INTEGERKEY) from a LMDB key
+     *
+     * @param value
+     * @return
+     */
+    static inline size_t load_sequence(const MDB_val &value)
+    {
+        size_t sequence = 0;
+
+        std::memcpy(&sequence, value.mv_data, std::min(value.mv_size, sizeof(sequence)));
+
+        return sequence;
+    }
+
+    /**
+     * Reads the highest sequence number ever assigned in the change log, which is kept even once
+     * every record has been acknowledged so that sequence numbers are never reused
+     *
+     * @param txn
+     * @param dbi
+     * @param sequence
+     * @return
+     */
+    static inline int last_sequence(MDB_txn *txn, MDB_dbi dbi, size_t &sequence)
+    {
+        sequence = 0;
+
+        size_t meta_key = LMDB_CHANGE_SEQUENCE_KEY;
+
+        MDB_val i_key = {sizeof(meta_key), &meta_key}, i_value;
+
+        const auto result = mdb_get(txn, dbi, &i_key, &i_value);
+
+        if (result == MDB_SUCCESS)
+        {
+            sequence = load_sequence(i_value);
+        }
+
+        return (result == MDB_NOTFOUND) ? MDB_SUCCESS : result;
+    }
+
+    /**
+     * Decodes a change log record from its stored form
+     *
+     * Layout: [txn id (8)] [dbi (4)] [operation (1)] [flags (4)] [name length (2)] [name]
+     *         [key length (4)] [key] [value length (4)] [value]
+     *
+     * @param sequence
+     * @param value
+     * @param record
+     * @return false if the record is malformed
+     */
+    static inline bool decode_change(size_t sequence, const MDB_val &value, ChangeRecord &record)
+    {
+        const auto data = static_cast<const unsigned char *>(value.mv_data);
+
+        const auto length = value.mv_size;
+
+        size_t offset = 0;
+
+        uint64_t txn_id = 0;
+
+        uint8_t operation = 0;
+
+        uint16_t name_length = 0;
+
+        uint32_t key_length = 0, value_length = 0;
+
+        record.sequence = sequence;
+
+        if (!read_le(data, length, offset, txn_id) || !read_le(data, length, offset, record.dbi)
+            || !read_le(data, length, offset, operation) || !read_le(data, length, offset, record.flags)
+            || !read_le(data, length, offset, name_length) || offset + name_length > length)
+        {
+            return false;
+        }
+
+        record.txn_id = txn_id;
+
+        record.operation = static_cast<ChangeOperation>(operation);
+
+        record.database = std::string(reinterpret_cast<const char *>(data + offset), name_length);
+
+        offset += name_length;
+
+        if (!read_le(data, length, offset, key_length) || offset + key_length > length)
+        {
+            return false;
+        }
+
+        record.key = mdb_result_t(data + offset, data + offset + key_length);
+
+        offset += key_length;
+
+        if (!read_le(data, length, offset, value_length) || offset + value_length > length)
+        {
+            return false;
+        }
+
+        record.value = mdb_result_t(data + offset, data + offset + value_length);
+
+        return true;
+    }
+
+    /**
+     * Reads up to the first 8 bytes of the data as a big-endian number (padding a shorter input with zeros)
+     * so that the numbers of keys sort in the same order as the keys themselves
+     *
+     * @param data
+     * @param length
+     * @return
+     */
+    static inline uint64_t read_be64(const unsigned char *data, size_t length)
+    {
+        uint64_t result = 0;
+
+        for (size_t i = 0; i < sizeof(uint64_t); ++i)
+        {
+            result = (result << 8) | ((i < length) ? data[i] : 0);
+        }
+
+        return result;
+    }
+
+    /**
+     * Maps the keys between two keys onto numbers in the same order as the keys, so that positions
+     * within the key space can be interpolated (numerically for MDB_INTEGERKEY databases, otherwise
+     * on the bytes following the common prefix of the two keys)
+     */
+    struct key_space_t
+    {
+        bool integer_key = false;
+
+        size_t prefix = 0;
+
+        mdb_result_t first;
+
+        uint64_t low = 0, high = 0;
+    };
+
+    /**
+     * Returns the number of a key within the key space
+     *
+     * @param space
+     * @param key
+     * @param length
+     * @return
+     */
+    static inline uint64_t key_position(const key_space_t &space, const void *key, size_t length)
+    {
+        const auto data = static_cast<const unsigned char *>(key);
+
+        if (space.integer_key && length == sizeof(unsigned int))
+        {
+            unsigned int value;
+
+            std::memcpy(&value, data, sizeof(value));
+
+            return value;
+        }
+
+        if (space.integer_key && length == sizeof(size_t))
+        {
+            size_t value;
+
+            std::memcpy(&value, data, sizeof(value));
+
+            return value;
+        }
+
+        return (length > space.prefix) ? read_be64(data + space.prefix, length - space.prefix) : 0;
+    }
+
+    /**
+     * Builds the key space between the first and last keys of a range
+     *
+     * @param flags the flags of the database
+     * @param first_key
+     * @param last_key
+     * @return
+     */
+    static inline key_space_t key_space(unsigned int flags, const mdb_result_t &first_key, const mdb_result_t &last_key)
+    {
+        key_space_t space;
+
+        space.integer_key = (flags & MDB_INTEGERKEY) && first_key.size() == last_key.size()
+                            && (first_key.size() == sizeof(unsigned int) || first_key.size() == sizeof(size_t));
+
+        if (!space.integer_key)
+        {
+            while (space.prefix < first_key.size() && space.prefix < last_key.size()
+                   && first_key[space.prefix] == last_key[space.prefix])
+            {
+                space.prefix++;
+            }
+        }
+
+        space.first = first_key;
+
+        space.low = key_position(space, first_key.data(), first_key.size());
+
+        space.high = key_position(space, last_key.data(), last_key.size());
+
+        return space;
+    }
+
+    /**
+     * Returns the smallest key at the number within the key space
+     *
+     * @param space
+     * @param position
+     * @return
+     */
+    static inline mdb_result_t position_key(const key_space_t &space, uint64_t position)
+    {
+        mdb_result_t key;
+
+        if (space.integer_key && space.first.size() == sizeof(unsigned int))
+        {
+            const auto value = static_cast<unsigned int>(position);
+
+            key.resize(sizeof(value));
+
+            std::memcpy(key.data(), &value, sizeof(value));
+        }
+        else if (space.integer_key)
+        {
+            const auto value = static_cast<size_t>(position);
+
+            key.resize(sizeof(value));
+
+            std::memcpy(key.data(), &value, sizeof(value));
+        }
+        else
+        {
+            key.assign(space.first.begin(), space.first.begin() + space.prefix);
+
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                key.push_back(static_cast<unsigned char>(position >> shift));
+            }
+
+            // trailing zeros would put the key after shorter keys at the same position
+            while (key.size() > space.prefix && key.back() == 0)
+            {
+                key.pop_back();
+            }
+        }
+
+        return key;
+    }
+
+    /**
+     * Finds the first and last keys of the range [begin, end) (an empty bound is unbounded)
+     *
+     * @param cursor
+     * @param begin
+     * @param begin_length
+     * @param end
+     * @param end_length
+     * @param first_key
+     * @param last_key
+     * @return whether the range contains any keys
+     */
+    static inline bool range_bounds(
+        MDB_cursor *cursor,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length,
+        mdb_result_t &first_key,
+        mdb_result_t &last_key)
+    {
+        MDB_val first = {begin_length, const_cast<void *>(begin)}, last = {end_length, const_cast<void *>(end)}, value;
+
+        if (mdb_cursor_get(cursor, &first, &value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST) != MDB_SUCCESS)
+        {
+            return false;
+        }
+
+        first_key = load_value(first.mv_data, first.mv_size, false);
+
+        // the last key of the range is the one before the end (or the last key if nothing is at or after the end)
+        auto result = (end_length != 0) ? mdb_cursor_get(cursor, &last, &value, MDB_SET_RANGE) : MDB_NOTFOUND;
+
+        result = mdb_cursor_get(cursor, &last, &value, (result == MDB_SUCCESS) ? MDB_PREV : MDB_LAST);
+
+        if (result != MDB_SUCCESS)
+        {
+            return false;
+        }
+
+        last_key = load_value(last.mv_data, last.mv_size, false);
+
+        auto i_first = load_val(first_key), i_last = load_val(last_key);
+
+        return mdb_cmp(mdb_cursor_txn(cursor), mdb_cursor_dbi(cursor), &i_first, &i_last) <= 0;
+    }
+
+    ResultSet::entry_t ResultSet::operator[](size_t index) const
+    {
+        const auto &[key_offset, key_length, value_offset, value_length] = offsets[index];
+
+        return {{arena.data() + key_offset, key_length}, {arena.data() + value_offset, value_length}};
+    }
+
+    void ResultSet::append(const MDB_val *key, const MDB_val *value)
+    {
+        size_t key_offset = 0, key_length = 0, value_offset = 0, value_length = 0;
+
+        if (key)
+        {
+            std::tie(key_offset, key_length) = append_data(*key, false);
+        }
+
+        if (value)
+        {
+            std::tie(value_offset, value_length) = append_data(*value, true);
+        }
+
+        offsets.emplace_back(key_offset, key_length, value_offset, value_length);
+    }
+
+    std::tuple<size_t, size_t> ResultSet::append_data(const MDB_val &data, bool uncompress)
+    {
+        const auto offset = arena.size();
+
+        size_t length = 0;
+
+        // mirrors load_result() by uncompressing anything that is valid snappy data, but straight into the buffer
+        if (uncompress && uncompressed_length(data, length))
+        {
+            arena.resize(offset + length);
+
+            if (snappy::RawUncompress(
+                    static_cast<const char *>(data.mv_data),
+                    data.mv_size,
+                    reinterpret_cast<char *>(arena.data() + offset)))
+            {
+                return {offset, length};
+            }
+
+            arena.resize(offset);
+        }
+
+        const auto bytes = static_cast<const unsigned char *>(data.mv_data);
+
+        arena.insert(arena.end(), bytes, bytes + data.mv_size);
+
+        return {offset, data.mv_size};
+    }
+
+    ResultSet::const_iterator ResultSet::begin() const
+    {
+        return {this, 0};
+    }
+
+    size_t ResultSet::capacity() const
+    {
+        return arena.capacity();
+    }
+
+    void ResultSet::clear()
+    {
+        arena.clear();
+
+        offsets.clear();
+    }
+
+    bool ResultSet::empty() const
+    {
+        return offsets.empty();
+    }
+
+    ResultSet::const_iterator ResultSet::end() const
+    {
+        return {this, offsets.size()};
+    }
+
+    void ResultSet::reserve(size_t entries, size_t bytes)
+    {
+        offsets.reserve(entries);
+
+        arena.reserve(bytes);
+    }
+
+    size_t ResultSet::size() const
+    {
+        return offsets.size();
+    }
+
     Environment::Environment(std::string env_path, size_t growth_factor):
         path(std::move(env_path)), growth_factor(growth_factor)
     {
     }
 
-    Environment::~Environment()
+    Environment::~Environment()
+    {
+        std::scoped_lock lock(mutex);
+
+        change_db = nullptr;
+
+        // clear the list of databases, which will destruct them and close them
+        databases.clear();
+
+        // flush the database to disk
+        flush(true);
+
+        mdb_env_close(*env);
+
+        env = nullptr;
+
+        if (Environment::environments.contains(path))
+        {
+            Environment::environments.erase(path);
+        }
+    }
+
+    Error Environment::acknowledge_changes(size_t sequence)
+    {
+        if (!change_log_enabled())
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Change log is not enabled for the environment");
+        }
+
+        bool done = false;
+
+        // truncate in bounded chunks so that we do not hold the write lock for too long
+        while (!done)
+        {
+        try_again:
+            auto txn = change_db->transaction();
+
+            MDB_cursor *cursor = nullptr;
+
+            auto result = mdb_cursor_open(*txn->txn, change_db->dbi, &cursor);
+
+            if (result != MDB_SUCCESS)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
+
+            size_t first_sequence = LMDB_CHANGE_SEQUENCE_KEY + 1;
+
+            MDB_val i_key = {sizeof(first_sequence), &first_sequence}, i_value;
+
+            std::vector<size_t> sequences;
+
+            // the sequence counter is never truncated
+            result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_SET_RANGE);
+
+            while (result == MDB_SUCCESS && sequences.size() < LMDB_CHANGE_TRUNCATE_CHUNK
+                   && load_sequence(i_key) <= sequence)
+            {
+                sequences.push_back(load_sequence(i_key));
+
+                result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
+            }
+
+            mdb_cursor_close(cursor);
+
+            done = sequences.size() < LMDB_CHANGE_TRUNCATE_CHUNK;
+
+            Error error;
+
+            for (auto &seq : sequences)
+            {
+                i_key = {sizeof(seq), &seq};
+
+                result = mdb_del(*txn->txn, change_db->dbi, &i_key, nullptr);
+
+                if (result != MDB_SUCCESS)
+                {
+                    error = MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+
+                    break;
+                }
+            }
+
+            LMDB_CHECK_TXN_EXPAND(error, this, txn, try_again)
+
+            if (error)
+            {
+                return error;
+            }
+
+            error = txn->commit();
+
+            LMDB_CHECK_TXN_EXPAND(error, this, txn, try_again)
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error Environment::change_append(
+        MDB_txn *txn,
+        const Database &db,
+        ChangeOperation operation,
+        unsigned int flags,
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length)
+    {
+        if (operation == CHANGE_PUT && !change_values)
+        {
+            value_length = 0;
+        }
+
+        mdb_result_t record;
+
+        record.reserve(27 + db.name.size() + key_length + value_length);
+
+        append_le<uint64_t>(record, mdb_txn_id(txn));
+
+        append_le<uint32_t>(record, db.dbi);
+
+        append_le<uint8_t>(record, operation);
+
+        append_le<uint32_t>(record, flags);
+
+        append_le<uint16_t>(record, db.name.size());
+
+        record.insert(record.end(), db.name.begin(), db.name.end());
+
+        append_le<uint32_t>(record, key_length);
+
+        record.insert(
+            record.end(),
+            static_cast<const unsigned char *>(key),
+            static_cast<const unsigned char *>(key) + key_length);
+
+        append_le<uint32_t>(record, value_length);
+
+        if (value_length != 0)
+        {
+            record.insert(
+                record.end(),
+                static_cast<const unsigned char *>(value),
+                static_cast<const unsigned char *>(value) + value_length);
+        }
+
+        // nested transactions share the ID of their parent, so they continue its numbering
+        const auto txn_id = mdb_txn_id(txn);
+
+        if (!change_pending || change_txn_id != txn_id)
+        {
+            size_t sequence = 0;
+
+            const auto result = last_sequence(txn, change_db->dbi, sequence);
+
+            if (result != MDB_SUCCESS)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
+
+            // the next sequence number follows the highest ever assigned, even if the log has been truncated
+            change_txn_id = txn_id;
+
+            change_next_sequence = sequence + 1;
+
+            change_pending = true;
+        }
+
+        auto sequence = change_next_sequence;
+
+        MDB_val i_key = {sizeof(sequence), &sequence}, i_value = load_val(record);
+
+        const auto result = mdb_put(txn, change_db->dbi, &i_key, &i_value, MDB_APPEND);
+
+        if (result == MDB_SUCCESS)
+        {
+            change_next_sequence++;
+        }
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    int Environment::change_commit(MDB_txn *txn)
+    {
+        if (!change_pending || change_txn_id != mdb_txn_id(txn))
+        {
+            return MDB_SUCCESS;
+        }
+
+        // the transaction ends whether or not the commit succeeds
+        change_pending = false;
+
+        size_t meta_key = LMDB_CHANGE_SEQUENCE_KEY, sequence = change_next_sequence - 1;
+
+        MDB_val i_key = {sizeof(meta_key), &meta_key}, i_value = {sizeof(sequence), &sequence};
+
+        return mdb_put(txn, change_db->dbi, &i_key, &i_value, 0);
+    }
+
+    void Environment::change_reset(MDB_txn *txn)
+    {
+        if (change_pending && change_txn_id == mdb_txn_id(txn))
+        {
+            change_pending = false;
+        }
+    }
+
+    std::vector<ChangeRecord> Environment::changes(size_t from_sequence, size_t limit)
+    {
+        std::vector<ChangeRecord> results;
+
+        if (!change_log_enabled())
+        {
+            return results;
+        }
+
+        auto txn = change_db->transaction(true);
+
+        MDB_cursor *cursor = nullptr;
+
+        if (mdb_cursor_open(*txn->txn, change_db->dbi, &cursor) != MDB_SUCCESS)
+        {
+            return results;
+        }
+
+        // the sequence counter is not a record
+        from_sequence = std::max<size_t>(from_sequence, LMDB_CHANGE_SEQUENCE_KEY + 1);
+
+        MDB_val i_key = {sizeof(from_sequence), &from_sequence}, i_value;
+
+        auto result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_SET_RANGE);
+
+        while (result == MDB_SUCCESS && (limit == 0 || results.size() < limit))
+        {
+            ChangeRecord record;
+
+            if (decode_change(load_sequence(i_key), i_value, record))
+            {
+                results.push_back(std::move(record));
+            }
+
+            result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
+        }
+
+        mdb_cursor_close(cursor);
+
+        return results;
+    }
+
+    bool Environment::change_log_enabled() const
+    {
+        return change_db != nullptr;
+    }
+
+    void Environment::commit_notify(size_t txn_id, const std::vector<std::tuple<MDB_dbi, mdb_result_t>> *touched)
+    {
+        {
+            std::scoped_lock lock(commit_mutex);
+
+            last_commit = std::max(last_commit, txn_id);
+        }
+
+        commit_cv.notify_all();
+
+        if (!touched || touched->empty())
+        {
+            return;
+        }
+
+        std::vector<std::shared_ptr<Watch>> active;
+
+        {
+            std::scoped_lock lock(watch_mutex);
+
+            for (const auto &weak_watch : watches)
+            {
+                if (auto w = weak_watch.lock())
+                {
+                    active.push_back(w);
+                }
+            }
+        }
+
+        for (const auto &w : active)
+        {
+            for (const auto &[dbi, key] : *touched)
+            {
+                if (w->matches(dbi, key))
+                {
+                    w->trigger();
+
+                    break;
+                }
+            }
+        }
+    }
+
+    Error Environment::copy(const std::string &dst_path, unsigned int flags)
+    {
+        std::scoped_lock lock(mutex);
+
+        auto file = cppfs::fs::open(dst_path);
+
+        auto [error, env_flags] = get_flags();
+
+        if (error)
+        {
+            throw std::runtime_error("Could not get environment flags");
+        }
+
+        // if the new path already exists, we need to clear it
+        if (file.exists())
+        {
+            if (file.isFile())
+            {
+                file.remove();
+            }
+            else
+            {
+                file.removeDirectoryRec();
+            }
+        }
+
+        if (!(env_flags & MDB_NOSUBDIR))
+        {
+            file.createDirectory();
+        }
+
+        const auto result = mdb_env_copy2(*env, file.path().c_str(), flags);
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    std::shared_ptr<Database> Environment::database(const std::string &name, bool enable_compression, int flags)
+    {
+        // if we haven't already opened this name database, we need to do so now
+        if (!databases.contains(name))
+        {
+            /**
+             * We grab the Environment instance this way to make sure that we are using the
+             * shared pointer to the instance so we do not have a bunch of copies of our env
+             * running around
+             */
+            auto _env = Environment::instance(path);
+
+            // we create the shared pointer this way as our constructor is private to avoid public calls to it
+            std::shared_ptr<Database> db(new Database(_env, name, flags, enable_compression));
+
+            databases.insert(name, db);
+        }
+
+        return databases.at(name);
+    }
+
+    void Environment::enable_change_log(bool include_values)
+    {
+        // opening the database may need to take the environment lock, so we do that first
+        auto db = database(LMDB_CHANGE_LOG_NAME, false, MDB_INTEGERKEY);
+
+        std::scoped_lock lock(mutex);
+
+        change_values = include_values;
+
+        change_db = db;
+    }
+
+    Error Environment::detect_map_size() const
+    {
+        std::scoped_lock lock(mutex);
+
+        if (open_transactions() != 0)
+        {
+            return MAKE_LMDB_ERROR_MSG(
+                LMDB_ERROR, "Cannot detect LMDB environment map size while transactions are open");
+        }
+
+        const auto result = mdb_env_set_mapsize(*env, 0);
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    Error Environment::expand()
+    {
+        const auto [error, pages] = memory_to_pages(growth_factor * LMDB_SPACE_MULTIPLIER);
+
+        if (error)
+        {
+            return error;
+        }
+
+        return expand(pages);
+    }
+
+    Error Environment::expand(size_t pages)
+    {
+        std::scoped_lock lock(mutex);
+
+        if (open_transactions() != 0)
+        {
+            return MAKE_LMDB_ERROR_MSG(
+                LMDB_ERROR, "Cannot expand LMDB environment map size while transactions are open");
+        }
+
+        const auto [info_error, l_info] = info();
+
+        if (info_error)
+        {
+            return info_error;
+        }
+
+        const auto [stats_error, l_stats] = stats();
+
+        if (stats_error)
+        {
+            return stats_error;
+        }
+
+        const auto new_size = (l_stats.ms_psize * pages) + l_info.me_mapsize;
+
+        const auto result = mdb_env_set_mapsize(*env, new_size);
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    Error Environment::flush(bool force)
+    {
+        std::scoped_lock lock(mutex);
+
+        const auto result = mdb_env_sync(*env, (force) ? 1 : 0);
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    std::tuple<Error, unsigned int> Environment::get_flags() const
+    {
+        unsigned int flags;
+
+        const auto result = mdb_env_get_flags(*env, &flags);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), flags};
+    }
+
+    std::tuple<Error, MDB_envinfo> Environment::info() const
+    {
+        MDB_envinfo info;
+
+        const auto result = mdb_env_info(*env, &info);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), info};
+    }
+
+    std::shared_ptr<Environment> Environment::instance(
+        const std::string &path,
+        int flags,
+        int mode,
+        size_t growth_factor,
+        unsigned int max_databases)
+    {
+        auto file = cppfs::fs::open(path);
+
+        // if we have not already opened the environment at the specified path, we will do so now
+        if (!Environment::environments.contains(file.path()))
+        {
+            // we create the shared pointer this way because the constructor is private to prevent public calls to it
+            std::shared_ptr<Environment> db(new Environment(file.path(), growth_factor));
+
+            if (flags & MDB_NOSUBDIR)
+            {
+                if (file.exists() && !file.isFile())
+                {
+                    throw std::runtime_error("LMDB path must be a regular file");
+                }
+            }
+            else if (!file.isDirectory())
+            {
+                file.createDirectory();
+            }
+
+            // attempt to create the environment in the pointer
+            auto success = mdb_env_create(db->env.get());
+
+            if (success != MDB_SUCCESS)
+            {
+                throw std::runtime_error("Could not create LMDB environment: " + mdb_error(success));
+            }
+
+            // attempt to set the map size, this sets the minimum, if the environment is already bigger than
+            // this will have no effect
+            success = mdb_env_set_mapsize(*db->env, growth_factor * LMDB_SPACE_MULTIPLIER);
+
+            if (success != MDB_SUCCESS)
+            {
+                throw std::runtime_error("Could not allocate initial LMDB memory map: " + mdb_error(success));
+            }
+
+            // attempt to set the maximum number of databases that can be opened in the environment
+            success = mdb_env_set_maxdbs(*db->env, max_databases);
+
+            if (success != MDB_SUCCESS)
+            {
+                throw std::runtime_error("Could not set maximum number of LMDB named databases: " + mdb_error(success));
+            }
+
+            /**
+             * A transaction and its cursors must only be used by a single thread, and a thread may only have a
+             * single write transaction at a time. If MDB_NOTLS is in use, this does not apply to read-only
+             * transactions. This call actually opens the environment.
+             */
+            success = mdb_env_open(*db->env, file.path().c_str(), flags | MDB_NOTLS, mode);
+
+            if (success != MDB_SUCCESS)
+            {
+                mdb_env_close(*db->env);
+
+                throw std::runtime_error("Could not open LMDB database file [" + path + "]: " + mdb_error(success));
+            }
+
+            Environment::environments.insert(db->path, db);
+        }
+
+        return Environment::environments.at(file.path());
+    }
+
+    std::tuple<Error, size_t> Environment::max_key_size() const
+    {
+        const auto result = mdb_env_get_maxkeysize(*env);
+
+        return {MAKE_LMDB_ERROR(SUCCESS), result};
+    }
+
+    std::tuple<Error, size_t> Environment::max_readers() const
+    {
+        unsigned int readers = 0;
+
+        const auto result = mdb_env_get_maxreaders(*env, &readers);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), readers};
+    }
+
+    std::tuple<Error, size_t> Environment::memory_to_pages(size_t memory) const
+    {
+        const auto [error, l_stats] = stats();
+
+        if (error)
+        {
+            return {error, 0};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), size_t(ceil(double(memory) / double(l_stats.ms_psize)))};
+    }
+
+    std::tuple<Error, size_t> Environment::last_change_sequence()
+    {
+        if (!change_log_enabled())
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Change log is not enabled for the environment"), 0};
+        }
+
+        auto txn = change_db->transaction(true);
+
+        size_t sequence = 0;
+
+        const auto result = last_sequence(*txn->txn, change_db->dbi, sequence);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), sequence};
+    }
+
+    std::tuple<Error, size_t> Environment::last_txn_id() const
+    {
+        const auto [error, l_info] = info();
+
+        return {error, (error) ? 0 : l_info.me_last_txnid};
+    }
+
+    size_t Environment::open_transactions() const
+    {
+        std::scoped_lock lock(txn_mutex);
+
+        return open_txns;
+    }
+
+    Error Environment::set_flags(int flags, bool flag_state)
+    {
+        std::scoped_lock lock(mutex);
+
+        const auto result = mdb_env_set_flags(*env, flags, (flag_state) ? 1 : 0);
+
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    }
+
+    std::tuple<Error, MDB_stat> Environment::stats() const
+    {
+        MDB_stat stats;
+
+        const auto result = mdb_env_stat(*env, &stats);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), stats};
+    }
+
+    void Environment::transaction_register()
+    {
+        std::scoped_lock lock(txn_mutex);
+
+        open_txns++;
+    }
+
+    void Environment::transaction_unregister()
+    {
+        std::scoped_lock lock(txn_mutex);
+
+        if (open_txns > 0)
+        {
+            open_txns--;
+        }
+    }
+
+    std::tuple<int, int, int> Environment::version()
+    {
+        int major, minor, patch;
+
+        mdb_version(&major, &minor, &patch);
+
+        return {major, minor, patch};
+    }
+
+    size_t Environment::wait_for_commit(
+        size_t last_seen,
+        std::chrono::milliseconds timeout,
+        std::chrono::milliseconds poll_interval)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        std::unique_lock lock(commit_mutex);
+
+        while (true)
+        {
+            if (last_commit > last_seen)
+            {
+                return last_commit;
+            }
+
+            // commits by other processes do not notify us, so we have to look for them ourselves
+            if (poll_interval.count() > 0)
+            {
+                lock.unlock();
+
+                const auto [error, txn_id] = last_txn_id();
+
+                lock.lock();
+
+                if (!error)
+                {
+                    last_commit = std::max(last_commit, txn_id);
+                }
+
+                if (last_commit > last_seen)
+                {
+                    return last_commit;
+                }
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+
+            if (now >= deadline)
+            {
+                return last_commit;
+            }
+
+            const auto until = (poll_interval.count() > 0) ? std::min(deadline, now + poll_interval) : deadline;
+
+            commit_cv.wait_until(lock, until);
+        }
+    }
+
+    std::shared_ptr<Watch> Environment::watch(const std::shared_ptr<Database> &db, const void *prefix, size_t length)
+    {
+        // we create the shared pointer this way as our constructor is private to avoid public calls to it
+        std::shared_ptr<Watch> w(new Watch(db->dbi, load_value(prefix, length, false)));
+
+        std::scoped_lock lock(watch_mutex);
+
+        // clean up any watches that are no longer held
+        watches.erase(
+            std::remove_if(
+                watches.begin(), watches.end(), [](const std::weak_ptr<Watch> &weak) { return weak.expired(); }),
+            watches.end());
+
+        watches.push_back(w);
+
+        return w;
+    }
+
+    bool Environment::watching() const
+    {
+        std::scoped_lock lock(watch_mutex);
+
+        return !watches.empty();
+    }
+
+    bool Environment::writer_acquire(WritePriority priority, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(writer_mutex);
+
+        const auto ticket = writer_ticket++;
+
+        auto &lane = writer_lanes[priority];
+
+        lane.push_back(ticket);
+
+        // we go next once the slot is free, we are first in our lane, and no more urgent lane is waiting
+        const auto ready = [&]()
+        {
+            if (writer_held || lane.front() != ticket)
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < priority; ++i)
+            {
+                if (!writer_lanes[i].empty())
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        bool acquired = true;
+
+        if (timeout == std::chrono::milliseconds::max())
+        {
+            writer_cv.wait(lock, ready);
+        }
+        else
+        {
+            acquired = writer_cv.wait_for(lock, timeout, ready);
+        }
+
+        lane.erase(std::find(lane.begin(), lane.end(), ticket));
+
+        if (acquired)
+        {
+            writer_held = true;
+        }
+        else
+        {
+            // we may have been the writer holding up those behind us
+            writer_cv.notify_all();
+        }
+
+        return acquired;
+    }
+
+    bool Environment::writer_contended(WritePriority priority) const
+    {
+        std::scoped_lock lock(writer_mutex);
+
+        for (size_t i = 0; i < priority; ++i)
+        {
+            if (!writer_lanes[i].empty())
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void Environment::writer_release()
+    {
+        {
+            std::scoped_lock lock(writer_mutex);
+
+            writer_held = false;
+        }
+
+        writer_cv.notify_all();
+    }
+
+    Database::Database(
+        std::shared_ptr<Environment> &environment,
+        const std::string &name,
+        int flags,
+        bool enable_compression):
+        environment(environment), dbi(0), name(name), compression(enable_compression)
+    {
+        const auto [error, env_flags] = environment->get_flags();
+
+        const auto readonly = (env_flags & MDB_RDONLY);
+
+        std::unique_ptr<Transaction> txn(new Transaction(environment, readonly));
+
+        auto success = mdb_dbi_open(*txn->txn, name.empty() ? nullptr : name.c_str(), flags | MDB_CREATE, &dbi);
+
+        if (success != MDB_SUCCESS)
+        {
+            throw std::runtime_error("Unable to open LMDB named database [" + name + "]: " + mdb_error(success));
+        }
+
+        if (dbi == 0)
+        {
+            throw std::runtime_error("Could not open LMDB named database [" + name + "]: No DBI handle");
+        }
+
+        if (!(env_flags & MDB_RDONLY))
+        {
+            if (txn->commit() != SUCCESS)
+            {
+                throw std::runtime_error("Could not commit to open LMDB named database: [" + name + "]");
+            }
+        }
+    }
+
+    Database::~Database()
+    {
+        stop_ttl_sweeper();
+
+        mdb_dbi_close(*environment->env, dbi);
+
+        dbi = 0;
+
+        if (environment->databases.contains(name))
+        {
+            environment->databases.erase(name);
+        }
+    }
+
+    bool Database::compressed() const
+    {
+        return compression;
+    }
+
+    std::tuple<Error, mdb_result_t> Database::compare_and_swap(
+        const void *key,
+        size_t key_length,
+        const void *expected,
+        size_t expected_length,
+        const void *desired,
+        size_t desired_length)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto [error, current] =
+            txn->compare_and_swap(key, key_length, expected, expected_length, desired, desired_length);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return {error, current};
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return {error, {}};
+    }
+
+    size_t Database::count()
+    {
+        auto txn = transaction(true);
+
+        MDB_stat stat;
+
+        if (mdb_stat(*txn->txn, dbi, &stat) != MDB_SUCCESS)
+        {
+            return 0;
+        }
+
+        return stat.ms_entries;
+    }
+
+    std::shared_ptr<Index> Database::create_index(const std::string &index_name, index_extractor_t extractor)
+    {
+        const auto [error, dbi_flags] = get_flags();
+
+        if (error)
+        {
+            throw std::runtime_error("Could not retrieve LMDB database flags: " + error.to_string());
+        }
+
+        if (dbi_flags & MDB_DUPSORT)
+        {
+            throw std::runtime_error("Cannot create an index on LMDB database with sorted duplicates: [" + name + "]");
+        }
+
+        // if we haven't already registered this index, we need to do so now
+        if (!indexes.contains(index_name))
+        {
+            // we create the shared pointer this way as our constructor is private to avoid public calls to it
+            std::shared_ptr<Index> idx(new Index(environment, name, index_name, std::move(extractor)));
+
+            indexes.insert(index_name, idx);
+        }
+
+        return indexes.at(index_name);
+    }
+
+    Error Database::del(const void *key, size_t length)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto error = txn->del(key, length);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    Error Database::del(const void *key, size_t key_length, const void *value, size_t value_length)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto error = txn->del(key, key_length, value, value_length);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    Error Database::drop(bool delete_db)
+    {
+        std::scoped_lock lock(mutex);
+
+    try_again:
+        std::unique_ptr<Transaction> txn(new Transaction(environment));
+
+        auto result = mdb_drop(*txn->txn, dbi, (delete_db) ? 1 : 0);
+
+        if (result == MDB_MAP_FULL)
+        {
+            txn->abort();
+
+            environment->expand();
+
+            goto try_again;
+        }
+
+        return txn->commit();
+    }
+
+    void Database::enable_ttl()
+    {
+        std::scoped_lock lock(mutex);
+
+        if (ttl_db)
+        {
+            return;
+        }
+
+        ttl_keys_db = environment->database(name + ":ttl_keys");
+
+        ttl_db = environment->database(name + ":ttl", false, MDB_DUPSORT);
+    }
+
+    void Database::enable_versioning()
+    {
+        std::scoped_lock lock(mutex);
+
+        if (versions_db)
+        {
+            return;
+        }
+
+        versions_db = environment->database(name + ":versions");
+    }
+
+    std::tuple<Error, RangeEstimate> Database::estimate_range(
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length,
+        size_t samples,
+        size_t sample_size)
+    {
+        RangeEstimate estimate;
+
+        samples = std::max<size_t>(samples, 1);
+
+        sample_size = std::max<size_t>(sample_size, 1);
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        unsigned int flags = 0;
+
+        mdb_dbi_flags(*txn->txn, dbi, &flags);
+
+        MDB_stat stat;
+
+        if (const auto result = mdb_stat(*txn->txn, dbi, &stat); result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), estimate};
+        }
+
+        mdb_result_t first_key, last_key;
+
+        if (!range_bounds(cursor->cursor, begin, begin_length, end, end_length, first_key, last_key))
+        {
+            estimate.exact = true;
+
+            return {Error(SUCCESS), estimate};
+        }
+
+        auto i_first = load_val(first_key), i_last = load_val(last_key);
+
+        MDB_val key = i_first, value;
+
+        // count small ranges exactly (positioning on the first entry of the first key)
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_SET_KEY);
+
+        for (size_t i = 0; result == MDB_SUCCESS && i < samples * sample_size; ++i)
+        {
+            if (mdb_cmp(*txn->txn, dbi, &key, &i_last) > 0)
+            {
+                break;
+            }
+
+            estimate.entries++;
+
+            estimate.bytes += key.mv_size + value.mv_size;
+
+            result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT);
+        }
+
+        if (result != MDB_SUCCESS || mdb_cmp(*txn->txn, dbi, &key, &i_last) > 0)
+        {
+            estimate.exact = true;
+
+            return {Error(SUCCESS), estimate};
+        }
+
+        // the order of reversed keys does not follow their leading bytes
+        if (flags & MDB_REVERSEKEY)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_INCOMPATIBLE, "Reversed keys cannot be estimated"), RangeEstimate()};
+        }
+
+        const auto space = key_space(flags, first_key, last_key);
+
+        const auto width = static_cast<long double>(space.high - space.low) + 1;
+
+        long double entries = 0, bytes = 0;
+
+        for (size_t i = 0; i < samples; ++i)
+        {
+            const auto low = static_cast<long double>(space.low) + width * i / samples;
+
+            const auto high = static_cast<long double>(space.low) + width * (i + 1) / samples;
+
+            auto probe = (i == 0) ? first_key : position_key(space, static_cast<uint64_t>(std::ceil(low)));
+
+            key = load_val(probe);
+
+            result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_SET_RANGE);
+
+            size_t count = 0, size = 0;
+
+            long double last_position = low;
+
+            bool complete = true;
+
+            while (result == MDB_SUCCESS && mdb_cmp(*txn->txn, dbi, &key, &i_last) <= 0)
+            {
+                const auto position = static_cast<long double>(key_position(space, key.mv_data, key.mv_size));
+
+                if (position >= high)
+                {
+                    break;
+                }
+
+                if (count == sample_size)
+                {
+                    complete = false;
+
+                    break;
+                }
+
+                count++;
+
+                size += key.mv_size + value.mv_size;
+
+                last_position = position;
+
+                result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT);
+            }
+
+            // extrapolate the density of the keys read across the rest of the slice
+            const auto scale = (complete) ? 1 : (high - low) / (last_position - low + 1);
+
+            entries += count * scale;
+
+            bytes += size * scale;
+        }
+
+        const auto pages = stat.ms_branch_pages + stat.ms_leaf_pages + stat.ms_overflow_pages;
+
+        estimate.entries =
+            std::max(estimate.entries, std::min(stat.ms_entries, static_cast<size_t>(std::llround(entries))));
+
+        estimate.bytes =
+            std::max(estimate.bytes, std::min(pages * stat.ms_psize, static_cast<size_t>(std::llround(bytes))));
+
+        return {Error(SUCCESS), estimate};
+    }
+
+    bool Database::exists(const void *key, size_t length)
+    {
+        return transaction(true)->exists(key, length);
+    }
+
+    std::tuple<Error, mdb_result_t> Database::get(const void *key, size_t length)
+    {
+        return transaction(true)->get(key, length);
+    }
+
+    std::tuple<Error, mdb_pmr_result_t>
+        Database::get(const void *key, size_t length, std::pmr::memory_resource *resource)
+    {
+        return transaction(true)->get(key, length, resource);
+    }
+
+    std::vector<mdb_result_t> Database::get_all()
+    {
+        std::vector<mdb_result_t> results;
+
+        const auto keys = list_keys();
+
+        auto txn = transaction(true);
+
+        for (const auto &key : keys)
+        {
+            auto [error, value] = txn->get(key.data(), key.size());
+
+            if (!error)
+            {
+                results.emplace_back(std::move(value));
+            }
+        }
+
+        return results;
+    }
+
+    Error Database::get_all(ResultSet &results)
+    {
+        results.clear();
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        MDB_val key, value;
+
+        // like get_all() above, only the first value of each key is retrieved
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT_NODUP))
+        {
+            results.append(&key, &value);
+        }
+
+        if (result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    std::tuple<Error, unsigned int> Database::get_flags()
+    {
+        auto txn = transaction(true);
+
+        unsigned int dbi_flags;
+
+        const auto result = mdb_dbi_flags(*txn->txn, dbi, &dbi_flags);
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), dbi_flags};
+    }
+
+    std::shared_ptr<Index> Database::index(const std::string &index_name)
+    {
+        if (!indexes.contains(index_name))
+        {
+            return nullptr;
+        }
+
+        return indexes.at(index_name);
+    }
+
+    std::vector<mdb_result_t> Database::list_keys(bool ignore_duplicates)
+    {
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        std::vector<mdb_result_t> results;
+
+        const auto op = (ignore_duplicates) ? MDB_NEXT_NODUP : MDB_NEXT;
+
+        MDB_val key, value;
+
+        // LMDB only points the value at its page, so overflow pages of large values are not read
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, op))
+        {
+            results.emplace_back(load_value(key.mv_data, key.mv_size, false));
+        }
+
+        return results;
+    }
+
+    Error Database::list_keys(ResultSet &results, bool ignore_duplicates)
+    {
+        results.clear();
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        const auto op = (ignore_duplicates) ? MDB_NEXT_NODUP : MDB_NEXT;
+
+        MDB_val key, value;
+
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, op))
+        {
+            results.append(&key, nullptr);
+        }
+
+        if (result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error Database::list_values(ResultSet &results)
+    {
+        results.clear();
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        MDB_val key, value;
+
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT))
+        {
+            results.append(nullptr, &value);
+        }
+
+        if (result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error Database::merge(
+        const void *key,
+        size_t key_length,
+        const void *operand,
+        size_t operand_length,
+        const merge_operator_t &merge_operator)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto error = txn->merge(key, key_length, operand, operand_length, merge_operator);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    Error Database::merge_batch(
+        const std::vector<std::tuple<mdb_result_t, mdb_result_t>> &operations,
+        const merge_operator_t &merge_operator)
+    {
+        // group the operands by key (in key order) while preserving the order they were supplied in
+        std::map<mdb_result_t, std::vector<const mdb_result_t *>> grouped;
+
+        for (const auto &[key, operand] : operations)
+        {
+            grouped[key].push_back(&operand);
+        }
+
+    try_again:
+        auto txn = transaction();
+
+        Error error;
+
+        for (const auto &[key, operands] : grouped)
+        {
+            auto [get_error, value] = txn->get(key);
+
+            if (get_error && get_error != LMDB_NOTFOUND)
+            {
+                error = get_error;
+
+                break;
+            }
+
+            const auto found = !get_error;
+
+            bool exists = found;
+
+            try
+            {
+                for (const auto &operand : operands)
+                {
+                    value = merge_operator((exists) ? &value : nullptr, *operand);
+
+                    exists = true;
+                }
+            }
+            catch (const std::invalid_argument &e)
+            {
+                error = MAKE_LMDB_ERROR_MSG(LMDB_BAD_VALSIZE, e.what());
+
+                break;
+            }
+
+            error = txn->write(key.data(), key.size(), value.data(), value.size(), 0, (found) ? LMDB_TTL_KEEP : 0);
+
+            if (error)
+            {
+                break;
+            }
+        }
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    Error Database::parallel_scan(
+        const scan_visitor_t &visitor,
+        size_t threads,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length)
+    {
+        if (threads == 0)
+        {
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        // the boundaries of the ranges, where an empty boundary is the start (or end) of the database
+        std::vector<mdb_result_t> boundaries;
+
+        const auto begin_bytes = static_cast<const unsigned char *>(begin);
+
+        const auto end_bytes = static_cast<const unsigned char *>(end);
+
+        boundaries.emplace_back(begin_bytes, begin_bytes + begin_length);
+
+        const auto partitions = threads * LMDB_PARALLEL_SCAN_RANGES_PER_THREAD;
+
+        for (auto &point : split_points(partitions, begin, begin_length, end, end_length))
+        {
+            boundaries.push_back(std::move(point));
+        }
+
+        boundaries.emplace_back(end_bytes, end_bytes + end_length);
+
+        std::vector<std::shared_ptr<Transaction>> txns;
+
+        for (size_t attempt = 0; attempt < LMDB_PARALLEL_SCAN_ATTEMPTS && txns.size() != threads; ++attempt)
+        {
+            txns.clear();
+
+            size_t snapshot = 0;
+
+            // as the environment uses MDB_NOTLS, we can open the transactions here and hand them to the workers
+            for (size_t i = 0; i < threads; ++i)
+            {
+                auto txn = transaction(true);
+
+                const auto [error, id] = txn->id();
+
+                if (error)
+                {
+                    return error;
+                }
+
+                // a write was committed since the first transaction was opened, so we start over
+                if (i != 0 && id != snapshot)
+                {
+                    break;
+                }
+
+                snapshot = id;
+
+                txns.push_back(txn);
+            }
+        }
+
+        if (txns.size() != threads)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_CONFLICT, "Could not open the scan transactions on the same snapshot");
+        }
+
+        std::atomic<size_t> next_range(0);
+
+        std::atomic<bool> stop(false);
+
+        std::vector<Error> errors(threads);
+
+        std::vector<std::exception_ptr> exceptions(threads);
+
+        std::vector<std::thread> workers;
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(
+                [&, i]
+                {
+                    try
+                    {
+                        MDB_cursor *cursor = nullptr;
+
+                        auto result = mdb_cursor_open(*txns[i]->txn, dbi, &cursor);
+
+                        // take the next unscanned range until there are none left
+                        for (auto range = next_range++; result == MDB_SUCCESS && !stop && range + 1 < boundaries.size();
+                             range = next_range++)
+                        {
+                            const auto &lower = boundaries[range], &upper = boundaries[range + 1];
+
+                            MDB_val i_key = load_val(lower), i_value, i_upper = load_val(upper);
+
+                            const auto op = (!lower.empty()) ? MDB_SET_RANGE : MDB_FIRST;
+
+                            for (result = mdb_cursor_get(cursor, &i_key, &i_value, op); result == MDB_SUCCESS && !stop;
+                                 result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT))
+                            {
+                                if (!upper.empty() && mdb_cmp(*txns[i]->txn, dbi, &i_key, &i_upper) >= 0)
+                                {
+                                    break;
+                                }
+
+                                if (!visitor(i, i_key, i_value))
+                                {
+                                    stop = true;
+                                }
+                            }
+
+                            result = (result == MDB_NOTFOUND) ? MDB_SUCCESS : result;
+                        }
+
+                        if (cursor)
+                        {
+                            mdb_cursor_close(cursor);
+                        }
+
+                        if (result != MDB_SUCCESS)
+                        {
+                            errors[i] = MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+
+                            stop = true;
+                        }
+                    }
+                    catch (...)
+                    {
+                        exceptions[i] = std::current_exception();
+
+                        stop = true;
+                    }
+                });
+        }
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        for (const auto &exception : exceptions)
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        for (const auto &error : errors)
+        {
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    std::tuple<Error, size_t> Database::purge_expired(size_t limit)
+    {
+        if (!ttl_enabled())
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "TTL support is not enabled for the database"), 0};
+        }
+
+    try_again:
+        auto txn = transaction();
+
+        MDB_cursor *cursor = nullptr;
+
+        auto result = mdb_cursor_open(*txn->txn, ttl_db->dbi, &cursor);
+
+        if (result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), 0};
+        }
+
+        const auto now = now_ms();
+
+        std::vector<mdb_result_t> keys;
+
+        MDB_val i_key, i_value;
+
+        result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_FIRST);
+
+        // the TTL index is ordered by expiry so we can stop as soon as we find a key that has not expired
+        while (result == MDB_SUCCESS && keys.size() < limit && decode_u64(i_key) <= now)
+        {
+            keys.push_back(load_value(i_value.mv_data, i_value.mv_size, false));
+
+            result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
+        }
+
+        mdb_cursor_close(cursor);
+
+        Error error;
+
+        size_t purged = 0;
+
+        for (const auto &key : keys)
+        {
+            error = txn->del(key);
+
+            // the key is already gone, but we still need to clean up its TTL entries
+            if (error == LMDB_NOTFOUND)
+            {
+                error = txn->ttl_update(key, 0);
+            }
+            else if (!error)
+            {
+                purged++;
+            }
+
+            if (error)
+            {
+                break;
+            }
+        }
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return {error, 0};
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return {error, (error) ? 0 : purged};
+    }
+
+    Error Database::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto error = txn->put(key, key_length, value, value_length, flags);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    Error Database::put(
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length,
+        std::chrono::milliseconds ttl,
+        int flags)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto error = txn->put(key, key_length, value, value_length, ttl, flags);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return error;
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return error;
+    }
+
+    std::tuple<Error, mdb_result_t>
+        Database::put_if_absent(const void *key, size_t key_length, const void *value, size_t value_length)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto [error, current] = txn->put_if_absent(key, key_length, value, value_length);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return {error, current};
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return {error, {}};
+    }
+
+    std::tuple<Error, uint64_t, mdb_result_t> Database::put_if_version(
+        const void *key,
+        size_t key_length,
+        uint64_t expected_version,
+        const void *value,
+        size_t value_length)
+    {
+    try_again:
+        auto txn = transaction();
+
+        auto [error, version, current] = txn->put_if_version(key, key_length, expected_version, value, value_length);
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        if (error)
+        {
+            return {error, version, current};
+        }
+
+        error = txn->commit();
+
+        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+        return {error, (error) ? 0 : version, {}};
+    }
+
+    Error Database::sample(size_t n, ResultSet &results)
+    {
+        results.clear();
+
+        if (n == 0)
+        {
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
+
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        unsigned int flags = 0;
+
+        mdb_dbi_flags(*txn->txn, dbi, &flags);
+
+        // the order of reversed keys does not follow their leading bytes
+        if (flags & MDB_REVERSEKEY)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_INCOMPATIBLE, "Reversed keys cannot be sampled");
+        }
+
+        MDB_stat stat;
+
+        if (const auto result = mdb_stat(*txn->txn, dbi, &stat); result != MDB_SUCCESS)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        mdb_result_t first_key, last_key;
+
+        if (!range_bounds(cursor->cursor, nullptr, 0, nullptr, 0, first_key, last_key))
+        {
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
+
+        const auto space = key_space(flags, first_key, last_key);
+
+        // an entry with the average gap to the preceding key is accepted with a probability of 1 / bound
+        const auto acceptance = (static_cast<long double>(space.high - space.low) + 1)
+                                / std::max<size_t>(stat.ms_entries, 1) / LMDB_SAMPLE_DENSITY_BOUND;
+
+        std::mt19937_64 generator(std::random_device {}());
+
+        std::uniform_int_distribution<uint64_t> positions(space.low, space.high);
+
+        std::uniform_real_distribution<long double> draws(0, 1);
+
+        MDB_val key, value;
+
+        for (size_t attempt = 0; results.size() < n && attempt < n * LMDB_SAMPLE_ATTEMPTS; ++attempt)
+        {
+            const auto probe = position_key(space, positions(generator));
+
+            key = load_val(probe);
+
+            if (mdb_cursor_get(cursor->cursor, &key, &value, MDB_SET_RANGE) != MDB_SUCCESS)
+            {
+                continue;
+            }
+
+            const auto position = key_position(space, key.mv_data, key.mv_size);
+
+            // the group is every entry (including duplicates) at the position landed on
+            size_t group = 1;
+
+            while (group < LMDB_SAMPLE_GROUP_LIMIT
+                   && mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT) == MDB_SUCCESS
+                   && key_position(space, key.mv_data, key.mv_size) == position)
+            {
+                group++;
+            }
+
+            // the probes that land on the group are those after the position of the preceding key
+            key = load_val(probe);
+
+            mdb_cursor_get(cursor->cursor, &key, &value, MDB_SET_RANGE);
+
+            auto gap = position - space.low + 1;
+
+            if (mdb_cursor_get(cursor->cursor, &key, &value, MDB_PREV) == MDB_SUCCESS)
+            {
+                gap = position - key_position(space, key.mv_data, key.mv_size);
+            }
+
+            if (draws(generator) >= acceptance * group / std::max<uint64_t>(gap, 1))
+            {
+                continue;
+            }
+
+            key = load_val(probe);
+
+            mdb_cursor_get(cursor->cursor, &key, &value, MDB_SET_RANGE);
+
+            for (auto skip = std::uniform_int_distribution<size_t>(0, group - 1)(generator); skip > 0; --skip)
+            {
+                mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT);
+            }
+
+            results.append(&key, &value);
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error Database::scan_keys(
+        const data_visitor_t &visitor,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length,
+        bool ignore_duplicates)
+    {
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        const auto op = (ignore_duplicates) ? MDB_NEXT_NODUP : MDB_NEXT;
+
+        MDB_val key = {begin_length, const_cast<void *>(begin)}, value, i_end = {end_length, const_cast<void *>(end)};
+
+        // LMDB only points the value at its page, so overflow pages of large values are not read
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, op))
+        {
+            if ((end_length != 0 && mdb_cmp(*txn->txn, dbi, &key, &i_end) >= 0) || !visitor(key))
+            {
+                break;
+            }
+        }
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error Database::scan_values(
+        const data_visitor_t &visitor,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length)
+    {
+        auto txn = transaction(true);
+
+        auto cursor = txn->cursor();
+
+        MDB_val key = {begin_length, const_cast<void *>(begin)}, value, i_end = {end_length, const_cast<void *>(end)};
+
+        auto result = mdb_cursor_get(cursor->cursor, &key, &value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor->cursor, &key, &value, MDB_NEXT))
+        {
+            if ((end_length != 0 && mdb_cmp(*txn->txn, dbi, &key, &i_end) >= 0) || !visitor(value))
+            {
+                break;
+            }
+        }
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    std::vector<mdb_result_t> Database::split_points(
+        size_t partitions,
+        const void *begin,
+        size_t begin_length,
+        const void *end,
+        size_t end_length)
     {
-        std::scoped_lock lock(mutex);
+        std::vector<mdb_result_t> points;
 
-        // clear the list of databases, which will destruct them and close them
-        databases.clear();
+        if (partitions < 2)
+        {
+            return points;
+        }
 
-        // flush the database to disk
-        flush(true);
+        auto txn = transaction(true);
 
-        mdb_env_close(*env);
+        auto cursor = txn->cursor();
 
-        env = nullptr;
+        unsigned int flags = 0;
 
-        if (Environment::environments.contains(path))
+        mdb_dbi_flags(*txn->txn, dbi, &flags);
+
+        // the order of reversed keys does not follow their leading bytes
+        if (flags & MDB_REVERSEKEY)
         {
-            Environment::environments.erase(path);
+            return points;
+        }
+
+        mdb_result_t first_key, last_key;
+
+        if (!range_bounds(cursor->cursor, begin, begin_length, end, end_length, first_key, last_key))
+        {
+            return points;
+        }
+
+        auto i_first = load_val(first_key), i_last = load_val(last_key);
+
+        if (mdb_cmp(*txn->txn, dbi, &i_first, &i_last) == 0)
+        {
+            return points;
+        }
+
+        const auto space = key_space(flags, first_key, last_key);
+
+        MDB_val value;
+
+        for (size_t i = 1; i < partitions && space.high > space.low; ++i)
+        {
+            const auto target = space.low
+                                + static_cast<uint64_t>(
+                                    static_cast<long double>(space.high - space.low) * static_cast<long double>(i)
+                                    / partitions);
+
+            const auto probe = position_key(space, target);
+
+            // position the split point on the first existing key at or after the probe
+            MDB_val i_probe = load_val(probe);
+
+            if (mdb_cursor_get(cursor->cursor, &i_probe, &value, MDB_SET_RANGE) != MDB_SUCCESS
+                || mdb_cmp(*txn->txn, dbi, &i_probe, &i_last) > 0)
+            {
+                break;
+            }
+
+            if (mdb_cmp(*txn->txn, dbi, &i_probe, &i_first) <= 0)
+            {
+                continue;
+            }
+
+            if (!points.empty())
+            {
+                auto i_previous = load_val(points.back());
+
+                if (mdb_cmp(*txn->txn, dbi, &i_probe, &i_previous) <= 0)
+                {
+                    continue;
+                }
+            }
+
+            points.push_back(load_value(i_probe.mv_data, i_probe.mv_size, false));
         }
+
+        return points;
     }
 
-    Error Environment::copy(const std::string &dst_path, unsigned int flags)
+    void Database::start_ttl_sweeper(std::chrono::milliseconds interval, size_t chunk_size)
     {
-        std::scoped_lock lock(mutex);
+        if (!ttl_enabled())
+        {
+            throw std::runtime_error("TTL support is not enabled for LMDB database: [" + name + "]");
+        }
 
-        auto file = cppfs::fs::open(dst_path);
+        stop_ttl_sweeper();
 
-        auto [error, env_flags] = get_flags();
+        auto state = std::make_shared<ttl_sweeper_state_t>();
 
-        if (error)
+        /**
+         * The sweeper only holds a weak reference to the database so that it does not keep
+         * the database alive and exits on its own if the database goes away
+         */
+        std::weak_ptr<Database> weak_db = environment->database(name);
+
+        ttl_sweeper_state = state;
+
+        ttl_sweeper = std::thread(
+            [state, weak_db, interval, chunk_size]
+            {
+                std::unique_lock lock(state->mutex);
+
+                while (!state->cv.wait_for(lock, interval, [&state] { return state->stop; }))
+                {
+                    lock.unlock();
+
+                    if (auto db = weak_db.lock())
+                    {
+                        // only sweep while no one else is writing to the environment
+                        while (db->environment->open_transactions() == 0)
+                        {
+                            const auto [error, purged] = db->purge_expired(chunk_size);
+
+                            if (error || purged < chunk_size)
+                            {
+                                break;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        return;
+                    }
+
+                    lock.lock();
+                }
+            });
+    }
+
+    void Database::stop_ttl_sweeper()
+    {
+        if (!ttl_sweeper_state)
         {
-            throw std::runtime_error("Could not get environment flags");
+            return;
         }
 
-        // if the new path already exists, we need to clear it
-        if (file.exists())
         {
-            if (file.isFile())
+            std::scoped_lock lock(ttl_sweeper_state->mutex);
+
+            ttl_sweeper_state->stop = true;
+        }
+
+        ttl_sweeper_state->cv.notify_all();
+
+        if (ttl_sweeper.joinable())
+        {
+            // the sweeper may hold the last reference to the database, in which case we are running on it
+            if (ttl_sweeper.get_id() == std::this_thread::get_id())
             {
-                file.remove();
+                ttl_sweeper.detach();
             }
             else
             {
-                file.removeDirectoryRec();
+                ttl_sweeper.join();
             }
         }
 
-        if (!(env_flags & MDB_NOSUBDIR))
+        ttl_sweeper_state = nullptr;
+    }
+
+    std::shared_ptr<Transaction> Database::transaction(bool readonly)
+    {
+        std::shared_ptr<Database> db;
+
         {
-            file.createDirectory();
+            std::scoped_lock lock(mutex);
+
+            /**
+             * We fetch the database instance this way to make sure that we do not
+             * have a bunch of extra instances running around
+             */
+            db = environment->database(name);
         }
 
-        const auto result = mdb_env_copy2(*env, file.path().c_str(), flags);
+        // the write transaction is waited for outside the lock so that we do not block readers of the database
+        return std::shared_ptr<Transaction>(new Transaction(environment, db, readonly));
+    }
 
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    std::tuple<Error, std::shared_ptr<Transaction>>
+        Database::transaction(std::chrono::milliseconds timeout, WritePriority priority)
+    {
+        std::shared_ptr<Database> db;
+
+        {
+            std::scoped_lock lock(mutex);
+
+            db = environment->database(name);
+        }
+
+        if (!environment->writer_acquire(priority, timeout))
+        {
+            return {MAKE_LMDB_ERROR(LMDB_TIMEOUT), nullptr};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), std::shared_ptr<Transaction>(new Transaction(environment, db, priority))};
     }
 
-    std::shared_ptr<Database> Environment::database(const std::string &name, bool enable_compression, int flags)
+    bool Database::ttl_enabled() const
     {
-        // if we haven't already opened this name database, we need to do so now
-        if (!databases.contains(name))
+        return ttl_db != nullptr;
+    }
+
+    std::tuple<Error, uint64_t> Database::version(const void *key, size_t length)
+    {
+        return transaction(true)->version(key, length);
+    }
+
+    bool Database::versioned() const
+    {
+        return versions_db != nullptr;
+    }
+
+    Index::Index(
+        std::shared_ptr<Environment> &environment,
+        std::string primary,
+        std::string name,
+        index_extractor_t extractor):
+        environment(environment), primary(std::move(primary)), m_name(std::move(name)), extractor(std::move(extractor))
+    {
+        db = environment->database(this->primary + ":" + m_name, false, MDB_DUPSORT);
+    }
+
+    Error Index::backfill(size_t threads)
+    {
+        if (threads == 0)
         {
-            /**
-             * We grab the Environment instance this way to make sure that we are using the
-             * shared pointer to the instance so we do not have a bunch of copies of our env
-             * running around
-             */
-            auto _env = Environment::instance(path);
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        struct entry_t
+        {
+            mdb_result_t key;
+
+            size_t hash = 0;
+
+            std::vector<mdb_result_t> index_keys;
+        };
+
+        auto primary_db = environment->database(primary);
+
+        // each worker indexes its own slice of the key space, where an empty boundary is the start (or end) of it
+        std::vector<mdb_result_t> boundaries(1);
+
+        for (auto &point : primary_db->split_points(threads))
+        {
+            boundaries.push_back(std::move(point));
+        }
+
+        boundaries.emplace_back();
+
+        threads = boundaries.size() - 1;
+
+        // writes the entries read by a worker, re-extracting any primary value that changed since it was read
+        const auto write = [&](std::vector<entry_t> &entries) -> Error
+        {
+        try_again:
+            // each chunk queues in the bulk lane so that other writers can go between chunks
+            auto [txn_error, txn] = primary_db->transaction(std::chrono::milliseconds::max(), WRITE_PRIORITY_BULK);
+
+            if (txn_error)
+            {
+                return txn_error;
+            }
+
+            std::vector<std::tuple<mdb_result_t, mdb_result_t>> pairs;
+
+            for (auto &entry : entries)
+            {
+                auto i_key = load_val(entry.key);
+
+                MDB_val i_value;
+
+                // the primary key has been deleted since we read it
+                if (mdb_get(*txn->txn, primary_db->dbi, &i_key, &i_value) != MDB_SUCCESS)
+                {
+                    continue;
+                }
+
+                // the primary value has changed since we read it
+                if (hash_val(i_value) != entry.hash)
+                {
+                    entry.hash = hash_val(i_value);
+
+                    entry.index_keys = extractor(entry.key, load_result(i_value));
+                }
+
+                for (const auto &index_key : entry.index_keys)
+                {
+                    pairs.emplace_back(index_key, entry.key);
+                }
+            }
+
+            // writing in sorted order keeps the index pages we are touching hot
+            std::sort(pairs.begin(), pairs.end());
+
+            Error error;
+
+            for (const auto &[index_key, primary_key] : pairs)
+            {
+                auto i_key = load_val(index_key);
+
+                auto i_value = load_val(primary_key);
+
+                const auto result = mdb_put(*txn->txn, db->dbi, &i_key, &i_value, MDB_NODUPDATA);
+
+                if (result != MDB_SUCCESS && result != MDB_KEYEXIST)
+                {
+                    error = MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+
+                    break;
+                }
+            }
+
+            LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+            if (error)
+            {
+                return error;
+            }
+
+            error = txn->commit();
+
+            LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+
+            return error;
+        };
+
+        std::atomic<bool> stop(false);
+
+        std::vector<Error> errors(threads);
+
+        std::vector<std::exception_ptr> exceptions(threads);
+
+        std::vector<std::thread> workers;
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(
+                [&, i]
+                {
+                    try
+                    {
+                        const auto &upper = boundaries[i + 1];
+
+                        auto resume = boundaries[i];
+
+                        bool skip_resume = false, done = false;
+
+                        /**
+                         * The slice is read in bounded chunks, each in a short lived read transaction, and
+                         * every chunk is written before the next is read so that memory use stays bounded
+                         */
+                        while (!done && !stop)
+                        {
+                            auto txn = primary_db->transaction(true);
+
+                            MDB_cursor *cursor = nullptr;
+
+                            auto result = mdb_cursor_open(*txn->txn, primary_db->dbi, &cursor);
+
+                            std::vector<entry_t> entries;
+
+                            if (result == MDB_SUCCESS)
+                            {
+                                MDB_val i_key = load_val(resume), i_value, i_upper = load_val(upper);
+
+                                const auto op = (!resume.empty()) ? MDB_SET_RANGE : MDB_FIRST;
+
+                                result = mdb_cursor_get(cursor, &i_key, &i_value, op);
+
+                                // the chunk before this one ended on the key we resume from
+                                if (result == MDB_SUCCESS && skip_resume)
+                                {
+                                    auto i_resume = load_val(resume);
+
+                                    if (mdb_cmp(*txn->txn, primary_db->dbi, &i_key, &i_resume) == 0)
+                                    {
+                                        result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
+                                    }
+                                }
+
+                                while (result == MDB_SUCCESS && entries.size() < LMDB_INDEX_BACKFILL_CHUNK)
+                                {
+                                    if (!upper.empty() && mdb_cmp(*txn->txn, primary_db->dbi, &i_key, &i_upper) >= 0)
+                                    {
+                                        result = MDB_NOTFOUND;
+
+                                        break;
+                                    }
+
+                                    entry_t entry;
+
+                                    entry.key = load_value(i_key.mv_data, i_key.mv_size, false);
+
+                                    entry.hash = hash_val(i_value);
+
+                                    entry.index_keys = extractor(entry.key, load_result(i_value));
+
+                                    entries.push_back(std::move(entry));
+
+                                    result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
+                                }
+
+                                mdb_cursor_close(cursor);
+                            }
+
+                            txn->abort();
+
+                            done = (result == MDB_NOTFOUND);
+
+                            if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+                            {
+                                errors[i] = MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+
+                                stop = true;
+
+                                break;
+                            }
+
+                            if (entries.empty())
+                            {
+                                continue;
+                            }
+
+                            resume = entries.back().key;
+
+                            skip_resume = true;
+
+                            if (auto error = write(entries))
+                            {
+                                errors[i] = error;
+
+                                stop = true;
+                            }
+                        }
+                    }
+                    catch (...)
+                    {
+                        exceptions[i] = std::current_exception();
+
+                        stop = true;
+                    }
+                });
+        }
+
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        for (const auto &exception : exceptions)
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        for (const auto &error : errors)
+        {
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    size_t Index::count(const void *key, size_t length)
+    {
+        auto txn = db->transaction(true);
+
+        MDB_cursor *cursor = nullptr;
+
+        if (mdb_cursor_open(*txn->txn, db->dbi, &cursor) != MDB_SUCCESS)
+        {
+            return 0;
+        }
+
+        LMDB_LOAD_VALUE(key, length, i_key, false);
+
+        MDB_val i_value;
+
+        size_t count = 0;
+
+        if (mdb_cursor_get(cursor, &i_key, &i_value, MDB_SET) == MDB_SUCCESS)
+        {
+            mdb_cursor_count(cursor, &count);
+        }
+
+        mdb_cursor_close(cursor);
+
+        return count;
+    }
+
+    Error Index::insert(MDB_txn *txn, const mdb_result_t &key, const mdb_result_t &value)
+    {
+        const auto index_keys = extractor(key, value);
 
-            // we create the shared pointer this way as our constructor is private to avoid public calls to it
-            std::shared_ptr<Database> db(new Database(_env, name, flags, enable_compression));
+        auto i_value = load_val(key);
 
-            databases.insert(name, db);
+        for (const auto &index_key : index_keys)
+        {
+            auto i_key = load_val(index_key);
+
+            const auto result = mdb_put(txn, db->dbi, &i_key, &i_value, MDB_NODUPDATA);
+
+            if (result != MDB_SUCCESS && result != MDB_KEYEXIST)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
         }
 
-        return databases.at(name);
+        return MAKE_LMDB_ERROR(SUCCESS);
     }
 
-    Error Environment::detect_map_size() const
+    std::vector<mdb_result_t> Index::lookup(const void *key, size_t length)
     {
-        std::scoped_lock lock(mutex);
+        std::vector<mdb_result_t> results;
 
-        if (open_transactions() != 0)
+        auto txn = db->transaction(true);
+
+        MDB_cursor *cursor = nullptr;
+
+        if (mdb_cursor_open(*txn->txn, db->dbi, &cursor) != MDB_SUCCESS)
         {
-            return MAKE_LMDB_ERROR_MSG(
-                LMDB_ERROR, "Cannot detect LMDB environment map size while transactions are open");
+            return results;
         }
 
-        const auto result = mdb_env_set_mapsize(*env, 0);
+        LMDB_LOAD_VALUE(key, length, i_key, false);
 
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
-    }
+        MDB_val i_value;
 
-    Error Environment::expand()
-    {
-        const auto [error, pages] = memory_to_pages(growth_factor * LMDB_SPACE_MULTIPLIER);
+        auto result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_SET);
 
-        if (error)
+        while (result == MDB_SUCCESS)
         {
-            return error;
+            results.push_back(load_value(i_value.mv_data, i_value.mv_size, false));
+
+            result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT_DUP);
         }
 
-        return expand(pages);
+        mdb_cursor_close(cursor);
+
+        return results;
     }
 
-    Error Environment::expand(size_t pages)
+    std::string Index::name() const
     {
-        std::scoped_lock lock(mutex);
+        return m_name;
+    }
 
-        if (open_transactions() != 0)
+    std::vector<std::tuple<mdb_result_t, mdb_result_t>>
+        Index::range(const void *begin, size_t begin_length, const void *end, size_t end_length, size_t limit)
+    {
+        std::vector<std::tuple<mdb_result_t, mdb_result_t>> results;
+
+        auto txn = db->transaction(true);
+
+        MDB_cursor *cursor = nullptr;
+
+        if (mdb_cursor_open(*txn->txn, db->dbi, &cursor) != MDB_SUCCESS)
         {
-            return MAKE_LMDB_ERROR_MSG(
-                LMDB_ERROR, "Cannot expand LMDB environment map size while transactions are open");
+            return results;
         }
 
-        const auto [info_error, l_info] = info();
+        LMDB_LOAD_VALUE(begin, begin_length, i_key, false);
 
-        if (info_error)
+        LMDB_LOAD_VALUE(end, end_length, i_end, false);
+
+        MDB_val i_value;
+
+        auto result = mdb_cursor_get(cursor, &i_key, &i_value, (begin_length != 0) ? MDB_SET_RANGE : MDB_FIRST);
+
+        while (result == MDB_SUCCESS)
         {
-            return info_error;
+            if (end_length != 0 && mdb_cmp(*txn->txn, db->dbi, &i_key, &i_end) >= 0)
+            {
+                break;
+            }
+
+            results.emplace_back(
+                load_value(i_key.mv_data, i_key.mv_size, false), load_value(i_value.mv_data, i_value.mv_size, false));
+
+            if (limit != 0 && results.size() >= limit)
+            {
+                break;
+            }
+
+            result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_NEXT);
         }
 
-        const auto [stats_error, l_stats] = stats();
+        mdb_cursor_close(cursor);
 
-        if (stats_error)
+        return results;
+    }
+
+    Error Index::remove(MDB_txn *txn, const mdb_result_t &key, const mdb_result_t &value)
+    {
+        const auto index_keys = extractor(key, value);
+
+        auto i_value = load_val(key);
+
+        for (const auto &index_key : index_keys)
         {
-            return stats_error;
+            auto i_key = load_val(index_key);
+
+            const auto result = mdb_del(txn, db->dbi, &i_key, &i_value);
+
+            if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
         }
 
-        const auto new_size = (l_stats.ms_psize * pages) + l_info.me_mapsize;
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
 
-        const auto result = mdb_env_set_mapsize(*env, new_size);
+    Watch::Watch(MDB_dbi dbi, mdb_result_t prefix): dbi(dbi), prefix(std::move(prefix)) {}
 
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+    bool Watch::matches(MDB_dbi key_dbi, const mdb_result_t &key) const
+    {
+        return key_dbi == dbi && key.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), key.begin());
     }
 
-    Error Environment::flush(bool force)
+    size_t Watch::pending() const
     {
         std::scoped_lock lock(mutex);
 
-        const auto result = mdb_env_sync(*env, (force) ? 1 : 0);
-
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        return triggered;
     }
 
-    std::tuple<Error, unsigned int> Environment::get_flags() const
+    void Watch::trigger()
     {
-        unsigned int flags;
+        {
+            std::scoped_lock lock(mutex);
 
-        const auto result = mdb_env_get_flags(*env, &flags);
+            triggered++;
+        }
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), flags};
+        cv.notify_all();
     }
 
-    std::tuple<Error, MDB_envinfo> Environment::info() const
+    bool Watch::wait(std::chrono::milliseconds timeout)
     {
-        MDB_envinfo info;
+        std::unique_lock lock(mutex);
 
-        const auto result = mdb_env_info(*env, &info);
+        const auto result = cv.wait_for(lock, timeout, [this] { return triggered != 0; });
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), info};
+        triggered = 0;
+
+        return result;
     }
 
-    std::shared_ptr<Environment> Environment::instance(
-        const std::string &path,
-        int flags,
-        int mode,
-        size_t growth_factor,
-        unsigned int max_databases)
+    Transaction::Transaction(std::shared_ptr<Environment> &environment, bool readonly):
+        environment(environment), m_readonly(readonly)
     {
-        auto file = cppfs::fs::open(path);
+        txn_setup();
+    }
 
-        // if we have not already opened the environment at the specified path, we will do so now
-        if (!Environment::environments.contains(file.path()))
-        {
-            // we create the shared pointer this way because the constructor is private to prevent public calls to it
-            std::shared_ptr<Environment> db(new Environment(file.path(), growth_factor));
+    Transaction::Transaction(
+        std::shared_ptr<Environment> &environment,
+        std::shared_ptr<Database> &database,
+        bool readonly):
+        environment(environment), db(database), m_readonly(readonly)
+    {
+        txn_setup();
+    }
 
-            if (flags & MDB_NOSUBDIR)
-            {
-                if (file.exists() && !file.isFile())
-                {
-                    throw std::runtime_error("LMDB path must be a regular file");
-                }
-            }
-            else if (!file.isDirectory())
-            {
-                file.createDirectory();
-            }
+    Transaction::Transaction(
+        std::shared_ptr<Environment> &environment,
+        std::shared_ptr<Database> &database,
+        std::vector<std::shared_ptr<MDB_txn *>> ancestors):
+        ancestors(std::move(ancestors)), environment(environment), db(database), m_readonly(false)
+    {
+        txn_setup();
+    }
 
-            // attempt to create the environment in the pointer
-            auto success = mdb_env_create(db->env.get());
+    Transaction::Transaction(
+        std::shared_ptr<Environment> &environment,
+        std::shared_ptr<Database> &database,
+        WritePriority priority):
+        environment(environment), db(database), m_readonly(false), priority(priority), writer_slot(true)
+    {
+        txn_setup();
+    }
 
-            if (success != MDB_SUCCESS)
-            {
-                throw std::runtime_error("Could not create LMDB environment: " + mdb_error(success));
-            }
+    Transaction::~Transaction()
+    {
+        // default action is to abort if the Transaction leaves scope
+        abort();
+    }
 
-            // attempt to set the map size, this sets the minimum, if the environment is already bigger than
-            // this will have no effect
-            success = mdb_env_set_mapsize(*db->env, growth_factor * LMDB_SPACE_MULTIPLIER);
+    void Transaction::abort()
+    {
+        if (!txn)
+        {
+            return;
+        }
 
-            if (success != MDB_SUCCESS)
-            {
-                throw std::runtime_error("Could not allocate initial LMDB memory map: " + mdb_error(success));
-            }
+        /**
+         * If a transaction we are nested within has already completed, LMDB has already
+         * freed our handle along with it and we must not touch it again
+         */
+        if (active())
+        {
+            // clear the shared handle so that any children know that we are gone
+            auto handle = *txn;
 
-            // attempt to set the maximum number of databases that can be opened in the environment
-            success = mdb_env_set_maxdbs(*db->env, max_databases);
+            *txn = nullptr;
 
-            if (success != MDB_SUCCESS)
+            if (!readonly() && !nested())
             {
-                throw std::runtime_error("Could not set maximum number of LMDB named databases: " + mdb_error(success));
+                environment->change_reset(handle);
             }
 
-            /**
-             * A transaction and its cursors must only be used by a single thread, and a thread may only have a
-             * single write transaction at a time. If MDB_NOTLS is in use, this does not apply to read-only
-             * transactions. This call actually opens the environment.
-             */
-            success = mdb_env_open(*db->env, file.path().c_str(), flags | MDB_NOTLS, mode);
+            mdb_txn_abort(handle);
+        }
 
-            if (success != MDB_SUCCESS)
-            {
-                mdb_env_close(*db->env);
+        if (!readonly() && !nested())
+        {
+            environment->transaction_unregister();
+        }
 
-                throw std::runtime_error("Could not open LMDB database file [" + path + "]: " + mdb_error(success));
-            }
+        if (writer_slot)
+        {
+            writer_slot = false;
 
-            Environment::environments.insert(db->path, db);
+            environment->writer_release();
         }
 
-        return Environment::environments.at(file.path());
+        txn = nullptr;
     }
 
-    std::tuple<Error, size_t> Environment::max_key_size() const
+    std::shared_ptr<Transaction> Transaction::begin_nested()
     {
-        const auto result = mdb_env_get_maxkeysize(*env);
+        if (!active() || readonly())
+        {
+            throw std::runtime_error(
+                "Cannot begin a nested LMDB transaction within a readonly or completed transaction");
+        }
 
-        return {MAKE_LMDB_ERROR(SUCCESS), result};
-    }
+        auto chain = ancestors;
 
-    std::tuple<Error, size_t> Environment::max_readers() const
-    {
-        unsigned int readers = 0;
+        chain.push_back(txn);
 
-        const auto result = mdb_env_get_maxreaders(*env, &readers);
+        std::shared_ptr<Transaction> child(new Transaction(environment, db, chain));
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), readers};
+        // children record the keys they write with their parent as only the outermost commit notifies
+        child->touched = touched;
+
+        return child;
     }
 
-    std::tuple<Error, size_t> Environment::memory_to_pages(size_t memory) const
+    Error Transaction::commit()
     {
-        const auto [error, l_stats] = stats();
-
-        if (error)
+        if (!active())
         {
-            return {error, 0};
+            txn = nullptr;
+
+            return MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, mdb_error(MDB_BAD_TXN));
         }
 
-        return {MAKE_LMDB_ERROR(SUCCESS), size_t(ceil(double(memory) / double(l_stats.ms_psize)))};
-    }
+        // clear the shared handle so that any children know that we are gone
+        auto handle = *txn;
 
-    size_t Environment::open_transactions() const
-    {
-        std::scoped_lock lock(txn_mutex);
+        *txn = nullptr;
 
-        return open_txns;
-    }
+        const auto txn_id = mdb_txn_id(handle);
 
-    Error Environment::set_flags(int flags, bool flag_state)
-    {
-        std::scoped_lock lock(mutex);
+        // the change log counter is written once per transaction rather than with every record
+        auto result = (!readonly() && !nested()) ? environment->change_commit(handle) : MDB_SUCCESS;
 
-        const auto result = mdb_env_set_flags(*env, flags, (flag_state) ? 1 : 0);
+        if (result == MDB_SUCCESS)
+        {
+            result = mdb_txn_commit(handle);
+        }
+        else
+        {
+            mdb_txn_abort(handle);
+        }
 
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
-    }
+        if (!readonly() && !nested())
+        {
+            environment->transaction_unregister();
 
-    std::tuple<Error, MDB_stat> Environment::stats() const
-    {
-        MDB_stat stats;
+            if (result == MDB_SUCCESS)
+            {
+                environment->commit_notify(txn_id, touched.get());
+            }
+        }
 
-        const auto result = mdb_env_stat(*env, &stats);
+        if (writer_slot)
+        {
+            writer_slot = false;
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), stats};
-    }
+            environment->writer_release();
+        }
 
-    void Environment::transaction_register()
-    {
-        std::scoped_lock lock(txn_mutex);
+        txn = nullptr;
 
-        open_txns++;
+        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
-    void Environment::transaction_unregister()
+    std::tuple<Error, mdb_result_t> Transaction::compare_and_swap(
+        const void *key,
+        size_t key_length,
+        const void *expected,
+        size_t expected_length,
+        const void *desired,
+        size_t desired_length)
     {
-        std::scoped_lock lock(txn_mutex);
+        auto [error, current] = get(key, key_length);
 
-        if (open_txns > 0)
+        if (error && error != LMDB_NOTFOUND)
         {
-            open_txns--;
+            return {error, {}};
+        }
+
+        const auto found = !error;
+
+        const auto matches = (expected == nullptr)
+                                 ? !found
+                                 : found && current.size() == expected_length
+                                       && (expected_length == 0
+                                           || std::memcmp(current.data(), expected, expected_length) == 0);
+
+        if (!matches)
+        {
+            return {MAKE_LMDB_ERROR(LMDB_CONFLICT), std::move(current)};
         }
+
+        // a key that has expired but not yet been purged must not keep its stale expiry
+        return {write(key, key_length, desired, desired_length, 0, (found) ? LMDB_TTL_KEEP : 0), {}};
     }
 
-    std::tuple<int, int, int> Environment::version()
+    std::shared_ptr<Cursor> Transaction::cursor()
     {
-        int major, minor, patch;
-
-        mdb_version(&major, &minor, &patch);
-
-        return {major, minor, patch};
+        return std::shared_ptr<Cursor>(new Cursor(txn, db, m_readonly));
     }
 
-    Database::Database(
-        std::shared_ptr<Environment> &environment,
-        const std::string &name,
-        int flags,
-        bool enable_compression):
-        environment(environment), dbi(0), name(name), compression(enable_compression)
+    Error Transaction::del(const void *key, size_t length)
     {
-        const auto [error, env_flags] = environment->get_flags();
+        LMDB_LOAD_VALUE(key, length, i_key, false);
 
-        const auto readonly = (env_flags & MDB_RDONLY);
+        const auto indexed = !db->indexes.empty();
 
-        std::unique_ptr<Transaction> txn(new Transaction(environment, readonly));
+        auto [old_found, old_value] = (indexed) ? index_prepare(i_key) : std::make_tuple(false, mdb_result_t());
 
-        auto success = mdb_dbi_open(*txn->txn, name.empty() ? nullptr : name.c_str(), flags | MDB_CREATE, &dbi);
+        const auto result = mdb_del(*txn, db->dbi, &i_key, nullptr);
 
-        if (success != MDB_SUCCESS)
+        if (result != MDB_SUCCESS)
         {
-            throw std::runtime_error("Unable to open LMDB named database [" + name + "]: " + mdb_error(success));
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
         }
 
-        if (dbi == 0)
+        touch(i_key_temp);
+
+        if (environment->change_log_enabled())
         {
-            throw std::runtime_error("Could not open LMDB named database [" + name + "]: No DBI handle");
+            const auto error = environment->change_append(*txn, *db, CHANGE_DEL, 0, key, length, nullptr, 0);
+
+            if (error)
+            {
+                return error;
+            }
         }
 
-        if (!(env_flags & MDB_RDONLY))
+        if (indexed)
         {
-            if (txn->commit() != SUCCESS)
+            const auto error = index_update(i_key_temp, old_found, old_value, nullptr);
+
+            if (error)
             {
-                throw std::runtime_error("Could not commit to open LMDB named database: [" + name + "]");
+                return error;
             }
         }
-    }
 
-    Database::~Database()
-    {
-        mdb_dbi_close(*environment->env, dbi);
+        if (db->ttl_enabled())
+        {
+            const auto error = ttl_update(i_key_temp, 0);
 
-        dbi = 0;
+            if (error)
+            {
+                return error;
+            }
+        }
 
-        if (environment->databases.contains(name))
+        if (db->versioned())
         {
-            environment->databases.erase(name);
+            return version_update(i_key_temp, true);
         }
-    }
 
-    bool Database::compressed() const
-    {
-        return compression;
+        return MAKE_LMDB_ERROR(SUCCESS);
     }
 
-    size_t Database::count()
+    Error Transaction::del(const void *key, size_t key_length, const void *value, size_t value_length)
     {
-        auto txn = transaction(true);
+        LMDB_LOAD_VALUE(key, key_length, i_key, false);
 
-        auto cursor = txn->cursor();
+        LMDB_LOAD_VALUE(value, value_length, i_value, db->compressed());
 
-        size_t count = 0;
+        const auto indexed = !db->indexes.empty();
 
-        Error error = Error(LMDB_ERROR);
+        auto [old_found, old_value] = (indexed) ? index_prepare(i_key) : std::make_tuple(false, mdb_result_t());
 
-        do
+        const auto result = mdb_del(*txn, db->dbi, &i_key, &i_value);
+
+        if (result != MDB_SUCCESS)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        touch(i_key_temp);
+
+        if (environment->change_log_enabled())
         {
-            std::tie(error, std::ignore, std::ignore) = cursor->get(count ? MDB_NEXT : MDB_FIRST);
+            const auto error =
+                environment->change_append(*txn, *db, CHANGE_DEL, 0, key, key_length, value, value_length);
 
-            if (error == SUCCESS)
+            if (error)
             {
-                count++;
+                return error;
             }
-        } while (error == SUCCESS);
+        }
 
-        return count;
-    }
+        if (indexed)
+        {
+            const auto error = index_update(i_key_temp, old_found, old_value, nullptr);
 
-    Error Database::del(const void *key, size_t length)
-    {
-    try_again:
-        auto txn = transaction();
+            if (error)
+            {
+                return error;
+            }
+        }
 
-        auto error = txn->del(key, length);
+        // with sorted duplicates, other values may remain for the key in which case it keeps its TTL
+        if (db->ttl_enabled() || db->versioned())
+        {
+            auto i_remaining = load_val(i_key_temp);
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+            MDB_val remaining;
 
-        if (error)
-        {
-            return error;
-        }
+            const auto removed = mdb_get(*txn, db->dbi, &i_remaining, &remaining) == MDB_NOTFOUND;
 
-        error = txn->commit();
+            if (removed && db->ttl_enabled())
+            {
+                const auto error = ttl_update(i_key_temp, 0);
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+                if (error)
+                {
+                    return error;
+                }
+            }
 
-        return error;
+            if (db->versioned())
+            {
+                return version_update(i_key_temp, removed);
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
     }
 
-    Error Database::del(const void *key, size_t key_length, const void *value, size_t value_length)
+    bool Transaction::exists(const void *key, size_t length)
     {
-    try_again:
-        auto txn = transaction();
+        LMDB_LOAD_VALUE(key, length, i_key, false);
 
-        auto error = txn->del(key, key_length, value, value_length);
+        MDB_val value;
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+        const auto result = mdb_get(*txn, db->dbi, &i_key, &value);
 
-        if (error)
+        return result == MDB_SUCCESS && !expired(i_key);
+    }
+
+    bool Transaction::expired(MDB_val &i_key)
+    {
+        if (!db->ttl_enabled())
         {
-            return error;
+            return false;
         }
 
-        error = txn->commit();
+        MDB_val value;
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+        if (mdb_get(*txn, db->ttl_keys_db->dbi, &i_key, &value) != MDB_SUCCESS)
+        {
+            return false;
+        }
 
-        return error;
+        return decode_u64(value) <= now_ms();
     }
 
-    Error Database::drop(bool delete_db)
+    std::tuple<Error, std::vector<unsigned char>> Transaction::get(const void *key, size_t length)
     {
-        std::scoped_lock lock(mutex);
+        LMDB_LOAD_VALUE(key, length, i_key, false);
 
-    try_again:
-        std::unique_ptr<Transaction> txn(new Transaction(environment));
+        MDB_val value;
 
-        auto result = mdb_drop(*txn->txn, dbi, (delete_db) ? 1 : 0);
+        const auto result = mdb_get(*txn, db->dbi, &i_key, &value);
 
-        if (result == MDB_MAP_FULL)
-        {
-            txn->abort();
+        mdb_result_t r_value;
 
-            environment->expand();
+        if (result == MDB_SUCCESS)
+        {
+            if (expired(i_key))
+            {
+                return {MAKE_LMDB_ERROR_MSG(LMDB_NOTFOUND, mdb_error(MDB_NOTFOUND)), r_value};
+            }
 
-            goto try_again;
+            r_value = load_result(value);
         }
 
-        return txn->commit();
-    }
-
-    bool Database::exists(const void *key, size_t length)
-    {
-        return transaction(true)->exists(key, length);
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), r_value};
     }
 
-    std::tuple<Error, mdb_result_t> Database::get(const void *key, size_t length)
+    std::tuple<Error, mdb_pmr_result_t>
+        Transaction::get(const void *key, size_t length, std::pmr::memory_resource *resource)
     {
-        return transaction(true)->get(key, length);
-    }
+        LMDB_LOAD_VALUE(key, length, i_key, false);
 
-    std::vector<mdb_result_t> Database::get_all()
-    {
-        std::vector<mdb_result_t> results;
+        MDB_val value;
 
-        const auto keys = list_keys();
+        const auto result = mdb_get(*txn, db->dbi, &i_key, &value);
 
-        auto txn = transaction(true);
+        mdb_pmr_result_t r_value(resource);
 
-        for (const auto &key : keys)
+        if (result == MDB_SUCCESS)
         {
-            const auto [error, value] = txn->get(key.data(), key.size());
-
-            if (!error)
+            if (expired(i_key))
             {
-                results.emplace_back(value);
+                return {MAKE_LMDB_ERROR_MSG(LMDB_NOTFOUND, mdb_error(MDB_NOTFOUND)), std::move(r_value)};
             }
+
+            r_value = load_result(value, resource);
         }
 
-        return results;
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), std::move(r_value)};
     }
 
-    std::tuple<Error, unsigned int> Database::get_flags()
+    std::tuple<bool, mdb_result_t> Transaction::index_prepare(MDB_val &i_key)
     {
-        auto txn = transaction(true);
-
-        unsigned int dbi_flags;
+        MDB_val value;
 
-        const auto result = mdb_dbi_flags(*txn->txn, dbi, &dbi_flags);
+        if (mdb_get(*txn, db->dbi, &i_key, &value) != MDB_SUCCESS)
+        {
+            return {false, {}};
+        }
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), dbi_flags};
+        return {true, load_result(value)};
     }
 
-    std::vector<mdb_result_t> Database::list_keys(bool ignore_duplicates)
+    Error Transaction::index_update(
+        const mdb_result_t &key,
+        bool old_found,
+        const mdb_result_t &old_value,
+        const mdb_result_t *new_value)
     {
-        auto txn = transaction(true);
-
-        auto cursor = txn->cursor();
-
-        std::vector<mdb_result_t> results;
-
-        size_t count = 0;
+        Error error;
 
-        mdb_result_t last_key;
-
-        Error error = Error(LMDB_ERROR);
-
-        do
-        {
-            mdb_result_t key;
-
-            std::tie(error, key, std::ignore) = cursor->get(count ? MDB_NEXT : MDB_FIRST);
-
-            if (error == SUCCESS)
+        db->indexes.each(
+            [&](const std::string &, const std::shared_ptr<Index> &idx)
             {
-                if (ignore_duplicates && key == last_key)
+                if (error)
                 {
-                    continue;
+                    return;
                 }
 
-                results.emplace_back(key);
-
-                last_key = key;
+                if (old_found)
+                {
+                    error = idx->remove(*txn, key, old_value);
+                }
 
-                count++;
-            }
-        } while (error == SUCCESS);
+                if (!error && new_value)
+                {
+                    error = idx->insert(*txn, key, *new_value);
+                }
+            });
 
-        return results;
+        return error;
     }
 
-    Error Database::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
+    std::tuple<Error, size_t> Transaction::id() const
     {
-    try_again:
-        auto txn = transaction();
+        if (!active())
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, mdb_error(MDB_BAD_TXN)), 0};
+        }
 
-        auto error = txn->put(key, key_length, value, value_length, flags);
+        const auto result = mdb_txn_id(*txn);
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+        return {MAKE_LMDB_ERROR(SUCCESS), result};
+    }
 
-        if (error)
+    Error Transaction::merge(
+        const void *key,
+        size_t key_length,
+        const void *operand,
+        size_t operand_length,
+        const merge_operator_t &merge_operator)
+    {
+        const auto [error, existing] = get(key, key_length);
+
+        if (error && error != LMDB_NOTFOUND)
         {
             return error;
         }
 
-        error = txn->commit();
+        mdb_result_t value;
 
-        LMDB_CHECK_TXN_EXPAND(error, environment, txn, try_again)
+        // the operator rejects a malformed value or operand, which leaves the key untouched
+        try
+        {
+            value = merge_operator((!error) ? &existing : nullptr, load_value(operand, operand_length, false));
+        }
+        catch (const std::invalid_argument &e)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_BAD_VALSIZE, e.what());
+        }
 
-        return error;
+        return write(key, key_length, value.data(), value.size(), 0, (!error) ? LMDB_TTL_KEEP : 0);
     }
 
-    std::shared_ptr<Transaction> Database::transaction(bool readonly)
+    Error Transaction::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
     {
-        std::scoped_lock lock(mutex);
-
-        /**
-         * We fetch the database instance this way to make sure that we do not
-         * have a bunch of extra instances running around
-         */
-        auto db = environment->database(name);
-
-        return std::shared_ptr<Transaction>(new Transaction(environment, db, readonly));
+        return write(key, key_length, value, value_length, flags, 0);
     }
 
-    Transaction::Transaction(std::shared_ptr<Environment> &environment, bool readonly):
-        environment(environment), m_readonly(readonly)
+    Error Transaction::put(
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length,
+        std::chrono::milliseconds ttl,
+        int flags)
     {
-        txn_setup();
-    }
+        if (!db->ttl_enabled())
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "TTL support is not enabled for the database");
+        }
 
-    Transaction::Transaction(
-        std::shared_ptr<Environment> &environment,
-        std::shared_ptr<Database> &database,
-        bool readonly):
-        environment(environment), db(database), m_readonly(readonly)
-    {
-        txn_setup();
+        return write(key, key_length, value, value_length, flags, now_ms() + std::max<int64_t>(ttl.count(), 0));
     }
 
-    Transaction::~Transaction()
+    std::tuple<Error, mdb_result_t>
+        Transaction::put_if_absent(const void *key, size_t key_length, const void *value, size_t value_length)
     {
-        // default action is to abort if the Transaction leaves scope
-        abort();
+        mdb_result_t existing;
+
+        const auto error = write(key, key_length, value, value_length, MDB_NOOVERWRITE, 0, &existing);
+
+        if (error == LMDB_KEYEXIST)
+        {
+            LMDB_LOAD_VALUE(key, key_length, i_key, false);
+
+            // the key has expired but has not been purged yet, so it is treated as absent
+            if (expired(i_key))
+            {
+                return {write(key, key_length, value, value_length, 0, 0), {}};
+            }
+
+            return {error, std::move(existing)};
+        }
+
+        return {error, {}};
     }
 
-    void Transaction::abort()
+    std::tuple<Error, uint64_t, mdb_result_t> Transaction::put_if_version(
+        const void *key,
+        size_t key_length,
+        uint64_t expected_version,
+        const void *value,
+        size_t value_length)
     {
-        if (!txn)
+        const auto [error, current] = version(key, key_length);
+
+        if (error)
         {
-            return;
+            return {error, 0, {}};
+        }
+
+        if (current != expected_version)
+        {
+            auto [get_error, existing] = get(key, key_length);
+
+            return {MAKE_LMDB_ERROR(LMDB_CONFLICT), current, std::move(existing)};
         }
 
-        mdb_txn_abort(*txn);
+        const auto write_error = write(key, key_length, value, value_length, 0, (current) ? LMDB_TTL_KEEP : 0);
 
-        if (!readonly())
+        if (write_error)
         {
-            environment->transaction_unregister();
+            return {write_error, 0, {}};
         }
 
-        txn = nullptr;
+        return {write_error, mdb_txn_id(*txn), {}};
     }
 
-    Error Transaction::commit()
+    bool Transaction::active() const
     {
-        if (!txn)
+        if (!txn || *txn == nullptr)
         {
-            return MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, mdb_error(MDB_BAD_TXN));
+            return false;
         }
 
-        const auto result = mdb_txn_commit(*txn);
-
-        if (!readonly())
+        for (const auto &ancestor : ancestors)
         {
-            environment->transaction_unregister();
+            if (*ancestor == nullptr)
+            {
+                return false;
+            }
         }
 
-        txn = nullptr;
-
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        return true;
     }
 
-    std::shared_ptr<Cursor> Transaction::cursor()
+    bool Transaction::nested() const
     {
-        return std::shared_ptr<Cursor>(new Cursor(txn, db, m_readonly));
+        return !ancestors.empty();
     }
 
-    Error Transaction::del(const void *key, size_t length)
+    bool Transaction::readonly() const
     {
-        LMDB_LOAD_VALUE(key, length, i_key, false);
-
-        const auto result = mdb_del(*txn, db->dbi, &i_key, nullptr);
-
-        return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        return m_readonly;
     }
 
-    Error Transaction::del(const void *key, size_t key_length, const void *value, size_t value_length)
+    bool Transaction::should_yield() const
     {
-        LMDB_LOAD_VALUE(key, key_length, i_key, false);
+        return writer_slot && environment->writer_contended(priority);
+    }
 
-        LMDB_LOAD_VALUE(value, value_length, i_value, db->compressed());
+    Error Transaction::renew()
+    {
+        if (!txn || !m_readonly)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, "Transaction does not exist or is not readonly");
+        }
 
-        const auto result = mdb_del(*txn, db->dbi, &i_key, &i_value);
+        const auto result = mdb_txn_renew(*txn);
 
         return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
-    bool Transaction::exists(const void *key, size_t length)
+    void Transaction::reset()
     {
-        LMDB_LOAD_VALUE(key, length, i_key, false);
-
-        MDB_val value;
-
-        const auto result = mdb_get(*txn, db->dbi, &i_key, &value);
+        if (!txn || !m_readonly)
+        {
+            throw std::runtime_error("Transaction does not exist or is not readonly");
+        }
 
-        return result == MDB_SUCCESS;
+        return mdb_txn_reset(*txn);
     }
 
-    std::tuple<Error, std::vector<unsigned char>> Transaction::get(const void *key, size_t length)
+    Error Transaction::ttl_update(const mdb_result_t &key, uint64_t expires)
     {
-        LMDB_LOAD_VALUE(key, length, i_key, false);
+        if (expires == LMDB_TTL_KEEP)
+        {
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
 
-        MDB_val value;
+        auto i_key = load_val(key);
 
-        const auto result = mdb_get(*txn, db->dbi, &i_key, &value);
+        MDB_val i_value;
 
-        mdb_result_t r_value;
+        auto result = mdb_get(*txn, db->ttl_keys_db->dbi, &i_key, &i_value);
 
+        // remove the previous expiry from the TTL index
         if (result == MDB_SUCCESS)
         {
-            r_value = load_result(value);
-        }
+            const auto previous = encode_u64(decode_u64(i_value));
 
-        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), r_value};
-    }
+            auto i_previous = load_val(previous);
 
-    std::tuple<Error, size_t> Transaction::id() const
-    {
-        if (!txn)
+            result = mdb_del(*txn, db->ttl_db->dbi, &i_previous, &i_key);
+
+            if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
+
+            if (expires == 0)
+            {
+                result = mdb_del(*txn, db->ttl_keys_db->dbi, &i_key, nullptr);
+
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
+        }
+
+        if (expires == 0)
         {
-            return {MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, mdb_error(MDB_BAD_TXN)), 0};
+            return MAKE_LMDB_ERROR(SUCCESS);
         }
 
-        const auto result = mdb_txn_id(*txn);
+        const auto encoded = encode_u64(expires);
 
-        return {MAKE_LMDB_ERROR(SUCCESS), result};
-    }
+        auto i_expires = load_val(encoded);
 
-    Error Transaction::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
-    {
-        LMDB_LOAD_VALUE(key, key_length, i_key, false);
+        result = mdb_put(*txn, db->ttl_keys_db->dbi, &i_key, &i_expires, 0);
 
-        LMDB_LOAD_VALUE(value, value_length, i_value, db->compressed());
+        if (result != MDB_SUCCESS)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
 
-        const auto result = mdb_put(*txn, db->dbi, &i_key, &i_value, flags);
+        result = mdb_put(*txn, db->ttl_db->dbi, &i_expires, &i_key, MDB_NODUPDATA);
+
+        if (result == MDB_KEYEXIST)
+        {
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
 
         return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
-    bool Transaction::readonly() const
+    Error Transaction::version_update(const mdb_result_t &key, bool removed)
     {
-        return m_readonly;
-    }
+        auto i_key = load_val(key);
 
-    Error Transaction::renew()
-    {
-        if (!txn || !m_readonly)
+        if (removed)
         {
-            return MAKE_LMDB_ERROR_MSG(LMDB_BAD_TXN, "Transaction does not exist or is not readonly");
+            const auto result = mdb_del(*txn, db->versions_db->dbi, &i_key, nullptr);
+
+            if (result == MDB_NOTFOUND)
+            {
+                return MAKE_LMDB_ERROR(SUCCESS);
+            }
+
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
         }
 
-        const auto result = mdb_txn_renew(*txn);
+        // nested transactions share the ID of their parent so the version is stable once committed
+        const auto encoded = encode_u64(mdb_txn_id(*txn));
+
+        auto i_version = load_val(encoded);
+
+        const auto result = mdb_put(*txn, db->versions_db->dbi, &i_key, &i_version, 0);
 
         return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
-    void Transaction::reset()
+    std::tuple<Error, uint64_t> Transaction::version(const void *key, size_t length)
     {
-        if (!txn || !m_readonly)
+        if (!db->versioned())
         {
-            throw std::runtime_error("Transaction does not exist or is not readonly");
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Versioning is not enabled for the database"), 0};
         }
 
-        return mdb_txn_reset(*txn);
+        LMDB_LOAD_VALUE(key, length, i_key, false);
+
+        MDB_val value;
+
+        // the key itself decides whether it exists, as not every write leaves a version behind
+        auto result = mdb_get(*txn, db->dbi, &i_key, &value);
+
+        // keys that have expired (TTL) but have not yet been purged do not exist
+        if (result == MDB_NOTFOUND || (result == MDB_SUCCESS && expired(i_key)))
+        {
+            return {MAKE_LMDB_ERROR(SUCCESS), 0};
+        }
+
+        if (result == MDB_SUCCESS)
+        {
+            result = mdb_get(*txn, db->versions_db->dbi, &i_key, &value);
+        }
+
+        // written before versioning was enabled, by another process, or via a cursor
+        if (result == MDB_NOTFOUND)
+        {
+            return {MAKE_LMDB_ERROR(SUCCESS), LMDB_VERSION_UNSTAMPED};
+        }
+
+        if (result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), 0};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), decode_u64(value)};
     }
 
     void Transaction::txn_setup()
     {
         MDB_txn *result;
 
+        MDB_txn *parent = (nested()) ? *ancestors.back() : nullptr;
+
+        // root R/W transactions queue for the writer slot before they queue for the LMDB write lock
+        if (!readonly() && !nested() && !writer_slot)
+        {
+            environment->writer_acquire(priority, std::chrono::milliseconds::max());
+
+            writer_slot = true;
+        }
+
         for (int i = 0; i < 3; ++i)
         {
-            const auto mdb_result = mdb_txn_begin(*environment->env, nullptr, (m_readonly) ? MDB_RDONLY : 0, &result);
+            const auto mdb_result = mdb_txn_begin(*environment->env, parent, (m_readonly) ? MDB_RDONLY : 0, &result);
 
             if (mdb_result == MDB_SUCCESS)
             {
                 break;
             }
 
-            if (mdb_result == MDB_MAP_RESIZED && i < 2)
+            if (mdb_result == MDB_MAP_RESIZED && i < 2 && !parent)
             {
                 environment->detect_map_size();
 
                 continue;
             }
 
+            if (writer_slot)
+            {
+                writer_slot = false;
+
+                environment->writer_release();
+            }
+
             throw std::runtime_error("Unable to start LMDB transaction: " + mdb_error(mdb_result));
         }
 
         txn = std::make_unique<MDB_txn *>(result);
 
-        if (!readonly())
+        // nested transactions live within their parent's registration
+        if (!readonly() && !nested())
         {
             environment->transaction_register();
+
+            if (environment->watching())
+            {
+                touched = std::make_shared<std::vector<std::tuple<MDB_dbi, mdb_result_t>>>();
+            }
+        }
+    }
+
+    void Transaction::touch(const mdb_result_t &key)
+    {
+        if (touched)
+        {
+            touched->emplace_back(db->dbi, key);
+        }
+    }
+
+    void Transaction::use(std::shared_ptr<Database> &database)
+    {
+        db = database;
+    }
+
+    Error Transaction::write(
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length,
+        int flags,
+        uint64_t expires,
+        mdb_result_t *existing)
+    {
+        LMDB_LOAD_VALUE(key, key_length, i_key, false);
+
+        LMDB_LOAD_VALUE(value, value_length, i_value, db->compressed());
+
+        const auto indexed = !db->indexes.empty();
+
+        auto [old_found, old_value] = (indexed) ? index_prepare(i_key) : std::make_tuple(false, mdb_result_t());
+
+        const auto result = mdb_put(*txn, db->dbi, &i_key, &i_value, flags);
+
+        if (result != MDB_SUCCESS)
+        {
+            // with MDB_NOOVERWRITE, LMDB returns the existing value in place of the new value
+            if (result == MDB_KEYEXIST && existing)
+            {
+                *existing = load_result(i_value);
+            }
+
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        touch(i_key_temp);
+
+        if (environment->change_log_enabled())
+        {
+            const auto error =
+                environment->change_append(*txn, *db, CHANGE_PUT, flags, key, key_length, value, value_length);
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        if (indexed)
+        {
+            const auto new_value = load_value(value, value_length, false);
+
+            const auto error = index_update(i_key_temp, old_found, old_value, &new_value);
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        if (db->ttl_enabled())
+        {
+            const auto error = ttl_update(i_key_temp, expires);
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        if (db->versioned())
+        {
+            return version_update(i_key_temp, false);
         }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
     }
 
     Cursor::Cursor(std::shared_ptr<MDB_txn *> &txn, std::shared_ptr<Database> &db, bool readonly):
@@ -929,8 +4105,35 @@ namespace LMDB
             return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Cursor does not exist or is readonly");
         }
 
+        const auto change_log = db->environment->change_log_enabled();
+
+        MDB_val i_key, i_value;
+
+        // we need to know what we are deleting before it is gone to record it in the change log
+        if (change_log)
+        {
+            const auto result = mdb_cursor_get(cursor, &i_key, &i_value, MDB_GET_CURRENT);
+
+            if (result != MDB_SUCCESS)
+            {
+                return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+            }
+        }
+
+        const auto r_key = (change_log) ? load_value(i_key.mv_data, i_key.mv_size, false) : mdb_result_t();
+
+        // MDB_NODUPDATA deletes all of the duplicates for the key, otherwise only the current value is deleted
+        const auto r_value =
+            (change_log && !(flags & MDB_NODUPDATA)) ? load_result(i_value) : mdb_result_t();
+
         const auto result = mdb_cursor_del(cursor, flags);
 
+        if (result == MDB_SUCCESS && change_log)
+        {
+            return db->environment->change_append(
+                mdb_cursor_txn(cursor), *db, CHANGE_DEL, 0, r_key.data(), r_key.size(), r_value.data(), r_value.size());
+        }
+
         return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
@@ -959,6 +4162,32 @@ namespace LMDB
         return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), r_key, r_value};
     }
 
+    std::tuple<Error, mdb_pmr_result_t, mdb_pmr_result_t>
+        Cursor::get(const MDB_cursor_op &op, std::pmr::memory_resource *resource)
+    {
+        mdb_pmr_result_t r_key(resource);
+
+        mdb_pmr_result_t r_value(resource);
+
+        if (cursor == nullptr)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Cursor does not exist"), std::move(r_key), std::move(r_value)};
+        }
+
+        MDB_val i_key, i_value;
+
+        const auto result = mdb_cursor_get(cursor, &i_key, &i_value, op);
+
+        if (result == MDB_SUCCESS)
+        {
+            r_key = load_result(i_key, resource);
+
+            r_value = load_result(i_value, resource);
+        }
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), std::move(r_key), std::move(r_value)};
+    }
+
     std::tuple<Error, mdb_result_t, mdb_result_t> Cursor::get(const void *key, size_t length, const MDB_cursor_op &op)
     {
         mdb_result_t r_key;
@@ -986,6 +4215,37 @@ namespace LMDB
         return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), r_key, r_value};
     }
 
+    std::tuple<Error, mdb_pmr_result_t, mdb_pmr_result_t> Cursor::get(
+        const void *key,
+        size_t length,
+        const MDB_cursor_op &op,
+        std::pmr::memory_resource *resource)
+    {
+        mdb_pmr_result_t r_key(resource);
+
+        mdb_pmr_result_t r_value(resource);
+
+        if (cursor == nullptr)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Cursor does not exist"), std::move(r_key), std::move(r_value)};
+        }
+
+        LMDB_LOAD_VALUE(key, length, i_key, false);
+
+        MDB_val i_value;
+
+        const auto result = mdb_cursor_get(cursor, &i_key, &i_value, op);
+
+        if (result == MDB_SUCCESS)
+        {
+            r_key = load_result(i_key, resource);
+
+            r_value = load_result(i_value, resource);
+        }
+
+        return {MAKE_LMDB_ERROR_MSG(result, mdb_error(result)), std::move(r_key), std::move(r_value)};
+    }
+
     std::tuple<Error, mdb_result_t, std::vector<mdb_result_t>> Cursor::get_all(const void *key, size_t length)
     {
         mdb_result_t l_key;
@@ -1000,11 +4260,11 @@ namespace LMDB
 
             if (!error)
             {
-                results.emplace_back(r_value);
+                results.emplace_back(std::move(r_value));
 
                 if (l_key.empty())
                 {
-                    l_key = r_key;
+                    l_key = std::move(r_key);
                 }
             }
 
@@ -1016,6 +4276,32 @@ namespace LMDB
         return {error, l_key, results};
     }
 
+    Error Cursor::get_all(const void *key, size_t length, ResultSet &results)
+    {
+        results.clear();
+
+        if (cursor == nullptr)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Cursor does not exist");
+        }
+
+        MDB_val i_key = {length, const_cast<void *>(key)}, value;
+
+        auto result = mdb_cursor_get(cursor, &i_key, &value, MDB_SET);
+
+        for (; result == MDB_SUCCESS; result = mdb_cursor_get(cursor, &i_key, &value, MDB_NEXT_DUP))
+        {
+            results.append(nullptr, &value);
+        }
+
+        if (result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
+        }
+
+        return MAKE_LMDB_ERROR((!results.empty()) ? SUCCESS : LMDB_EMPTY);
+    }
+
     Error Cursor::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
     {
         if (cursor == nullptr || m_readonly)
@@ -1029,6 +4315,12 @@ namespace LMDB
 
         const auto result = mdb_cursor_put(cursor, &i_key, &i_value, flags);
 
+        if (result == MDB_SUCCESS && db->environment->change_log_enabled())
+        {
+            return db->environment->change_append(
+                mdb_cursor_txn(cursor), *db, CHANGE_PUT, flags, key, key_length, value, value_length);
+        }
+
         return MAKE_LMDB_ERROR_MSG(result, mdb_error(result));
     }
 
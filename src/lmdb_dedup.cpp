@@ -0,0 +1,529 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_dedup.hpp"
+#include "lmdb_internal.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_DEDUP_INLINE 0x00
+#define LMDB_DEDUP_REFERENCE 0x01
+#define LMDB_CONTENT_KEY_SIZE 14 // [hash (4)] [length (8)] [collision chain (2)]
+
+namespace LMDB
+{
+    // the key in the content database that holds the statistics (content keys are always longer)
+    static const mdb_result_t stats_key = {'s', 't', 'a', 't', 's'};
+
+    /**
+     * Builds the key of a content, which embeds its length so that the key alone describes it
+     *
+     * @param hash
+     * @param length
+     * @param chain
+     * @return
+     */
+    static inline mdb_result_t content_key(uint32_t hash, uint64_t length, uint16_t chain)
+    {
+        mdb_result_t result;
+
+        result.reserve(LMDB_CONTENT_KEY_SIZE);
+
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            result.push_back(static_cast<unsigned char>(hash >> shift));
+        }
+
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            result.push_back(static_cast<unsigned char>(length >> shift));
+        }
+
+        result.push_back(static_cast<unsigned char>(chain >> 8));
+
+        result.push_back(static_cast<unsigned char>(chain));
+
+        return result;
+    }
+
+    /**
+     * Retrieves the length of the content from its key
+     *
+     * @param key
+     * @return
+     */
+    static inline uint64_t content_length(const mdb_result_t &key)
+    {
+        uint64_t length = 0;
+
+        for (size_t i = 4; i < 12; ++i)
+        {
+            length = (length << 8) | key[i];
+        }
+
+        return length;
+    }
+
+    /**
+     * The key of the reference count of a content
+     *
+     * @param key
+     * @return
+     */
+    static inline mdb_result_t refcount_key(const mdb_result_t &key)
+    {
+        auto result = key;
+
+        result.push_back(0x00);
+
+        return result;
+    }
+
+    /**
+     * Encodes the values as consecutive little-endian 64-bit integers
+     *
+     * @param values
+     * @return
+     */
+    static inline mdb_result_t encode_u64s(std::initializer_list<uint64_t> values)
+    {
+        mdb_result_t result;
+
+        for (const auto &value : values)
+        {
+            for (size_t i = 0; i < sizeof(uint64_t); ++i)
+            {
+                result.push_back(static_cast<unsigned char>(value >> (8 * i)));
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Decodes the index-th little-endian 64-bit integer of the value (0 if it is too short)
+     *
+     * @param value
+     * @param index
+     * @return
+     */
+    static inline uint64_t decode_u64(const MDB_val &value, size_t index)
+    {
+        uint64_t result = 0;
+
+        if (value.mv_size < (index + 1) * sizeof(uint64_t))
+        {
+            return 0;
+        }
+
+        const auto data = static_cast<const unsigned char *>(value.mv_data) + index * sizeof(uint64_t);
+
+        for (size_t i = 0; i < sizeof(uint64_t); ++i)
+        {
+            result |= static_cast<uint64_t>(data[i]) << (8 * i);
+        }
+
+        return result;
+    }
+
+    /**
+     * Reads a value directly from the transaction
+     *
+     * Values are read without going through Transaction::get() so that they are never mistaken for
+     * snappy compressed data (and the content is not copied until we need it).
+     *
+     * @param txn
+     * @param dbi
+     * @param key
+     * @param length
+     * @return [result, value]
+     */
+    static inline std::tuple<int, MDB_val> raw_get(MDB_txn *txn, MDB_dbi dbi, const void *key, size_t length)
+    {
+        MDB_val i_key = {length, const_cast<void *>(key)}, value = {0, nullptr};
+
+        const auto result = mdb_get(txn, dbi, &i_key, &value);
+
+        return {result, value};
+    }
+
+    DedupDatabase::DedupDatabase(std::shared_ptr<Database> db, size_t threshold):
+        db(std::move(db)), threshold(threshold)
+    {
+        // the stored records are read back raw, so they must not be compressed on the way in
+        if (this->db->compressed())
+        {
+            throw std::invalid_argument("A deduplicated database cannot use a database with compression enabled");
+        }
+
+        content_db = this->db->environment->database(this->db->name + ":content");
+
+        if (content_db->compressed())
+        {
+            throw std::invalid_argument("The content database of a deduplicated database cannot use compression");
+        }
+    }
+
+    std::tuple<Error, mdb_result_t>
+        DedupDatabase::acquire(Transaction &txn, const unsigned char *value, size_t length)
+    {
+        const auto hash = crc32c(value, length);
+
+        for (uint32_t chain = 0; chain <= UINT16_MAX; ++chain)
+        {
+            const auto key = content_key(hash, length, static_cast<uint16_t>(chain));
+
+            const auto [result, existing] = raw_get(*txn.txn, content_db->dbi, key.data(), key.size());
+
+            if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+            {
+                return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), {}};
+            }
+
+            const auto found = result == MDB_SUCCESS;
+
+            // a different value with the same hash and length, so try the next key in the chain
+            if (found
+                && (existing.mv_size != length || (length != 0 && std::memcmp(existing.mv_data, value, length) != 0)))
+            {
+                continue;
+            }
+
+            const auto count_key = refcount_key(key);
+
+            const auto [count_result, count] = raw_get(*txn.txn, content_db->dbi, count_key.data(), count_key.size());
+
+            const auto references = (found && count_result == MDB_SUCCESS) ? decode_u64(count, 0) : 0;
+
+            txn.use(content_db);
+
+            Error error;
+
+            if (!found)
+            {
+                error = txn.put(key.data(), key.size(), value, length);
+            }
+
+            if (!error)
+            {
+                error = txn.put(count_key, encode_u64s({references + 1}));
+            }
+
+            txn.use(db);
+
+            if (!error)
+            {
+                error = account(txn, (found) ? 0 : 1, length, (found) ? 0 : length);
+            }
+
+            return {error, key};
+        }
+
+        return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Too many distinct values share the same hash"), {}};
+    }
+
+    Error DedupDatabase::account(Transaction &txn, int64_t contents, int64_t logical_bytes, int64_t stored_bytes)
+    {
+        const auto [result, value] = raw_get(*txn.txn, content_db->dbi, stats_key.data(), stats_key.size());
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        const auto encoded = encode_u64s({
+            decode_u64(value, 0) + contents,
+            decode_u64(value, 1) + logical_bytes,
+            decode_u64(value, 2) + stored_bytes,
+        });
+
+        txn.use(content_db);
+
+        const auto error = txn.put(stats_key, encoded);
+
+        txn.use(db);
+
+        return error;
+    }
+
+    Error DedupDatabase::del(const void *key, size_t length)
+    {
+    try_again:
+        auto txn = db->transaction();
+
+        auto error = del(*txn, key, length);
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    Error DedupDatabase::del(Transaction &txn, const void *key, size_t length)
+    {
+        const auto [result, previous] = raw_get(*txn.txn, db->dbi, key, length);
+
+        if (result != MDB_SUCCESS)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        const auto data = static_cast<const unsigned char *>(previous.mv_data);
+
+        mdb_result_t reference;
+
+        // copy the reference before the delete invalidates the memory that it points to
+        if (previous.mv_size == 1 + LMDB_CONTENT_KEY_SIZE && data[0] == LMDB_DEDUP_REFERENCE)
+        {
+            reference = mdb_result_t(data + 1, data + previous.mv_size);
+        }
+
+        auto error = txn.del(key, length);
+
+        if (!error && !reference.empty())
+        {
+            error = release(txn, reference);
+        }
+
+        return error;
+    }
+
+    bool DedupDatabase::exists(const void *key, size_t length)
+    {
+        return db->exists(key, length);
+    }
+
+    std::tuple<Error, mdb_result_t> DedupDatabase::get(const void *key, size_t length)
+    {
+        auto txn = db->transaction(true);
+
+        return get(*txn, key, length);
+    }
+
+    std::tuple<Error, mdb_result_t> DedupDatabase::get(Transaction &txn, const void *key, size_t length)
+    {
+        const auto [result, stored] = raw_get(*txn.txn, db->dbi, key, length);
+
+        if (result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), {}};
+        }
+
+        const auto data = static_cast<const unsigned char *>(stored.mv_data);
+
+        if (stored.mv_size != 0 && data[0] == LMDB_DEDUP_INLINE)
+        {
+            return {MAKE_LMDB_ERROR(SUCCESS), mdb_result_t(data + 1, data + stored.mv_size)};
+        }
+
+        if (stored.mv_size != 1 + LMDB_CONTENT_KEY_SIZE || data[0] != LMDB_DEDUP_REFERENCE)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The stored value is not a deduplicated value"), {}};
+        }
+
+        const auto [content_result, content] = raw_get(*txn.txn, content_db->dbi, data + 1, LMDB_CONTENT_KEY_SIZE);
+
+        if (content_result != MDB_SUCCESS)
+        {
+            return {MAKE_LMDB_ERROR_MSG(content_result, mdb_strerror(content_result)), {}};
+        }
+
+        const auto content_data = static_cast<const unsigned char *>(content.mv_data);
+
+        return {MAKE_LMDB_ERROR(SUCCESS), mdb_result_t(content_data, content_data + content.mv_size)};
+    }
+
+    Error DedupDatabase::put(const void *key, size_t key_length, const void *value, size_t value_length)
+    {
+    try_again:
+        auto txn = db->transaction();
+
+        auto error = put(*txn, key, key_length, value, value_length);
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    Error DedupDatabase::put(
+        Transaction &txn,
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length)
+    {
+        const auto [result, previous] = raw_get(*txn.txn, db->dbi, key, key_length);
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        const auto previous_data = static_cast<const unsigned char *>(previous.mv_data);
+
+        mdb_result_t reference;
+
+        // copy the reference before the put invalidates the memory that it points to
+        if (result == MDB_SUCCESS && previous.mv_size == 1 + LMDB_CONTENT_KEY_SIZE
+            && previous_data[0] == LMDB_DEDUP_REFERENCE)
+        {
+            reference = mdb_result_t(previous_data + 1, previous_data + previous.mv_size);
+        }
+
+        const auto value_bytes = static_cast<const unsigned char *>(value);
+
+        mdb_result_t stored;
+
+        if (value_length >= threshold)
+        {
+            // acquire before releasing the previous reference so that rewriting the same value keeps its content
+            const auto [error, content] = acquire(txn, value_bytes, value_length);
+
+            if (error)
+            {
+                return error;
+            }
+
+            stored.reserve(1 + content.size());
+
+            stored.push_back(LMDB_DEDUP_REFERENCE);
+
+            stored.insert(stored.end(), content.begin(), content.end());
+        }
+        else
+        {
+            stored.reserve(1 + value_length);
+
+            stored.push_back(LMDB_DEDUP_INLINE);
+
+            stored.insert(stored.end(), value_bytes, value_bytes + value_length);
+        }
+
+        auto error = txn.put(key, key_length, stored.data(), stored.size());
+
+        if (!error && !reference.empty())
+        {
+            error = release(txn, reference);
+        }
+
+        return error;
+    }
+
+    Error DedupDatabase::release(Transaction &txn, const mdb_result_t &content_key)
+    {
+        const auto count_key = refcount_key(content_key);
+
+        const auto [result, count] = raw_get(*txn.txn, content_db->dbi, count_key.data(), count_key.size());
+
+        if (result != MDB_SUCCESS)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        const auto references = decode_u64(count, 0);
+
+        const auto length = static_cast<int64_t>(content_length(content_key));
+
+        txn.use(content_db);
+
+        Error error;
+
+        if (references <= 1)
+        {
+            error = txn.del(content_key);
+
+            if (!error)
+            {
+                error = txn.del(count_key);
+            }
+        }
+        else
+        {
+            error = txn.put(count_key, encode_u64s({references - 1}));
+        }
+
+        txn.use(db);
+
+        if (!error)
+        {
+            error = account(txn, (references <= 1) ? -1 : 0, -length, (references <= 1) ? -length : 0);
+        }
+
+        return error;
+    }
+
+    std::tuple<Error, DedupStats> DedupDatabase::stats()
+    {
+        DedupStats stats;
+
+        auto txn = content_db->transaction(true);
+
+        const auto [result, value] = raw_get(*txn->txn, content_db->dbi, stats_key.data(), stats_key.size());
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), stats};
+        }
+
+        stats.contents = decode_u64(value, 0);
+
+        stats.logical_bytes = decode_u64(value, 1);
+
+        stats.stored_bytes = decode_u64(value, 2);
+
+        stats.saved_bytes = stats.logical_bytes - stats.stored_bytes;
+
+        return {MAKE_LMDB_ERROR(SUCCESS), stats};
+    }
+} // namespace LMDB
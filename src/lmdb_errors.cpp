@@ -120,6 +120,11 @@ namespace LMDB
                        "issue persists in the database.";
             case LMDB_ENV_NOT_OPEN:
                 return "The LMDB environment has been previously closed or never opened.";
+            case LMDB_TIMEOUT:
+                return "The operation did not complete before the deadline specified.";
+            case LMDB_CONFLICT:
+                return "The write was not applied as the current value or version of a key did not match "
+                       "the expected value or version.";
             default:
                 return "The error code supplied does not have a default message. Please create one.";
         }
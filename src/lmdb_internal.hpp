@@ -0,0 +1,206 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef LMDB_INTERNAL_HPP
+#define LMDB_INTERNAL_HPP
+
+/**
+ * Helpers shared by the translation units of the library for encoding and checksumming the records
+ * that it stores and for syncing its own files. This header is not installed and is not part of the public API.
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#define LMDB_FSYNC(file) _commit(_fileno(file))
+#else
+#include <unistd.h>
+#define LMDB_FSYNC(file) fsync(fileno(file))
+#endif
+
+namespace LMDB
+{
+    /**
+     * Computes the CRC32C (Castagnoli) checksum of the data, using the hardware CRC instructions
+     * if the target supports them
+     *
+     * The checksum of data split across buffers is computed by passing the checksum of the preceding
+     * bytes as the seed
+     *
+     * @param data
+     * @param length
+     * @param seed
+     * @return
+     */
+    inline uint32_t crc32c(const unsigned char *data, size_t length, uint32_t seed = 0)
+    {
+        uint32_t crc = ~seed;
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+        uint64_t crc64 = crc;
+
+        for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t), data += sizeof(uint64_t))
+        {
+            uint64_t word;
+
+            std::memcpy(&word, data, sizeof(word));
+
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+
+        crc = static_cast<uint32_t>(crc64);
+
+        for (; length != 0; --length)
+        {
+            crc = _mm_crc32_u8(crc, *data++);
+        }
+#elif defined(__ARM_FEATURE_CRC32)
+        for (; length >= sizeof(uint64_t); length -= sizeof(uint64_t), data += sizeof(uint64_t))
+        {
+            uint64_t word;
+
+            std::memcpy(&word, data, sizeof(word));
+
+            crc = __crc32cd(crc, word);
+        }
+
+        for (; length != 0; --length)
+        {
+            crc = __crc32cb(crc, *data++);
+        }
+#else
+        static const auto table = []
+        {
+            std::array<uint32_t, 256> result = {};
+
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t value = i;
+
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    value = (value & 1) ? (value >> 1) ^ 0x82F63B78 : value >> 1;
+                }
+
+                result[i] = value;
+            }
+
+            return result;
+        }();
+
+        for (; length != 0; --length)
+        {
+            crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        }
+#endif
+
+        return ~crc;
+    }
+
+    /**
+     * Appends an unsigned integer to the buffer (a string or vector of bytes) in little-endian byte order
+     *
+     * @tparam T
+     * @tparam Buffer
+     * @param buffer
+     * @param value
+     */
+    template<typename T, typename Buffer> inline void append_le(Buffer &buffer, T value)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            buffer.push_back(static_cast<typename Buffer::value_type>(static_cast<uint64_t>(value) >> (8 * i)));
+        }
+    }
+
+    /**
+     * Reads an unsigned integer in little-endian byte order from data known to be long enough
+     *
+     * @tparam T
+     * @param data
+     * @return
+     */
+    template<typename T> inline T read_le(const unsigned char *data)
+    {
+        uint64_t value = 0;
+
+        for (size_t i = 0; i < sizeof(T); ++i)
+        {
+            value |= static_cast<uint64_t>(data[i]) << (8 * i);
+        }
+
+        return static_cast<T>(value);
+    }
+
+    /**
+     * Reads an unsigned integer in little-endian byte order from the buffer and advances the offset
+     *
+     * @tparam T
+     * @param data
+     * @param length
+     * @param offset
+     * @param value
+     * @return false if there are not enough bytes remaining in the buffer
+     */
+    template<typename T> inline bool read_le(const void *data, size_t length, size_t &offset, T &value)
+    {
+        if (offset > length || length - offset < sizeof(T))
+        {
+            return false;
+        }
+
+        value = read_le<T>(static_cast<const unsigned char *>(data) + offset);
+
+        offset += sizeof(T);
+
+        return true;
+    }
+
+    /**
+     * Returns the current time in milliseconds since the epoch
+     *
+     * @return
+     */
+    inline uint64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+} // namespace LMDB
+
+#endif // LMDB_INTERNAL_HPP
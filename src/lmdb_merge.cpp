@@ -0,0 +1,163 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_merge.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace LMDB::Merge
+{
+    mdb_result_t encode_int64(int64_t value)
+    {
+        mdb_result_t result(sizeof(int64_t));
+
+        const auto temp = static_cast<uint64_t>(value);
+
+        for (size_t i = 0; i < sizeof(int64_t); ++i)
+        {
+            result[i] = static_cast<unsigned char>(temp >> (8 * i));
+        }
+
+        return result;
+    }
+
+    int64_t decode_int64(const mdb_result_t &value)
+    {
+        if (value.size() != sizeof(int64_t))
+        {
+            throw std::invalid_argument("Integer merge values must be exactly 8 bytes");
+        }
+
+        uint64_t result = 0;
+
+        for (size_t i = 0; i < sizeof(int64_t); ++i)
+        {
+            result |= static_cast<uint64_t>(value[i]) << (8 * i);
+        }
+
+        return static_cast<int64_t>(result);
+    }
+
+    merge_operator_t add_int64()
+    {
+        return [](const mdb_result_t *existing, const mdb_result_t &operand)
+        {
+            const auto current = (existing) ? decode_int64(*existing) : 0;
+
+            // wrap around on overflow rather than invoking undefined behavior
+            return encode_int64(
+                static_cast<int64_t>(static_cast<uint64_t>(current) + static_cast<uint64_t>(decode_int64(operand))));
+        };
+    }
+
+    merge_operator_t max_int64()
+    {
+        return [](const mdb_result_t *existing, const mdb_result_t &operand)
+        {
+            const auto value = decode_int64(operand);
+
+            return encode_int64((existing) ? std::max(decode_int64(*existing), value) : value);
+        };
+    }
+
+    merge_operator_t min_int64()
+    {
+        return [](const mdb_result_t *existing, const mdb_result_t &operand)
+        {
+            const auto value = decode_int64(operand);
+
+            return encode_int64((existing) ? std::min(decode_int64(*existing), value) : value);
+        };
+    }
+
+    merge_operator_t append()
+    {
+        return [](const mdb_result_t *existing, const mdb_result_t &operand)
+        {
+            mdb_result_t result;
+
+            result.reserve(((existing) ? existing->size() : 0) + operand.size());
+
+            if (existing)
+            {
+                result.insert(result.end(), existing->begin(), existing->end());
+            }
+
+            result.insert(result.end(), operand.begin(), operand.end());
+
+            return result;
+        };
+    }
+
+    merge_operator_t set_union(size_t width)
+    {
+        if (width == 0)
+        {
+            throw std::invalid_argument("Set item width must be greater than 0");
+        }
+
+        return [width](const mdb_result_t *existing, const mdb_result_t &operand)
+        {
+            if (operand.size() % width != 0 || (existing && existing->size() % width != 0))
+            {
+                throw std::invalid_argument("Set values must be a multiple of the item width");
+            }
+
+            std::vector<mdb_result_t> items;
+
+            const auto load = [&items, width](const mdb_result_t &value)
+            {
+                for (size_t offset = 0; offset < value.size(); offset += width)
+                {
+                    items.emplace_back(value.begin() + offset, value.begin() + offset + width);
+                }
+            };
+
+            if (existing)
+            {
+                load(*existing);
+            }
+
+            load(operand);
+
+            std::sort(items.begin(), items.end());
+
+            items.erase(std::unique(items.begin(), items.end()), items.end());
+
+            mdb_result_t result;
+
+            result.reserve(items.size() * width);
+
+            for (const auto &item : items)
+            {
+                result.insert(result.end(), item.begin(), item.end());
+            }
+
+            return result;
+        };
+    }
+} // namespace LMDB::Merge
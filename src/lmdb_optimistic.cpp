@@ -0,0 +1,300 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_optimistic.hpp"
+
+#include <string_view>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+
+namespace LMDB
+{
+    OptimisticTransaction::OptimisticTransaction(std::shared_ptr<Environment> environment):
+        environment(std::move(environment))
+    {
+    }
+
+    OptimisticTransaction::~OptimisticTransaction()
+    {
+        abort();
+    }
+
+    void OptimisticTransaction::abort()
+    {
+        snapshot = nullptr;
+
+        reads.clear();
+
+        writes.clear();
+    }
+
+    Error OptimisticTransaction::commit()
+    {
+        // release the snapshot so that it does not pin old pages while we hold the write lock
+        snapshot = nullptr;
+
+        // the reads all came from a single consistent snapshot, so there is nothing to validate
+        if (writes.empty())
+        {
+            abort();
+
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
+
+    try_again:
+        auto txn = std::shared_ptr<Transaction>(new Transaction(environment));
+
+        Error error;
+
+        for (const auto &[id, read] : reads)
+        {
+            const auto [stamp_error, found, stamp] = read_stamp(*txn, read.db, std::get<1>(id), nullptr);
+
+            if (stamp_error)
+            {
+                error = stamp_error;
+
+                break;
+            }
+
+            if (found != read.found || stamp != read.stamp)
+            {
+                abort();
+
+                return MAKE_LMDB_ERROR(LMDB_CONFLICT);
+            }
+        }
+
+        for (auto it = writes.begin(); !error && it != writes.end(); ++it)
+        {
+            const auto &key = std::get<1>(it->first);
+
+            auto db = it->second.db;
+
+            txn->use(db);
+
+            if (it->second.deleted)
+            {
+                error = txn->del(key);
+
+                if (error == LMDB_NOTFOUND)
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+                }
+            }
+            else
+            {
+                error = txn->put(key, it->second.value);
+            }
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        abort();
+
+        return error;
+    }
+
+    void OptimisticTransaction::del(const std::shared_ptr<Database> &db, const void *key, size_t length)
+    {
+        auto &entry = writes[{db->dbi, mdb_result_t(static_cast<const unsigned char *>(key),
+                                                    static_cast<const unsigned char *>(key) + length)}];
+
+        entry.db = db;
+
+        entry.deleted = true;
+
+        entry.value.clear();
+    }
+
+    bool OptimisticTransaction::exists(const std::shared_ptr<Database> &db, const void *key, size_t length)
+    {
+        const auto [error, value] = get(db, key, length);
+
+        return !error;
+    }
+
+    std::tuple<Error, mdb_result_t>
+        OptimisticTransaction::get(const std::shared_ptr<Database> &db, const void *key, size_t length)
+    {
+        auto id = std::make_tuple(
+            db->dbi,
+            mdb_result_t(static_cast<const unsigned char *>(key), static_cast<const unsigned char *>(key) + length));
+
+        // read your own writes
+        if (const auto it = writes.find(id); it != writes.end())
+        {
+            if (it->second.deleted)
+            {
+                return {MAKE_LMDB_ERROR(LMDB_NOTFOUND), {}};
+            }
+
+            return {MAKE_LMDB_ERROR(SUCCESS), it->second.value};
+        }
+
+        if (!snapshot)
+        {
+            snapshot = std::shared_ptr<Transaction>(new Transaction(environment, true));
+        }
+
+        mdb_result_t value;
+
+        const auto [error, found, stamp] = read_stamp(*snapshot, db, std::get<1>(id), &value);
+
+        if (error)
+        {
+            return {error, {}};
+        }
+
+        // only the first read of a key is recorded as every read comes from the same snapshot
+        reads.try_emplace(std::move(id), read_entry_t {db, found, stamp});
+
+        if (!found)
+        {
+            return {MAKE_LMDB_ERROR(LMDB_NOTFOUND), {}};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), std::move(value)};
+    }
+
+    void OptimisticTransaction::put(
+        const std::shared_ptr<Database> &db,
+        const void *key,
+        size_t key_length,
+        const void *value,
+        size_t value_length)
+    {
+        auto &entry = writes[{db->dbi, mdb_result_t(static_cast<const unsigned char *>(key),
+                                                    static_cast<const unsigned char *>(key) + key_length)}];
+
+        entry.db = db;
+
+        entry.deleted = false;
+
+        entry.value.assign(
+            static_cast<const unsigned char *>(value), static_cast<const unsigned char *>(value) + value_length);
+    }
+
+    std::tuple<Error, bool, uint64_t> OptimisticTransaction::read_stamp(
+        Transaction &txn,
+        std::shared_ptr<Database> db,
+        const mdb_result_t &key,
+        mdb_result_t *value)
+    {
+        txn.use(db);
+
+        /**
+         * A version is cheaper to compare. It is only 0 when the key does not exist (a key without a
+         * stamp has a version too), so the key is found the same way whether or not the value is fetched
+         */
+        if (db->versioned())
+        {
+            const auto [error, version] = txn.version(key);
+
+            if (error)
+            {
+                return {error, false, 0};
+            }
+
+            if (version != 0 && value)
+            {
+                auto [get_error, result] = txn.get(key);
+
+                if (get_error)
+                {
+                    return {get_error, false, 0};
+                }
+
+                *value = std::move(result);
+            }
+
+            return {MAKE_LMDB_ERROR(SUCCESS), version != 0, version};
+        }
+
+        auto [error, result] = txn.get(key);
+
+        if (error == LMDB_NOTFOUND)
+        {
+            return {MAKE_LMDB_ERROR(SUCCESS), false, 0};
+        }
+
+        if (error)
+        {
+            return {error, false, 0};
+        }
+
+        const auto stamp = std::hash<std::string_view>()(
+            std::string_view(reinterpret_cast<const char *>(result.data()), result.size()));
+
+        if (value)
+        {
+            *value = std::move(result);
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), true, stamp};
+    }
+
+    Error OptimisticTransaction::run(
+        std::shared_ptr<Environment> environment,
+        const std::function<Error(OptimisticTransaction &)> &body,
+        size_t max_attempts)
+    {
+        for (size_t attempt = 0; attempt < max_attempts; ++attempt)
+        {
+            OptimisticTransaction txn(environment);
+
+            auto error = body(txn);
+
+            if (error)
+            {
+                return error;
+            }
+
+            error = txn.commit();
+
+            if (error != LMDB_CONFLICT)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(LMDB_CONFLICT);
+    }
+} // namespace LMDB
@@ -0,0 +1,603 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_replication.hpp"
+#include "lmdb_internal.hpp"
+
+#include <algorithm>
+#include <map>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_REPLICATION_MAGIC 0x504d4c52 // RLMP
+#define LMDB_REPLICATION_STATE_NAME "__replication"
+#define LMDB_REPLICATION_APPLIED_KEY std::string("applied_sequence")
+#define LMDB_REPLICATION_MAX_PAYLOAD (1024 * 1024 * 1024)
+#define LMDB_REPLICATION_READ_CHUNK (1024 * 1024)
+#define LMDB_REPLICATION_HEADER_SIZE 29
+#define LMDB_REPLICATION_CRC_OFFSET 25
+
+namespace LMDB
+{
+    /**
+     * Frame types written to the replication stream
+     */
+    enum ReplicationFrameType : uint8_t
+    {
+        FRAME_CHANGE = 1,
+        FRAME_HEARTBEAT = 2
+    };
+
+    /**
+     * The outcome of reading a frame from the replication stream
+     */
+    enum ReplicationFrameStatus
+    {
+        FRAME_READ,
+        FRAME_INCOMPLETE,
+        FRAME_CORRUPTED
+    };
+
+    /**
+     * A frame as read from the replication stream
+     *
+     * Layout: [magic (4)] [type (1)] [sequence (8)] [timestamp (8)] [payload length (4)] [crc32c (4)] [payload]
+     *
+     * The checksum covers the header (up to the checksum itself) and the payload
+     */
+    struct replication_frame_t
+    {
+        uint8_t type = 0;
+
+        uint64_t sequence = 0;
+
+        uint64_t timestamp = 0;
+
+        std::string payload;
+    };
+
+    /**
+     * Reads a length prefixed byte string from the buffer and advances the offset
+     *
+     * @tparam LengthType
+     * @param buffer
+     * @param offset
+     * @param value
+     * @return false if there are not enough bytes remaining in the buffer
+     */
+    template<typename LengthType, typename OutputType>
+    static inline bool read_bytes(const std::string &buffer, size_t &offset, OutputType &value)
+    {
+        LengthType length = 0;
+
+        if (!read_le(buffer.data(), buffer.size(), offset, length) || offset + length > buffer.size())
+        {
+            return false;
+        }
+
+        value = OutputType(buffer.begin() + offset, buffer.begin() + offset + length);
+
+        offset += length;
+
+        return true;
+    }
+
+    /**
+     * Encodes a change as the payload of a replication frame
+     *
+     * Layout: [txn id (8)] [operation (1)] [flags (4)] [name length (2)] [name]
+     *         [key length (4)] [key] [value length (4)] [value]
+     *
+     * @param record
+     * @return
+     */
+    static inline std::string encode_change(const ChangeRecord &record)
+    {
+        std::string payload;
+
+        payload.reserve(23 + record.database.size() + record.key.size() + record.value.size());
+
+        append_le<uint64_t>(payload, record.txn_id);
+
+        append_le<uint8_t>(payload, record.operation);
+
+        append_le<uint32_t>(payload, record.flags);
+
+        append_le<uint16_t>(payload, record.database.size());
+
+        payload.append(record.database);
+
+        append_le<uint32_t>(payload, record.key.size());
+
+        payload.append(record.key.begin(), record.key.end());
+
+        append_le<uint32_t>(payload, record.value.size());
+
+        payload.append(record.value.begin(), record.value.end());
+
+        return payload;
+    }
+
+    /**
+     * Decodes a change from the payload of a replication frame
+     *
+     * @param sequence
+     * @param payload
+     * @param record
+     * @return false if the payload is malformed
+     */
+    static inline bool decode_change(uint64_t sequence, const std::string &payload, ChangeRecord &record)
+    {
+        size_t offset = 0;
+
+        uint64_t txn_id = 0;
+
+        uint8_t operation = 0;
+
+        record.sequence = sequence;
+
+        const auto data = payload.data();
+
+        const auto length = payload.size();
+
+        if (!read_le(data, length, offset, txn_id) || !read_le(data, length, offset, operation)
+            || !read_le(data, length, offset, record.flags) || !read_bytes<uint16_t>(payload, offset, record.database)
+            || !read_bytes<uint32_t>(payload, offset, record.key)
+            || !read_bytes<uint32_t>(payload, offset, record.value))
+        {
+            return false;
+        }
+
+        record.txn_id = txn_id;
+
+        record.operation = static_cast<ChangeOperation>(operation);
+
+        return true;
+    }
+
+    /**
+     * Writes a frame to the replication stream
+     *
+     * @param output
+     * @param type
+     * @param sequence
+     * @param payload
+     */
+    static inline void write_frame(std::ostream &output, uint8_t type, uint64_t sequence, const std::string &payload)
+    {
+        std::string header;
+
+        append_le<uint32_t>(header, LMDB_REPLICATION_MAGIC);
+
+        append_le<uint8_t>(header, type);
+
+        append_le<uint64_t>(header, sequence);
+
+        append_le<uint64_t>(header, now_ms());
+
+        append_le<uint32_t>(header, payload.size());
+
+        auto crc = crc32c(reinterpret_cast<const unsigned char *>(header.data()), header.size());
+
+        crc = crc32c(reinterpret_cast<const unsigned char *>(payload.data()), payload.size(), crc);
+
+        append_le<uint32_t>(header, crc);
+
+        output.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+        output.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+    }
+
+    /**
+     * Reads a complete frame from the replication stream
+     *
+     * @param input
+     * @param frame
+     * @return whether a frame was read, the stream ended part way through a frame, or the frame is invalid
+     */
+    static inline ReplicationFrameStatus read_frame(std::istream &input, replication_frame_t &frame)
+    {
+        std::string header(LMDB_REPLICATION_HEADER_SIZE, '\0');
+
+        if (!input.read(header.data(), static_cast<std::streamsize>(header.size())))
+        {
+            return FRAME_INCOMPLETE;
+        }
+
+        size_t offset = 0;
+
+        uint32_t magic = 0, length = 0, crc = 0;
+
+        read_le(header.data(), header.size(), offset, magic);
+
+        read_le(header.data(), header.size(), offset, frame.type);
+
+        read_le(header.data(), header.size(), offset, frame.sequence);
+
+        read_le(header.data(), header.size(), offset, frame.timestamp);
+
+        read_le(header.data(), header.size(), offset, length);
+
+        read_le(header.data(), header.size(), offset, crc);
+
+        if (magic != LMDB_REPLICATION_MAGIC || length > LMDB_REPLICATION_MAX_PAYLOAD)
+        {
+            return FRAME_CORRUPTED;
+        }
+
+        frame.payload.clear();
+
+        // grow the payload as it arrives rather than trusting the length up front
+        while (frame.payload.size() < length)
+        {
+            const auto offset = frame.payload.size();
+
+            const auto chunk = std::min<size_t>(length - offset, LMDB_REPLICATION_READ_CHUNK);
+
+            frame.payload.resize(offset + chunk);
+
+            if (!input.read(frame.payload.data() + offset, static_cast<std::streamsize>(chunk)))
+            {
+                return FRAME_INCOMPLETE;
+            }
+        }
+
+        // a damaged key or value would otherwise decode cleanly and be applied to the follower
+        const auto header_bytes = reinterpret_cast<const unsigned char *>(header.data());
+
+        const auto payload_bytes = reinterpret_cast<const unsigned char *>(frame.payload.data());
+
+        const auto expected =
+            crc32c(payload_bytes, frame.payload.size(), crc32c(header_bytes, LMDB_REPLICATION_CRC_OFFSET));
+
+        return (crc == expected) ? FRAME_READ : FRAME_CORRUPTED;
+    }
+
+    ReplicationLeader::ReplicationLeader(std::shared_ptr<Environment> environment, size_t from_sequence):
+        environment(std::move(environment)), shipped(from_sequence)
+    {
+        if (!this->environment->change_log_enabled())
+        {
+            throw std::runtime_error("The change log must be enabled on the environment to replicate it");
+        }
+    }
+
+    std::tuple<Error, size_t> ReplicationLeader::ship(std::ostream &output, size_t max_records, bool acknowledge)
+    {
+        std::scoped_lock lock(mutex);
+
+        const auto records = environment->changes(shipped + 1, max_records);
+
+        for (const auto &record : records)
+        {
+            write_frame(output, FRAME_CHANGE, record.sequence, encode_change(record));
+        }
+
+        const auto last_shipped = (records.empty()) ? shipped : records.back().sequence;
+
+        const auto [error, last_sequence] = environment->last_change_sequence();
+
+        if (error)
+        {
+            return {error, 0};
+        }
+
+        // the heartbeat lets the follower know how far behind it is
+        write_frame(output, FRAME_HEARTBEAT, std::max(last_sequence, last_shipped), "");
+
+        output.flush();
+
+        if (!output)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not write to the replication stream"), 0};
+        }
+
+        shipped = last_shipped;
+
+        if (acknowledge && !records.empty())
+        {
+            const auto ack_error = environment->acknowledge_changes(shipped);
+
+            if (ack_error)
+            {
+                return {ack_error, records.size()};
+            }
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), records.size()};
+    }
+
+    size_t ReplicationLeader::shipped_sequence() const
+    {
+        std::scoped_lock lock(mutex);
+
+        return shipped;
+    }
+
+    ReplicationFollower::ReplicationFollower(std::shared_ptr<Environment> environment):
+        environment(std::move(environment))
+    {
+        state_db = this->environment->database(LMDB_REPLICATION_STATE_NAME);
+
+        const auto [error, value] = state_db->get(LMDB_REPLICATION_APPLIED_KEY);
+
+        if (!error && value.size() == sizeof(uint64_t))
+        {
+            size_t offset = 0;
+
+            uint64_t sequence = 0;
+
+            read_le(value.data(), value.size(), offset, sequence);
+
+            applied = sequence;
+
+            leader_sequence = sequence;
+        }
+    }
+
+    std::tuple<Error, size_t> ReplicationFollower::apply(std::istream &input, size_t batch_size, size_t max_records)
+    {
+        std::vector<std::tuple<uint64_t, ChangeRecord>> batch;
+
+        size_t total = 0;
+
+        // the changes before an invalid frame are still applied
+        Error corruption;
+
+        batch_size = std::max<size_t>(batch_size, 1);
+
+        while (max_records == 0 || total + batch.size() < max_records)
+        {
+            const auto position = input.tellg();
+
+            replication_frame_t frame;
+
+            const auto status = read_frame(input, frame);
+
+            if (status != FRAME_READ)
+            {
+                // rewind any partially written (or invalid) frame (if we can) so that it is read in full next time
+                input.clear();
+
+                if (position != std::streampos(-1))
+                {
+                    input.seekg(position);
+                }
+
+                if (status == FRAME_INCOMPLETE)
+                {
+                    break;
+                }
+
+                corruption = MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The replication stream contains an invalid frame");
+
+                break;
+            }
+
+            if (frame.type == FRAME_HEARTBEAT)
+            {
+                std::scoped_lock lock(mutex);
+
+                leader_sequence = std::max<size_t>(leader_sequence, frame.sequence);
+
+                continue;
+            }
+
+            ChangeRecord record;
+
+            // skip changes that we have already applied (ie. the stream is being replayed)
+            if (frame.type != FRAME_CHANGE || frame.sequence <= applied)
+            {
+                continue;
+            }
+
+            if (!decode_change(frame.sequence, frame.payload, record))
+            {
+                // leave the stream at the change (if we can) so that it is not skipped
+                if (position != std::streampos(-1))
+                {
+                    input.seekg(position);
+                }
+
+                corruption = MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The replication stream contains an invalid change");
+
+                break;
+            }
+
+            batch.emplace_back(frame.timestamp, std::move(record));
+
+            if (batch.size() >= batch_size)
+            {
+                const auto error = apply_batch(batch);
+
+                if (error)
+                {
+                    return {error, total};
+                }
+
+                total += batch.size();
+
+                batch.clear();
+            }
+        }
+
+        if (!batch.empty())
+        {
+            const auto error = apply_batch(batch);
+
+            if (error)
+            {
+                return {error, total};
+            }
+
+            total += batch.size();
+        }
+
+        if (corruption)
+        {
+            return {corruption, total};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), total};
+    }
+
+    Error ReplicationFollower::apply_batch(const std::vector<std::tuple<uint64_t, ChangeRecord>> &batch)
+    {
+        const auto &[last_timestamp, last_record] = batch.back();
+
+        std::string encoded;
+
+        append_le<uint64_t>(encoded, last_record.sequence);
+
+        /**
+         * Opening a database we have not seen yet takes the write transaction itself, so every database
+         * in the batch is opened before we start ours (or we would wait on ourselves forever)
+         */
+        std::map<std::string, std::shared_ptr<Database>> databases;
+
+        for (const auto &[timestamp, record] : batch)
+        {
+            if (databases.find(record.database) == databases.end())
+            {
+                databases.emplace(record.database, environment->database(record.database));
+            }
+        }
+
+    try_again:
+        auto txn = state_db->transaction();
+
+        Error error;
+
+        for (const auto &[timestamp, record] : batch)
+        {
+            txn->use(databases.at(record.database));
+
+            if (record.operation == CHANGE_PUT)
+            {
+                // positional flags do not carry over to the follower
+                const auto flags = record.flags & (MDB_NOOVERWRITE | MDB_NODUPDATA);
+
+                error = txn->put(record.key.data(), record.key.size(), record.value.data(), record.value.size(), flags);
+
+                if (error == LMDB_KEYEXIST)
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+                }
+            }
+            else
+            {
+                error = (record.value.empty())
+                            ? txn->del(record.key)
+                            : txn->del(record.key.data(), record.key.size(), record.value.data(), record.value.size());
+
+                if (error == LMDB_NOTFOUND)
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+                }
+            }
+
+            if (error)
+            {
+                break;
+            }
+        }
+
+        /**
+         * Record how far we have applied in the same transaction as the changes themselves. This is
+         * written directly so that it never appears in our own change log (if enabled) and overwrites
+         * the progress of a follower that is replicating from us.
+         */
+        if (!error)
+        {
+            const auto key = LMDB_REPLICATION_APPLIED_KEY;
+
+            MDB_val i_key = {key.size(), (void *)key.data()}, i_value = {encoded.size(), (void *)encoded.data()};
+
+            const auto result = mdb_put(*txn->txn, state_db->dbi, &i_key, &i_value, 0);
+
+            error = MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        if (error)
+        {
+            return error;
+        }
+
+        std::scoped_lock lock(mutex);
+
+        applied = last_record.sequence;
+
+        applied_time = last_timestamp;
+
+        leader_sequence = std::max(leader_sequence, applied);
+
+        return error;
+    }
+
+    size_t ReplicationFollower::applied_sequence() const
+    {
+        std::scoped_lock lock(mutex);
+
+        return applied;
+    }
+
+    ReplicationLag ReplicationFollower::lag() const
+    {
+        std::scoped_lock lock(mutex);
+
+        ReplicationLag result;
+
+        result.applied_sequence = applied;
+
+        result.leader_sequence = leader_sequence;
+
+        result.records = leader_sequence - applied;
+
+        if (result.records != 0 && applied_time != 0)
+        {
+            const auto now = now_ms();
+
+            result.time = std::chrono::milliseconds((now > applied_time) ? now - applied_time : 0);
+        }
+
+        return result;
+    }
+} // namespace LMDB
@@ -0,0 +1,446 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_sharded.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define LMDB_FNV_PRIME 0x100000001b3ULL
+
+namespace LMDB
+{
+    /**
+     * Hashes the bytes using 64-bit FNV-1a. Unlike std::hash, the result is stable across platforms
+     * and standard library implementations, which is required as it determines where keys are stored.
+     *
+     * @param data
+     * @param length
+     * @return
+     */
+    static inline uint64_t fnv1a(const void *data, size_t length)
+    {
+        const auto bytes = static_cast<const unsigned char *>(data);
+
+        uint64_t hash = LMDB_FNV_OFFSET_BASIS;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            hash ^= bytes[i];
+
+            hash *= LMDB_FNV_PRIME;
+        }
+
+        return hash;
+    }
+
+    /**
+     * Applies the writes to the database in a single write transaction
+     *
+     * If we encounter MDB_MAP_FULL, we will automatically retry the transaction after
+     * attempting to expand the database
+     *
+     * @param environment
+     * @param db
+     * @param ops [key, value] pairs, if the value is nullptr the key is deleted
+     * @return
+     */
+    static Error write_shard(
+        const std::shared_ptr<Environment> &environment,
+        const std::shared_ptr<Database> &db,
+        const std::vector<std::tuple<const mdb_result_t *, const mdb_result_t *>> &ops)
+    {
+    try_again:
+        auto txn = db->transaction();
+
+        Error error;
+
+        for (const auto &[key, value] : ops)
+        {
+            if (value)
+            {
+                error = txn->put(*key, *value);
+            }
+            else
+            {
+                error = txn->del(*key);
+
+                if (error == LMDB_NOTFOUND)
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+                }
+            }
+
+            if (error)
+            {
+                break;
+            }
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    int ShardKeyCompare::compare(const mdb_result_t &a, const mdb_result_t &b) const
+    {
+        if ((flags & MDB_INTEGERKEY) && a.size() == b.size() && a.size() == sizeof(unsigned int))
+        {
+            unsigned int a_int, b_int;
+
+            std::memcpy(&a_int, a.data(), sizeof(a_int));
+
+            std::memcpy(&b_int, b.data(), sizeof(b_int));
+
+            return (a_int < b_int) ? -1 : (a_int > b_int);
+        }
+
+        if ((flags & MDB_INTEGERKEY) && a.size() == b.size() && a.size() == sizeof(size_t))
+        {
+            size_t a_int, b_int;
+
+            std::memcpy(&a_int, a.data(), sizeof(a_int));
+
+            std::memcpy(&b_int, b.data(), sizeof(b_int));
+
+            return (a_int < b_int) ? -1 : (a_int > b_int);
+        }
+
+        const auto length = std::min(a.size(), b.size());
+
+        if (flags & MDB_REVERSEKEY)
+        {
+            for (size_t i = 1; i <= length; ++i)
+            {
+                if (a[a.size() - i] != b[b.size() - i])
+                {
+                    return (a[a.size() - i] < b[b.size() - i]) ? -1 : 1;
+                }
+            }
+        }
+        else if (const auto result = (length != 0) ? std::memcmp(a.data(), b.data(), length) : 0; result != 0)
+        {
+            return result;
+        }
+
+        return (a.size() < b.size()) ? -1 : (a.size() > b.size());
+    }
+
+    ShardedIterator::ShardedIterator(
+        const std::vector<std::shared_ptr<Database>> &databases,
+        ShardKeyCompare compare,
+        const void *begin,
+        size_t length):
+        heads(head_greater_t {compare})
+    {
+        for (size_t i = 0; i < databases.size(); ++i)
+        {
+            transactions.push_back(databases[i]->transaction(true));
+
+            cursors.push_back(transactions.back()->cursor());
+
+            auto [error, key, value] =
+                (begin) ? cursors.back()->get(begin, length, MDB_SET_RANGE) : cursors.back()->get(MDB_FIRST);
+
+            push(i, error, std::move(key), std::move(value));
+        }
+    }
+
+    std::tuple<Error, mdb_result_t, mdb_result_t> ShardedIterator::next()
+    {
+        if (heads.empty())
+        {
+            return {MAKE_LMDB_ERROR(LMDB_NOTFOUND), {}, {}};
+        }
+
+        auto head = heads.top();
+
+        heads.pop();
+
+        auto [error, key, value] = cursors[head.shard]->get(MDB_NEXT);
+
+        push(head.shard, error, std::move(key), std::move(value));
+
+        return {MAKE_LMDB_ERROR(SUCCESS), std::move(head.key), std::move(head.value)};
+    }
+
+    void ShardedIterator::push(size_t shard, const Error &error, mdb_result_t key, mdb_result_t value)
+    {
+        // the shard is exhausted (or failed), either way it has nothing more to contribute
+        if (error)
+        {
+            return;
+        }
+
+        heads.push({std::move(key), std::move(value), shard});
+    }
+
+    ShardedDatabase::ShardedDatabase(
+        std::vector<std::shared_ptr<Environment>> environments,
+        const std::string &name,
+        bool enable_compression,
+        int flags):
+        ShardedDatabase(std::move(environments), {}, name, enable_compression, flags)
+    {
+    }
+
+    ShardedDatabase::ShardedDatabase(
+        std::vector<std::shared_ptr<Environment>> environments,
+        std::vector<mdb_result_t> split_keys,
+        const std::string &name,
+        bool enable_compression,
+        int flags):
+        environments(std::move(environments)), split_keys(std::move(split_keys))
+    {
+        compare.flags = static_cast<unsigned int>(flags) & (MDB_INTEGERKEY | MDB_REVERSEKEY);
+
+        if (this->environments.empty())
+        {
+            throw std::invalid_argument("A sharded database requires at least one environment");
+        }
+
+        if (!this->split_keys.empty())
+        {
+            if (this->split_keys.size() != this->environments.size() - 1)
+            {
+                throw std::invalid_argument("A range sharded database requires one fewer split key than shards");
+            }
+
+            if (!std::is_sorted(this->split_keys.begin(), this->split_keys.end(), compare))
+            {
+                throw std::invalid_argument("The split keys of a range sharded database must be sorted");
+            }
+        }
+
+        for (auto &environment : this->environments)
+        {
+            databases.push_back(environment->database(name, enable_compression, flags));
+        }
+    }
+
+    size_t ShardedDatabase::count()
+    {
+        size_t count = 0;
+
+        for (auto &db : databases)
+        {
+            count += db->count();
+        }
+
+        return count;
+    }
+
+    std::shared_ptr<Database> ShardedDatabase::database(size_t shard) const
+    {
+        return databases.at(shard);
+    }
+
+    Error ShardedDatabase::del(const void *key, size_t length)
+    {
+        return databases[shard(key, length)]->del(key, length);
+    }
+
+    Error ShardedDatabase::del_batch(const std::vector<mdb_result_t> &keys)
+    {
+        std::vector<batch_op_t> ops;
+
+        ops.reserve(keys.size());
+
+        for (const auto &key : keys)
+        {
+            ops.emplace_back(&key, nullptr);
+        }
+
+        return apply_batch(ops);
+    }
+
+    bool ShardedDatabase::exists(const void *key, size_t length)
+    {
+        return databases[shard(key, length)]->exists(key, length);
+    }
+
+    std::tuple<Error, mdb_result_t> ShardedDatabase::get(const void *key, size_t length)
+    {
+        return databases[shard(key, length)]->get(key, length);
+    }
+
+    std::shared_ptr<ShardedIterator> ShardedDatabase::iterator(const void *begin, size_t length)
+    {
+        return std::shared_ptr<ShardedIterator>(new ShardedIterator(databases, compare, begin, length));
+    }
+
+    std::shared_ptr<ShardedDatabase> ShardedDatabase::open(
+        const std::string &path,
+        size_t shards,
+        const std::string &name,
+        bool enable_compression,
+        int flags)
+    {
+        std::vector<std::shared_ptr<Environment>> environments;
+
+        for (size_t i = 0; i < shards; ++i)
+        {
+            environments.push_back(Environment::instance(path + "." + std::to_string(i)));
+        }
+
+        return std::make_shared<ShardedDatabase>(std::move(environments), name, enable_compression, flags);
+    }
+
+    Error ShardedDatabase::put(const void *key, size_t key_length, const void *value, size_t value_length, int flags)
+    {
+        return databases[shard(key, key_length)]->put(key, key_length, value, value_length, flags);
+    }
+
+    Error ShardedDatabase::put_batch(const std::vector<std::tuple<mdb_result_t, mdb_result_t>> &pairs)
+    {
+        std::vector<batch_op_t> ops;
+
+        ops.reserve(pairs.size());
+
+        for (const auto &[key, value] : pairs)
+        {
+            ops.emplace_back(&key, &value);
+        }
+
+        return apply_batch(ops);
+    }
+
+    size_t ShardedDatabase::shard(const void *key, size_t length) const
+    {
+        if (!split_keys.empty())
+        {
+            const auto bytes = static_cast<const unsigned char *>(key);
+
+            const auto it =
+                std::upper_bound(split_keys.begin(), split_keys.end(), mdb_result_t(bytes, bytes + length), compare);
+
+            return std::distance(split_keys.begin(), it);
+        }
+
+        return fnv1a(key, length) % databases.size();
+    }
+
+    size_t ShardedDatabase::shards() const
+    {
+        return databases.size();
+    }
+
+    Error ShardedDatabase::apply_batch(const std::vector<batch_op_t> &ops)
+    {
+        std::vector<std::vector<batch_op_t>> partitions(databases.size());
+
+        for (const auto &op : ops)
+        {
+            const auto &key = *std::get<0>(op);
+
+            partitions[shard(key.data(), key.size())].push_back(op);
+        }
+
+        std::vector<Error> errors(databases.size());
+
+        std::vector<std::exception_ptr> exceptions(databases.size());
+
+        std::vector<std::thread> threads;
+
+        std::vector<size_t> pending;
+
+        for (size_t i = 0; i < partitions.size(); ++i)
+        {
+            if (!partitions[i].empty())
+            {
+                pending.push_back(i);
+            }
+        }
+
+        // an exception must not escape a worker (or this thread while the workers are still joinable)
+        const auto write = [&](size_t shard_id)
+        {
+            try
+            {
+                errors[shard_id] = write_shard(environments[shard_id], databases[shard_id], partitions[shard_id]);
+            }
+            catch (...)
+            {
+                exceptions[shard_id] = std::current_exception();
+            }
+        };
+
+        // the last shard is written on this thread rather than sitting idle while we wait
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            if (i + 1 == pending.size())
+            {
+                write(pending[i]);
+            }
+            else
+            {
+                threads.emplace_back(write, pending[i]);
+            }
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        for (const auto &exception : exceptions)
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        for (const auto &error : errors)
+        {
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+} // namespace LMDB
@@ -0,0 +1,907 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_value_log.hpp"
+#include "lmdb_internal.hpp"
+
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_VALUE_INLINE 0x00
+#define LMDB_VALUE_POINTER 0x01
+#define LMDB_VALUE_POINTER_SIZE 21 // [tag (1)] [segment (4)] [offset (8)] [length (8)]
+#define LMDB_BLOB_HEADER_SIZE 8 // [key length (4)] [value length (4)]
+
+namespace LMDB
+{
+    /**
+     * A read-only memory map of (the first size bytes of) a segment of the blob log
+     */
+    struct ValueLog::mapping_t
+    {
+        const unsigned char *data = nullptr;
+
+        size_t size = 0;
+
+        ~mapping_t()
+        {
+#ifndef _WIN32
+            if (data)
+            {
+                munmap(const_cast<unsigned char *>(data), size);
+            }
+#endif
+        }
+    };
+
+    /**
+     * The location of a value in the blob log
+     */
+    struct blob_pointer_t
+    {
+        uint32_t segment = 0;
+
+        uint64_t offset = 0, length = 0;
+    };
+
+    /**
+     * Encodes the segment number as big-endian bytes so that the segments sort numerically
+     *
+     * @param segment
+     * @return
+     */
+    static inline mdb_result_t encode_segment(uint32_t segment)
+    {
+        return {static_cast<unsigned char>(segment >> 24),
+                static_cast<unsigned char>(segment >> 16),
+                static_cast<unsigned char>(segment >> 8),
+                static_cast<unsigned char>(segment)};
+    }
+
+    /**
+     * Decodes a big-endian segment number
+     *
+     * @param value
+     * @return
+     */
+    static inline uint32_t decode_segment(const mdb_result_t &value)
+    {
+        return (static_cast<uint32_t>(value[0]) << 24) | (static_cast<uint32_t>(value[1]) << 16)
+               | (static_cast<uint32_t>(value[2]) << 8) | static_cast<uint32_t>(value[3]);
+    }
+
+    /**
+     * Decodes the stored value of a key if it is a pointer into the blob log
+     *
+     * @param stored
+     * @param pointer
+     * @return whether the stored value is a pointer
+     */
+    static inline bool decode_pointer(const mdb_result_t &stored, blob_pointer_t &pointer)
+    {
+        if (stored.size() != LMDB_VALUE_POINTER_SIZE || stored[0] != LMDB_VALUE_POINTER)
+        {
+            return false;
+        }
+
+        pointer.segment = read_le<uint32_t>(stored.data() + 1);
+
+        pointer.offset = read_le<uint64_t>(stored.data() + 5);
+
+        pointer.length = read_le<uint64_t>(stored.data() + 13);
+
+        return true;
+    }
+
+    /**
+     * Decodes the total and live bytes of a segment
+     *
+     * @param value
+     * @return [total, live]
+     */
+    static inline std::tuple<uint64_t, uint64_t> decode_usage(const mdb_result_t &value)
+    {
+        if (value.size() != 2 * sizeof(uint64_t))
+        {
+            return {0, 0};
+        }
+
+        return {read_le<uint64_t>(value.data()), read_le<uint64_t>(value.data() + sizeof(uint64_t))};
+    }
+
+    /**
+     * Reads a value directly from the transaction
+     *
+     * Values are read without going through Transaction::get() so that the stored pointers, inline
+     * values and segment usage are never mistaken for snappy compressed data.
+     *
+     * @param txn
+     * @param dbi
+     * @param key
+     * @param length
+     * @return [result, value]
+     */
+    static inline std::tuple<int, mdb_result_t> raw_get(MDB_txn *txn, MDB_dbi dbi, const void *key, size_t length)
+    {
+        MDB_val i_key = {length, const_cast<void *>(key)}, value = {0, nullptr};
+
+        const auto result = mdb_get(txn, dbi, &i_key, &value);
+
+        if (result != MDB_SUCCESS)
+        {
+            return {result, {}};
+        }
+
+        const auto bytes = static_cast<const unsigned char *>(value.mv_data);
+
+        return {result, mdb_result_t(bytes, bytes + value.mv_size)};
+    }
+
+    /**
+     * Reads the total and live bytes of every segment directly from the transaction
+     *
+     * @param txn
+     * @param dbi
+     * @return [segment, total, live] in ascending order of segment
+     */
+    static inline std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> read_usage(MDB_txn *txn, MDB_dbi dbi)
+    {
+        std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> usage;
+
+        MDB_cursor *cursor = nullptr;
+
+        if (mdb_cursor_open(txn, dbi, &cursor) != MDB_SUCCESS)
+        {
+            return usage;
+        }
+
+        MDB_val key, value;
+
+        for (auto result = mdb_cursor_get(cursor, &key, &value, MDB_FIRST); result == MDB_SUCCESS;
+             result = mdb_cursor_get(cursor, &key, &value, MDB_NEXT))
+        {
+            if (key.mv_size != sizeof(uint32_t))
+            {
+                continue;
+            }
+
+            const auto key_bytes = static_cast<const unsigned char *>(key.mv_data);
+
+            const auto value_bytes = static_cast<const unsigned char *>(value.mv_data);
+
+            const auto [total, live] = decode_usage(mdb_result_t(value_bytes, value_bytes + value.mv_size));
+
+            usage.emplace_back(decode_segment(mdb_result_t(key_bytes, key_bytes + key.mv_size)), total, live);
+        }
+
+        mdb_cursor_close(cursor);
+
+        return usage;
+    }
+
+    const unsigned char *BlobView::data() const
+    {
+        return m_data;
+    }
+
+    bool BlobView::empty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t BlobView::size() const
+    {
+        return m_size;
+    }
+
+    ValueLog::ValueLog(std::shared_ptr<Database> db, ValueLogOptions options):
+        db(std::move(db)), options(std::move(options))
+    {
+        if (this->options.path.empty())
+        {
+            throw std::invalid_argument("A path is required for the blob log of a value log");
+        }
+
+        // the stored records are read back raw, so they must not be compressed on the way in
+        if (this->db->compressed())
+        {
+            throw std::invalid_argument("A value log cannot use a database with compression enabled");
+        }
+
+        blobs_db = this->db->environment->database(this->db->name + ":blobs");
+
+        if (blobs_db->compressed())
+        {
+            throw std::invalid_argument("The blobs database of a value log cannot use compression");
+        }
+
+        // continue appending to the newest segment that we know about
+        {
+            auto txn = blobs_db->transaction(true);
+
+            const auto usage = read_usage(*txn->txn, blobs_db->dbi);
+
+            if (!usage.empty())
+            {
+                active_segment = std::get<0>(usage.back());
+            }
+        }
+
+        active_file = std::fopen(segment_path(active_segment).c_str(), "ab");
+
+        if (!active_file)
+        {
+            throw std::runtime_error("Could not open blob log segment: " + segment_path(active_segment));
+        }
+
+        std::fseek(active_file, 0, SEEK_END);
+
+        active_size = std::ftell(active_file);
+    }
+
+    ValueLog::~ValueLog()
+    {
+        stop_gc();
+
+        if (active_file)
+        {
+            std::fclose(active_file);
+        }
+    }
+
+    Error ValueLog::account(Transaction &txn, uint32_t segment, int64_t total, int64_t live)
+    {
+        const auto key = encode_segment(segment);
+
+        txn.use(blobs_db);
+
+        const auto [result, value] = raw_get(*txn.txn, blobs_db->dbi, key.data(), key.size());
+
+        auto [current_total, current_live] = decode_usage(value);
+
+        current_total += total;
+
+        current_live += live;
+
+        mdb_result_t encoded;
+
+        append_le<uint64_t>(encoded, current_total);
+
+        append_le<uint64_t>(encoded, current_live);
+
+        const auto put_error = txn.put(key, encoded);
+
+        txn.use(db);
+
+        return put_error;
+    }
+
+    std::tuple<Error, mdb_result_t> ValueLog::append(const mdb_result_t &key, const void *value, size_t length)
+    {
+        // the record header holds 32-bit lengths, a longer value could not be found again by collect()
+        if (length > UINT32_MAX || key.size() > UINT32_MAX)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_BAD_VALSIZE, "The value is too large for the blob log"), {}};
+        }
+
+        std::scoped_lock lock(mutex);
+
+        if (active_size >= options.segment_size)
+        {
+            const auto next = active_segment + 1;
+
+            auto file = std::fopen(segment_path(next).c_str(), "ab");
+
+            if (!file)
+            {
+                return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not open blob log segment: " + segment_path(next)), {}};
+            }
+
+            std::fclose(active_file);
+
+            active_file = file;
+
+            active_segment = next;
+
+            std::fseek(active_file, 0, SEEK_END);
+
+            active_size = std::ftell(active_file);
+        }
+
+        mdb_result_t header;
+
+        append_le<uint32_t>(header, static_cast<uint32_t>(key.size()));
+
+        append_le<uint32_t>(header, static_cast<uint32_t>(length));
+
+        if (std::fwrite(header.data(), 1, header.size(), active_file) != header.size()
+            || std::fwrite(key.data(), 1, key.size(), active_file) != key.size()
+            || std::fwrite(value, 1, length, active_file) != length || std::fflush(active_file) != 0
+            || (options.sync && LMDB_FSYNC(active_file) != 0))
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not write to blob log segment"), {}};
+        }
+
+        const auto offset = active_size + LMDB_BLOB_HEADER_SIZE + key.size();
+
+        active_size = offset + length;
+
+        mdb_result_t pointer;
+
+        pointer.reserve(LMDB_VALUE_POINTER_SIZE);
+
+        pointer.push_back(LMDB_VALUE_POINTER);
+
+        append_le<uint32_t>(pointer, active_segment);
+
+        append_le<uint64_t>(pointer, offset);
+
+        append_le<uint64_t>(pointer, length);
+
+        return {MAKE_LMDB_ERROR(SUCCESS), pointer};
+    }
+
+    Error ValueLog::collect(uint32_t segment, size_t chunk_size)
+    {
+        auto file = std::fopen(segment_path(segment).c_str(), "rb");
+
+        if (!file)
+        {
+            return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not open blob log segment: " + segment_path(segment));
+        }
+
+        // the [key, value offset, value length] of the next chunk of values in the segment
+        std::vector<std::tuple<mdb_result_t, uint64_t, uint64_t>> candidates;
+
+        Error error;
+
+        bool done = false;
+
+        uint64_t position = 0;
+
+        while (!done && !error)
+        {
+            candidates.clear();
+
+            while (candidates.size() < chunk_size)
+            {
+                unsigned char header[LMDB_BLOB_HEADER_SIZE];
+
+                // a partially written record at the end of the segment is garbage
+                if (std::fread(header, 1, sizeof(header), file) != sizeof(header))
+                {
+                    done = true;
+
+                    break;
+                }
+
+                const auto key_length = read_le<uint32_t>(header);
+
+                const auto value_length = read_le<uint32_t>(header + sizeof(uint32_t));
+
+                mdb_result_t key(key_length);
+
+                if (std::fread(key.data(), 1, key_length, file) != key_length
+                    || std::fseek(file, static_cast<long>(value_length), SEEK_CUR) != 0)
+                {
+                    done = true;
+
+                    break;
+                }
+
+                const auto offset = position + LMDB_BLOB_HEADER_SIZE + key_length;
+
+                position = offset + value_length;
+
+                candidates.emplace_back(std::move(key), offset, value_length);
+            }
+
+            const auto resume = std::ftell(file);
+
+        try_again:
+            auto txn = db->transaction();
+
+            for (const auto &[key, offset, length] : candidates)
+            {
+                const auto [result, stored] = raw_get(*txn->txn, db->dbi, key.data(), key.size());
+
+                blob_pointer_t pointer;
+
+                // the key has been deleted or overwritten since the value was written
+                if (result != MDB_SUCCESS || !decode_pointer(stored, pointer) || pointer.segment != segment
+                    || pointer.offset != offset || pointer.length != length)
+                {
+                    continue;
+                }
+
+                mdb_result_t value(length);
+
+                if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0
+                    || std::fread(value.data(), 1, length, file) != length)
+                {
+                    error = MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not read blob log segment");
+
+                    break;
+                }
+
+                const auto [append_error, relocated] = append(key, value.data(), value.size());
+
+                error = (append_error) ? append_error : replace(*txn, key, &relocated);
+
+                if (error)
+                {
+                    break;
+                }
+            }
+
+            if (!error)
+            {
+                error = txn->commit();
+            }
+
+            if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+            {
+                txn->abort();
+
+                if (!db->environment->expand())
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+
+                    goto try_again;
+                }
+            }
+
+            std::fseek(file, resume, SEEK_SET);
+        }
+
+        std::fclose(file);
+
+        if (error)
+        {
+            return error;
+        }
+
+        // nothing references the segment any longer
+        {
+            auto txn = blobs_db->transaction();
+
+            const auto segment_key = encode_segment(segment);
+
+            const auto [result, usage] = raw_get(*txn->txn, blobs_db->dbi, segment_key.data(), segment_key.size());
+
+            const auto [total, live] = decode_usage(usage);
+
+            // every live value has been relocated (or since overwritten), otherwise we must keep the segment
+            if (live != 0)
+            {
+                return MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob log segment still holds live values");
+            }
+
+            error = txn->del(segment_key);
+
+            if (!error || error == LMDB_NOTFOUND)
+            {
+                error = txn->commit();
+            }
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        {
+            std::scoped_lock lock(mutex);
+
+            mappings.erase(segment);
+        }
+
+        // any views into the segment keep their own mapping of it
+        std::remove(segment_path(segment).c_str());
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error ValueLog::del(const void *key, size_t length)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        const auto i_key = mdb_result_t(key_bytes, key_bytes + length);
+
+    try_again:
+        auto txn = db->transaction();
+
+        auto error = replace(*txn, i_key, nullptr);
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    std::tuple<Error, size_t> ValueLog::garbage_collect(double min_garbage_ratio, size_t chunk_size)
+    {
+        std::scoped_lock gc_lock(gc_mutex);
+
+        uint32_t active;
+
+        {
+            std::scoped_lock lock(mutex);
+
+            active = active_segment;
+        }
+
+        std::vector<uint32_t> victims;
+
+        {
+            auto txn = blobs_db->transaction(true);
+
+            for (const auto &[segment, total, live] : read_usage(*txn->txn, blobs_db->dbi))
+            {
+                if (segment != active && total != 0
+                    && 1.0 - static_cast<double>(live) / static_cast<double>(total) >= min_garbage_ratio)
+                {
+                    victims.push_back(segment);
+                }
+            }
+        }
+
+        size_t reclaimed = 0;
+
+        for (const auto &segment : victims)
+        {
+            const auto error = collect(segment, chunk_size);
+
+            if (error)
+            {
+                return {error, reclaimed};
+            }
+
+            reclaimed++;
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), reclaimed};
+    }
+
+    std::tuple<Error, mdb_result_t> ValueLog::get(const void *key, size_t length)
+    {
+        const auto [error, view] = this->view(key, length);
+
+        if (error)
+        {
+            return {error, {}};
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), mdb_result_t(view.data(), view.data() + view.size())};
+    }
+
+    Error ValueLog::put(const void *key, size_t key_length, const void *value, size_t value_length)
+    {
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        const auto i_key = mdb_result_t(key_bytes, key_bytes + key_length);
+
+        mdb_result_t stored;
+
+        if (value_length >= options.threshold)
+        {
+            auto [error, pointer] = append(i_key, value, value_length);
+
+            if (error)
+            {
+                return error;
+            }
+
+            stored = std::move(pointer);
+        }
+        else
+        {
+            const auto value_bytes = static_cast<const unsigned char *>(value);
+
+            stored.reserve(value_length + 1);
+
+            stored.push_back(LMDB_VALUE_INLINE);
+
+            stored.insert(stored.end(), value_bytes, value_bytes + value_length);
+        }
+
+    try_again:
+        auto txn = db->transaction();
+
+        auto error = replace(*txn, i_key, &stored);
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        return error;
+    }
+
+    Error ValueLog::replace(Transaction &txn, const mdb_result_t &key, const mdb_result_t *value)
+    {
+        const auto [result, previous] = raw_get(*txn.txn, db->dbi, key.data(), key.size());
+
+        if (result != MDB_SUCCESS && result != MDB_NOTFOUND)
+        {
+            return MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result));
+        }
+
+        auto error = (value) ? txn.put(key, *value) : txn.del(key);
+
+        if (error)
+        {
+            return error;
+        }
+
+        blob_pointer_t pointer;
+
+        if (value && decode_pointer(*value, pointer))
+        {
+            const auto length = static_cast<int64_t>(pointer.length);
+
+            error = account(txn, pointer.segment, length, length);
+
+            if (error)
+            {
+                return error;
+            }
+        }
+
+        if (result == MDB_SUCCESS && decode_pointer(previous, pointer))
+        {
+            return account(txn, pointer.segment, 0, -static_cast<int64_t>(pointer.length));
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    std::tuple<Error, BlobView> ValueLog::resolve(mdb_result_t stored)
+    {
+        BlobView view;
+
+        if (!stored.empty() && stored[0] == LMDB_VALUE_INLINE)
+        {
+            auto owner = std::make_shared<mdb_result_t>(std::move(stored));
+
+            view.m_data = owner->data() + 1;
+
+            view.m_size = owner->size() - 1;
+
+            view.owner = std::move(owner);
+
+            return {MAKE_LMDB_ERROR(SUCCESS), view};
+        }
+
+        blob_pointer_t pointer;
+
+        if (!decode_pointer(stored, pointer))
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The stored value is not a value log entry"), view};
+        }
+
+        const auto end = pointer.offset + pointer.length;
+
+#ifdef _WIN32
+        auto file = std::fopen(segment_path(pointer.segment).c_str(), "rb");
+
+        if (!file)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_NOTFOUND, "The blob log segment does not exist"), view};
+        }
+
+        auto owner = std::make_shared<mdb_result_t>(pointer.length);
+
+        const auto read = std::fseek(file, static_cast<long>(pointer.offset), SEEK_SET) == 0
+                          && std::fread(owner->data(), 1, owner->size(), file) == owner->size();
+
+        std::fclose(file);
+
+        if (!read)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob log segment is shorter than expected"), view};
+        }
+
+        view.m_data = owner->data();
+
+        view.m_size = owner->size();
+
+        view.owner = std::move(owner);
+#else
+        std::shared_ptr<mapping_t> mapping;
+
+        {
+            std::scoped_lock lock(mutex);
+
+            mapping = mappings[pointer.segment];
+
+            // the segment has grown since we mapped it (or has not been mapped yet)
+            if (!mapping || mapping->size < end)
+            {
+                const auto fd = open(segment_path(pointer.segment).c_str(), O_RDONLY);
+
+                if (fd < 0)
+                {
+                    mappings.erase(pointer.segment);
+
+                    return {MAKE_LMDB_ERROR_MSG(LMDB_NOTFOUND, "The blob log segment does not exist"), view};
+                }
+
+                struct stat st = {};
+
+                mapping = std::make_shared<mapping_t>();
+
+                if (fstat(fd, &st) == 0 && st.st_size > 0)
+                {
+                    const auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+                    if (data != MAP_FAILED)
+                    {
+                        mapping->data = static_cast<const unsigned char *>(data);
+
+                        mapping->size = st.st_size;
+                    }
+                }
+
+                close(fd);
+
+                mappings[pointer.segment] = mapping;
+            }
+        }
+
+        if (mapping->size < end)
+        {
+            return {MAKE_LMDB_ERROR_MSG(LMDB_CORRUPTED, "The blob log segment is shorter than expected"), view};
+        }
+
+        view.m_data = mapping->data + pointer.offset;
+
+        view.m_size = pointer.length;
+
+        view.owner = std::move(mapping);
+#endif
+
+        return {MAKE_LMDB_ERROR(SUCCESS), view};
+    }
+
+    std::string ValueLog::segment_path(uint32_t segment) const
+    {
+        return options.path + "." + std::to_string(segment);
+    }
+
+    void ValueLog::start_gc(std::chrono::milliseconds interval, double min_garbage_ratio)
+    {
+        stop_gc();
+
+        gc_stop = false;
+
+        gc_thread = std::thread(
+            [this, interval, min_garbage_ratio]
+            {
+                std::unique_lock lock(gc_thread_mutex);
+
+                while (!gc_cv.wait_for(lock, interval, [this] { return gc_stop; }))
+                {
+                    lock.unlock();
+
+                    garbage_collect(min_garbage_ratio);
+
+                    lock.lock();
+                }
+            });
+    }
+
+    std::tuple<Error, ValueLogStats> ValueLog::stats()
+    {
+        ValueLogStats stats;
+
+        auto txn = blobs_db->transaction(true);
+
+        for (const auto &[segment, total, live] : read_usage(*txn->txn, blobs_db->dbi))
+        {
+            stats.segments++;
+
+            stats.total_bytes += total;
+
+            stats.live_bytes += live;
+        }
+
+        return {MAKE_LMDB_ERROR(SUCCESS), stats};
+    }
+
+    void ValueLog::stop_gc()
+    {
+        {
+            std::scoped_lock lock(gc_thread_mutex);
+
+            gc_stop = true;
+        }
+
+        gc_cv.notify_all();
+
+        if (gc_thread.joinable())
+        {
+            gc_thread.join();
+        }
+    }
+
+    std::tuple<Error, BlobView> ValueLog::view(const void *key, size_t length)
+    {
+        // if garbage collection removes the segment between reading the pointer and the value, the
+        // pointer has since been updated to the new location of the value so we read it again
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            auto txn = db->transaction(true);
+
+            auto [result, stored] = raw_get(*txn->txn, db->dbi, key, length);
+
+            txn->abort();
+
+            if (result != MDB_SUCCESS)
+            {
+                return {MAKE_LMDB_ERROR_MSG(result, mdb_strerror(result)), {}};
+            }
+
+            auto [resolve_error, view] = resolve(std::move(stored));
+
+            if (resolve_error != LMDB_NOTFOUND || attempt == 1)
+            {
+                return {resolve_error, view};
+            }
+        }
+
+        return {MAKE_LMDB_ERROR(LMDB_NOTFOUND), {}};
+    }
+} // namespace LMDB
@@ -0,0 +1,454 @@
+// Copyright (c) 2020-2023, Brandon Lehmann
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "lmdb_write_buffer.hpp"
+#include "lmdb_internal.hpp"
+
+#include <stdexcept>
+
+#define MAKE_LMDB_ERROR(code) Error(code, __LINE__, __FILE__)
+#define MAKE_LMDB_ERROR_MSG(code, message) Error(code, message, __LINE__, __FILE__)
+#define LMDB_WAL_HEADER_SIZE 13 // [operation (1)] [key length (4)] [value length (4)] [crc32c (4)]
+#define LMDB_WAL_CRC_OFFSET 9
+#define LMDB_WAL_PUT 1
+#define LMDB_WAL_DEL 2
+
+namespace LMDB
+{
+    /**
+     * Computes the checksum of a write-ahead log record over its header (up to the checksum itself),
+     * key and value
+     *
+     * @param header
+     * @param key
+     * @param value
+     * @return
+     */
+    static inline uint32_t record_crc(const void *header, const mdb_result_t &key, const mdb_result_t &value)
+    {
+        auto crc = crc32c(static_cast<const unsigned char *>(header), LMDB_WAL_CRC_OFFSET);
+
+        crc = crc32c(key.data(), key.size(), crc);
+
+        return crc32c(value.data(), value.size(), crc);
+    }
+
+    WriteBuffer::WriteBuffer(std::shared_ptr<Database> db, WriteBufferOptions options):
+        db(std::move(db)), options(std::move(options))
+    {
+        if (this->options.durability != BUFFER_VOLATILE)
+        {
+            if (this->options.wal_path.empty())
+            {
+                throw std::invalid_argument("A write-ahead log path is required for a durable write buffer");
+            }
+
+            replay();
+
+            wal = std::fopen(this->options.wal_path.c_str(), "ab");
+
+            if (!wal)
+            {
+                throw std::runtime_error("Could not open write-ahead log: " + this->options.wal_path);
+            }
+        }
+
+        if (this->options.max_age.count() > 0)
+        {
+            flusher = std::thread(
+                [this]
+                {
+                    const auto interval = std::max(this->options.max_age / 2, std::chrono::milliseconds(1));
+
+                    std::unique_lock lock(flusher_mutex);
+
+                    while (!flusher_stop)
+                    {
+                        flusher_cv.wait_for(lock, interval, [this] { return flusher_stop; });
+
+                        if (flusher_stop)
+                        {
+                            break;
+                        }
+
+                        lock.unlock();
+
+                        bool due;
+
+                        {
+                            std::shared_lock buffer_lock(buffer_mutex);
+
+                            due = !buffer.empty()
+                                  && std::chrono::steady_clock::now() - oldest >= this->options.max_age;
+                        }
+
+                        if (due)
+                        {
+                            flush();
+                        }
+
+                        lock.lock();
+                    }
+                });
+        }
+    }
+
+    WriteBuffer::~WriteBuffer()
+    {
+        {
+            std::scoped_lock lock(flusher_mutex);
+
+            flusher_stop = true;
+        }
+
+        flusher_cv.notify_all();
+
+        if (flusher.joinable())
+        {
+            flusher.join();
+        }
+
+        flush();
+
+        if (wal)
+        {
+            std::fclose(wal);
+        }
+    }
+
+    size_t WriteBuffer::bytes() const
+    {
+        std::shared_lock lock(buffer_mutex);
+
+        return buffer_bytes;
+    }
+
+    Error WriteBuffer::del(const void *key, size_t length)
+    {
+        std::scoped_lock lock(write_mutex);
+
+        const auto bytes = static_cast<const unsigned char *>(key);
+
+        return record(mdb_result_t(bytes, bytes + length), {true, {}});
+    }
+
+    bool WriteBuffer::exists(const void *key, size_t length)
+    {
+        const auto [error, value] = get(key, length);
+
+        return !error;
+    }
+
+    Error WriteBuffer::flush()
+    {
+        std::scoped_lock lock(write_mutex);
+
+        return flush_locked();
+    }
+
+    Error WriteBuffer::flush_locked()
+    {
+        // writers are held off by the write mutex, so readers can keep using the buffer while we write it out
+        std::shared_lock read_lock(buffer_mutex);
+
+        if (buffer.empty())
+        {
+            return MAKE_LMDB_ERROR(SUCCESS);
+        }
+
+    try_again:
+        auto txn = db->transaction();
+
+        Error error;
+
+        for (const auto &[key, entry] : buffer)
+        {
+            if (entry.deleted)
+            {
+                error = txn->del(key);
+
+                if (error == LMDB_NOTFOUND)
+                {
+                    error = MAKE_LMDB_ERROR(SUCCESS);
+                }
+            }
+            else
+            {
+                error = txn->put(key, entry.value);
+            }
+
+            if (error)
+            {
+                break;
+            }
+        }
+
+        if (!error)
+        {
+            error = txn->commit();
+        }
+
+        if (error == LMDB_MAP_FULL || error == LMDB_TXN_FULL)
+        {
+            txn->abort();
+
+            if (!db->environment->expand())
+            {
+                goto try_again;
+            }
+        }
+
+        if (error)
+        {
+            return error;
+        }
+
+        read_lock.unlock();
+
+        {
+            std::unique_lock lock(buffer_mutex);
+
+            buffer.clear();
+
+            buffer_bytes = 0;
+        }
+
+        // everything in the log is now in the database
+        if (wal)
+        {
+            wal = std::freopen(options.wal_path.c_str(), "wb", wal);
+
+            if (!wal)
+            {
+                return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not truncate write-ahead log: " + options.wal_path);
+            }
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    std::tuple<Error, mdb_result_t> WriteBuffer::get(const void *key, size_t length)
+    {
+        {
+            std::shared_lock lock(buffer_mutex);
+
+            const auto bytes = static_cast<const unsigned char *>(key);
+
+            const auto it = buffer.find(mdb_result_t(bytes, bytes + length));
+
+            if (it != buffer.end())
+            {
+                if (it->second.deleted)
+                {
+                    return {MAKE_LMDB_ERROR_MSG(LMDB_NOTFOUND, mdb_strerror(MDB_NOTFOUND)), {}};
+                }
+
+                return {MAKE_LMDB_ERROR(SUCCESS), it->second.value};
+            }
+        }
+
+        return db->get(key, length);
+    }
+
+    Error WriteBuffer::put(const void *key, size_t key_length, const void *value, size_t value_length)
+    {
+        std::scoped_lock lock(write_mutex);
+
+        const auto key_bytes = static_cast<const unsigned char *>(key);
+
+        const auto value_bytes = static_cast<const unsigned char *>(value);
+
+        const auto error = record(
+            mdb_result_t(key_bytes, key_bytes + key_length),
+            {false, mdb_result_t(value_bytes, value_bytes + value_length)});
+
+        if (error)
+        {
+            return error;
+        }
+
+        // only writers change the size of the buffer and we are holding them off
+        if (buffer_bytes >= options.max_bytes)
+        {
+            return flush_locked();
+        }
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    Error WriteBuffer::record(mdb_result_t key, entry_t entry)
+    {
+        // a durable buffer never accepts a write that it could not log
+        if (options.durability != BUFFER_VOLATILE)
+        {
+            /**
+             * The log could not be reopened after the last flush. The buffer is empty (every write since
+             * has been refused), so everything the log held is in the database and it can start over.
+             */
+            if (!wal)
+            {
+                wal = std::fopen(options.wal_path.c_str(), "wb");
+
+                if (!wal)
+                {
+                    return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not reopen write-ahead log: " + options.wal_path);
+                }
+            }
+
+            std::string encoded;
+
+            encoded.reserve(LMDB_WAL_HEADER_SIZE + key.size() + entry.value.size());
+
+            encoded.push_back(static_cast<char>((entry.deleted) ? LMDB_WAL_DEL : LMDB_WAL_PUT));
+
+            append_le<uint32_t>(encoded, static_cast<uint32_t>(key.size()));
+
+            append_le<uint32_t>(encoded, static_cast<uint32_t>(entry.value.size()));
+
+            append_le<uint32_t>(encoded, record_crc(encoded.data(), key, entry.value));
+
+            encoded.append(key.begin(), key.end());
+
+            encoded.append(entry.value.begin(), entry.value.end());
+
+            if (std::fwrite(encoded.data(), 1, encoded.size(), wal) != encoded.size() || std::fflush(wal) != 0
+                || (options.durability == BUFFER_WAL_SYNC && LMDB_FSYNC(wal) != 0))
+            {
+                return MAKE_LMDB_ERROR_MSG(LMDB_ERROR, "Could not write to write-ahead log: " + options.wal_path);
+            }
+        }
+
+        std::unique_lock lock(buffer_mutex);
+
+        if (buffer.empty())
+        {
+            oldest = std::chrono::steady_clock::now();
+        }
+
+        const auto size = key.size() + entry.value.size();
+
+        if (const auto it = buffer.find(key); it != buffer.end())
+        {
+            buffer_bytes -= it->first.size() + it->second.value.size();
+
+            it->second = std::move(entry);
+        }
+        else
+        {
+            buffer.emplace(std::move(key), std::move(entry));
+        }
+
+        buffer_bytes += size;
+
+        return MAKE_LMDB_ERROR(SUCCESS);
+    }
+
+    void WriteBuffer::replay()
+    {
+        auto file = std::fopen(options.wal_path.c_str(), "rb");
+
+        if (!file)
+        {
+            return;
+        }
+
+        std::vector<unsigned char> data;
+
+        unsigned char chunk[65536];
+
+        size_t read;
+
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+        {
+            data.insert(data.end(), chunk, chunk + read);
+        }
+
+        std::fclose(file);
+
+        size_t offset = 0;
+
+        // a partially written (or corrupted) record at the end of the log, from a crash mid-write, is ignored
+        while (offset + LMDB_WAL_HEADER_SIZE <= data.size())
+        {
+            const auto operation = data[offset];
+
+            const auto key_length = read_le<uint32_t>(data.data() + offset + 1);
+
+            const auto value_length = read_le<uint32_t>(data.data() + offset + 5);
+
+            const auto start = offset + LMDB_WAL_HEADER_SIZE;
+
+            if ((operation != LMDB_WAL_PUT && operation != LMDB_WAL_DEL)
+                || data.size() - start < static_cast<size_t>(key_length) + value_length)
+            {
+                break;
+            }
+
+            mdb_result_t key(data.begin() + start, data.begin() + start + key_length);
+
+            entry_t entry {operation == LMDB_WAL_DEL,
+                           mdb_result_t(
+                               data.begin() + start + key_length, data.begin() + start + key_length + value_length)};
+
+            if (read_le<uint32_t>(data.data() + offset + LMDB_WAL_CRC_OFFSET)
+                != record_crc(data.data() + offset, key, entry.value))
+            {
+                break;
+            }
+
+            // the log itself is not open yet so this only loads the buffer
+            record(std::move(key), std::move(entry));
+
+            offset = start + key_length + value_length;
+        }
+
+        // drop anything after the valid records so that new records are not appended after it
+        if (offset != data.size())
+        {
+            file = std::fopen(options.wal_path.c_str(), "wb");
+
+            if (!file || std::fwrite(data.data(), 1, offset, file) != offset || std::fflush(file) != 0
+                || LMDB_FSYNC(file) != 0)
+            {
+                if (file)
+                {
+                    std::fclose(file);
+                }
+
+                throw std::runtime_error("Could not truncate write-ahead log: " + options.wal_path);
+            }
+
+            std::fclose(file);
+        }
+    }
+
+    size_t WriteBuffer::size() const
+    {
+        std::shared_lock lock(buffer_mutex);
+
+        return buffer.size();
+    }
+} // namespace LMDB
@@ -24,8 +24,22 @@
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include "lmdb_blob.hpp"
 #include "lmdb_cpp.hpp"
+#include "lmdb_dedup.hpp"
+#include "lmdb_merge.hpp"
+#include "lmdb_optimistic.hpp"
+#include "lmdb_predicates.hpp"
+#include "lmdb_replication.hpp"
+#include "lmdb_sharded.hpp"
+#include "lmdb_typed.hpp"
+#include "lmdb_value_log.hpp"
+#include "lmdb_write_buffer.hpp"
 
 using namespace LMDB;
 
@@ -104,5 +118,839 @@ int main()
         }
     }
 
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        auto txn = db->transaction();
+
+        txn->put(std::string("nested_kept"), std::string("kept"));
+
+        {
+            auto child = txn->begin_nested();
+
+            child->put(std::string("nested_discarded"), std::string("discarded"));
+
+            child->abort();
+        }
+
+        {
+            auto child = txn->begin_nested();
+
+            child->put(std::string("nested_committed"), std::string("committed"));
+
+            child->commit();
+        }
+
+        txn->commit();
+
+        std::cout << "Nested kept: " << db->exists(std::string("nested_kept")) << std::endl;
+
+        std::cout << "Nested discarded: " << db->exists(std::string("nested_discarded")) << std::endl;
+
+        std::cout << "Nested committed: " << db->exists(std::string("nested_committed")) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        // index each value by its last character
+        auto idx = db->create_index(
+            "by_suffix",
+            [](const mdb_result_t &, const mdb_result_t &value)
+            {
+                return std::vector<mdb_result_t> {{value.back()}};
+            });
+
+        idx->backfill(2);
+
+        const auto suffix = std::string("7");
+
+        for (const auto &k : idx->lookup(suffix))
+        {
+            std::cout << "Indexed Key: " << std::string(k.begin(), k.end()) << std::endl;
+        }
+
+        db->del(key + "7");
+
+        std::cout << "Indexed after delete: " << idx->count(suffix) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        db->enable_ttl();
+
+        db->put(std::string("ttl_short"), std::string("short"), std::chrono::milliseconds(0));
+
+        db->put(std::string("ttl_long"), std::string("long"), std::chrono::hours(1));
+
+        std::cout << "TTL short exists: " << db->exists(std::string("ttl_short")) << std::endl;
+
+        std::cout << "TTL long exists: " << db->exists(std::string("ttl_long")) << std::endl;
+
+        const auto [error, purged] = db->purge_expired();
+
+        std::cout << "TTL purged: " << purged << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        env->enable_change_log();
+
+        auto db = env->database("test");
+
+        const auto [seq_error, start] = env->last_change_sequence();
+
+        db->put(std::string("cdc_key"), std::string("cdc_value"));
+
+        db->del(std::string("cdc_key"));
+
+        for (const auto &change : env->changes(start + 1))
+        {
+            std::cout << "Change #" << change.sequence << " [" << change.database << "] "
+                      << ((change.operation == CHANGE_PUT) ? "PUT " : "DEL ")
+                      << std::string(change.key.begin(), change.key.end()) << std::endl;
+        }
+
+        const auto [last_error, last] = env->last_change_sequence();
+
+        env->acknowledge_changes(last);
+
+        std::cout << "Changes after acknowledge: " << env->changes(0).size() << std::endl;
+
+        db->put(std::string("cdc_key"), std::string("cdc_value"));
+
+        db->del(std::string("cdc_key"));
+
+        const auto after = env->changes(last + 1);
+
+        std::cout << "Sequence after acknowledge: " << (after.empty() ? 0 : after.front().sequence)
+                  << " (continues from " << last << ")" << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto replica_env = Environment::instance("test_replica.db");
+
+        auto db = env->database("test");
+
+        ReplicationLeader leader(env, std::get<1>(env->last_change_sequence()));
+
+        ReplicationFollower follower(replica_env);
+
+        db->put(std::string("replicated"), std::string("value"));
+
+        std::stringstream stream;
+
+        const auto [ship_error, shipped] = leader.ship(stream, 1000, true);
+
+        const auto [apply_error, applied] = follower.apply(stream);
+
+        std::cout << "Replication shipped: " << shipped << " applied: " << applied
+                  << " lag: " << follower.lag().records << std::endl;
+
+        std::cout << "Replica has key: " << replica_env->database("test")->exists(std::string("replicated"))
+                  << std::endl;
+
+        // the log was emptied by acknowledging what was shipped, later changes must still replicate
+        db->put(std::string("replicated_again"), std::string("value"));
+
+        const auto [reship_error, reshipped] = leader.ship(stream, 1000, true);
+
+        const auto [reapply_error, reapplied] = follower.apply(stream);
+
+        std::cout << "Replica has key after acknowledge: "
+                  << replica_env->database("test")->exists(std::string("replicated_again")) << std::endl;
+
+        // the follower has never opened this database, so applying the change has to open it
+        env->database("replicated_only")->put(std::string("unopened"), std::string("value"));
+
+        const auto [unopened_ship_error, unopened_shipped] = leader.ship(stream, 1000, true);
+
+        const auto [unopened_error, unopened_applied] = follower.apply(stream);
+
+        std::cout << "Replica opened database: " << unopened_applied << " "
+                  << replica_env->database("replicated_only")->exists(std::string("unopened")) << std::endl;
+
+        db->put(std::string("flipped"), std::string("value"));
+
+        std::stringstream shipped_stream;
+
+        leader.ship(shipped_stream, 1000, true);
+
+        // damage the payload of the change so that it still decodes, only the checksum can tell
+        auto damaged = shipped_stream.str();
+
+        damaged[29] ^= 0x01;
+
+        std::stringstream damaged_stream(damaged);
+
+        const auto [damaged_error, damaged_applied] = follower.apply(damaged_stream);
+
+        std::cout << "Damaged frame rejected: " << (damaged_error == LMDB_CORRUPTED) << std::endl;
+
+        std::stringstream corrupted("not a replication frame, just some bytes");
+
+        const auto [corrupted_error, corrupted_applied] = follower.apply(corrupted);
+
+        std::cout << "Corrupted stream rejected: " << (corrupted_error == LMDB_CORRUPTED) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        auto w = env->watch(db, std::string("watched_"));
+
+        const auto [id_error, last_seen] = env->last_txn_id();
+
+        std::thread writer([&db] { db->put(std::string("watched_key"), std::string("value")); });
+
+        const auto latest = env->wait_for_commit(last_seen, std::chrono::seconds(5));
+
+        std::cout << "Commit observed: " << (latest > last_seen) << std::endl;
+
+        std::cout << "Watch triggered: " << w->wait(std::chrono::seconds(5)) << std::endl;
+
+        writer.join();
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        const auto counter = std::string("counter");
+
+        db->merge(counter, Merge::encode_int64(5), Merge::add_int64());
+
+        db->merge_batch(
+            {{mdb_result_t(counter.begin(), counter.end()), Merge::encode_int64(10)},
+             {mdb_result_t(counter.begin(), counter.end()), Merge::encode_int64(-3)}},
+            Merge::add_int64());
+
+        const auto [error, value] = db->get(counter);
+
+        std::cout << "Counter: " << Merge::decode_int64(value) << std::endl;
+
+        const auto malformed_error = db->merge(counter, std::string("bad"), Merge::add_int64());
+
+        std::cout << "Malformed operand rejected: " << (malformed_error == LMDB_BAD_VALSIZE) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        db->enable_versioning();
+
+        const auto cas_key = std::string("cas_key");
+
+        db->put_if_absent(cas_key, std::string("first"));
+
+        const auto [absent_error, existing] = db->put_if_absent(cas_key, std::string("second"));
+
+        std::cout << "Put if absent conflict: " << std::string(existing.begin(), existing.end()) << std::endl;
+
+        const auto [cas_error, current] = db->compare_and_swap(cas_key, std::string("wrong"), std::string("third"));
+
+        std::cout << "CAS conflict: " << (cas_error == LMDB_CONFLICT) << " current: "
+                  << std::string(current.begin(), current.end()) << std::endl;
+
+        const auto [version_error, version] = db->version(cas_key);
+
+        const auto [put_error, new_version, ignored] = db->put_if_version(cas_key, version, std::string("fourth"));
+
+        std::cout << "Put if version: " << put_error.to_string() << " new version: " << new_version << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("unversioned");
+
+        const auto key = std::string("legacy_key");
+
+        // written before versioning is enabled, so the key has no version stamp
+        db->put(key, std::string("legacy"));
+
+        db->enable_versioning();
+
+        const auto [version_error, version] = db->version(key);
+
+        const auto [absent_error, absent_version, current] = db->put_if_version(key, 0, std::string("overwrite"));
+
+        std::cout << "Unstamped key has a version: " << (version != 0)
+                  << " put if absent conflict: " << (absent_error == LMDB_CONFLICT) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        const auto from = std::string("balance_a"), to = std::string("balance_b");
+
+        db->put(from, Merge::encode_int64(100));
+
+        db->put(to, Merge::encode_int64(0));
+
+        // move 25 from one balance to the other, the arithmetic happens without holding the write lock
+        const auto error = OptimisticTransaction::run(
+            env,
+            [&](OptimisticTransaction &txn)
+            {
+                const auto [from_error, from_value] = txn.get(db, from);
+
+                const auto [to_error, to_value] = txn.get(db, to);
+
+                if (from_error || to_error)
+                {
+                    return (from_error) ? from_error : to_error;
+                }
+
+                txn.put(db, from, Merge::encode_int64(Merge::decode_int64(from_value) - 25));
+
+                txn.put(db, to, Merge::encode_int64(Merge::decode_int64(to_value) + 25));
+
+                return Error();
+            });
+
+        std::cout << "Optimistic transfer: " << error.to_string() << " balance: "
+                  << Merge::decode_int64(std::get<1>(db->get(to))) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("unversioned_optimistic");
+
+        const auto legacy = std::string("legacy_key");
+
+        // written before versioning is enabled, so the key has no version stamp
+        db->put(legacy, std::string("legacy"));
+
+        db->enable_versioning();
+
+        const auto error = OptimisticTransaction::run(
+            env,
+            [&](OptimisticTransaction &txn)
+            {
+                const auto [get_error, value] = txn.get(db, legacy);
+
+                if (get_error)
+                {
+                    return get_error;
+                }
+
+                txn.put(db, std::string("derived_key"), value);
+
+                return Error();
+            },
+            1);
+
+        std::cout << "Optimistic read of unstamped key: " << error.to_string() << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        auto [bulk_error, bulk] = db->transaction(std::chrono::milliseconds::max(), WRITE_PRIORITY_BULK);
+
+        bulk->put(std::string("bulk_key"), std::string("bulk_value"));
+
+        Error timed_error;
+
+        // while the bulk writer holds the write transaction, a bounded wait gives up
+        std::thread waiter(
+            [&db, &timed_error]
+            {
+                timed_error =
+                    std::get<0>(db->transaction(std::chrono::milliseconds(50), WRITE_PRIORITY_INTERACTIVE));
+            });
+
+        waiter.join();
+
+        std::cout << "Bounded wait: " << (timed_error == LMDB_TIMEOUT) << " should yield: " << bulk->should_yield()
+                  << std::endl;
+
+        bulk->commit();
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto sharded = ShardedDatabase::open("test_sharded.db", 4, "test");
+
+        std::vector<std::tuple<mdb_result_t, mdb_result_t>> pairs;
+
+        for (size_t i = 0; i < 10; ++i)
+        {
+            const auto temp = "sharded_" + std::to_string(i);
+
+            pairs.emplace_back(mdb_result_t(temp.begin(), temp.end()), mdb_result_t(temp.begin(), temp.end()));
+        }
+
+        sharded->put_batch(pairs);
+
+        std::cout << "Sharded count: " << sharded->count() << std::endl;
+
+        auto it = sharded->iterator();
+
+        for (auto [error, k, v] = it->next(); !error; std::tie(error, k, v) = it->next())
+        {
+            std::cout << "Sharded Key: " << std::string(k.begin(), k.end()) << " (shard " << sharded->shard(k) << ")"
+                      << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        WriteBufferOptions options;
+
+        options.durability = BUFFER_WAL;
+
+        options.wal_path = "test_buffer.wal";
+
+        WriteBuffer buffer(db, options);
+
+        for (size_t i = 0; i < 10; ++i)
+        {
+            buffer.put("buffered_" + std::to_string(i), std::string("value"));
+        }
+
+        buffer.del(std::string("buffered_3"));
+
+        std::cout << "Buffered keys: " << buffer.size() << " in database: " << db->exists(std::string("buffered_0"))
+                  << " deleted: " << buffer.exists(std::string("buffered_3")) << std::endl;
+
+        buffer.flush();
+
+        std::cout << "Flushed to database: " << db->exists(std::string("buffered_0")) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        // a torn record left behind by a crash
+        std::ofstream("test_torn.wal", std::ios::binary) << std::string(20, '\x01');
+
+        WriteBufferOptions options;
+
+        options.durability = BUFFER_WAL;
+
+        options.wal_path = "test_torn.wal";
+
+        WriteBuffer buffer(db, options);
+
+        buffer.put(std::string("recovered"), std::string("value"));
+
+        std::ifstream wal("test_torn.wal", std::ios::binary | std::ios::ate);
+
+        std::cout << "Torn write-ahead log truncated: " << (wal.tellg() == 13 + 9 + 5) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto vlog_env = Environment::instance("test_vlog.db");
+
+        ValueLogOptions options;
+
+        options.path = "test_vlog.blobs";
+
+        options.threshold = 64;
+
+        options.segment_size = 1024;
+
+        ValueLog vlog(vlog_env->database("test"), options);
+
+        for (size_t i = 0; i < 10; ++i)
+        {
+            vlog.put("blob_" + std::to_string(i), std::string(256, static_cast<char>('a' + i)));
+        }
+
+        vlog.put(std::string("small"), std::string("inline"));
+
+        for (size_t i = 0; i < 8; ++i)
+        {
+            vlog.del("blob_" + std::to_string(i));
+        }
+
+        const auto [view_error, view] = vlog.view(std::string("blob_9"));
+
+        std::cout << "Blob size: " << view.size() << " first byte: " << view.data()[0] << std::endl;
+
+        const auto [gc_error, reclaimed] = vlog.garbage_collect();
+
+        const auto [stats_error, stats] = vlog.stats();
+
+        std::cout << "Reclaimed segments: " << reclaimed << " segments: " << stats.segments
+                  << " live bytes: " << stats.live_bytes << " of " << stats.total_bytes << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto blob_env = Environment::instance("test_blob.db");
+
+        BlobStore blobs(blob_env->database("test"), 1024);
+
+        std::string contents;
+
+        for (size_t i = 0; i < 300; ++i)
+        {
+            contents += "chunk_" + std::to_string(i) + ";";
+        }
+
+        std::istringstream input(contents);
+
+        blobs.write(std::string("blob"), input);
+
+        const auto [info_error, info] = blobs.info(std::string("blob"));
+
+        std::cout << "Blob size: " << info.size << " chunks: " << info.chunks << std::endl;
+
+        const auto [reader_error, reader] = blobs.reader(std::string("blob"));
+
+        char buffer[16] = {};
+
+        const auto [read_error, read] = reader->read_at(1024, buffer, sizeof(buffer) - 1);
+
+        std::cout << "Read at 1024: " << std::string(buffer, read) << std::endl;
+
+        std::ostringstream output;
+
+        reader->copy_to(output);
+
+        std::cout << "Round trip: " << (output.str() == contents) << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto dedup_env = Environment::instance("test_dedup.db");
+
+        DedupDatabase dedup(dedup_env->database("test"), 64);
+
+        const auto payload = std::string(1000, 'x');
+
+        for (size_t i = 0; i < 5; ++i)
+        {
+            dedup.put("dedup_" + std::to_string(i), payload);
+        }
+
+        dedup.put(std::string("dedup_small"), std::string("small"));
+
+        dedup.del(std::string("dedup_0"));
+
+        const auto [get_error, value] = dedup.get(std::string("dedup_4"));
+
+        const auto [stats_error, stats] = dedup.stats();
+
+        std::cout << "Dedup value size: " << value.size() << " contents: " << stats.contents
+                  << " logical bytes: " << stats.logical_bytes << " saved bytes: " << stats.saved_bytes << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        ResultSet results;
+
+        db->get_all(results);
+
+        const auto allocated = results.capacity();
+
+        for (const auto &[key, value] : results)
+        {
+            std::cout << "Arena Key: " << std::string(key.begin(), key.end()) << " (" << value.size << " bytes)"
+                      << std::endl;
+        }
+
+        db->list_keys(results);
+
+        std::cout << "Arena keys: " << results.size() << " reused buffer: " << (results.capacity() == allocated)
+                  << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        unsigned char buffer[4096];
+
+        std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+
+        auto txn = db->transaction(true);
+
+        const auto [get_error, value] = txn->get(std::string("buffered_0"), &arena);
+
+        std::cout << "Arena allocated value: " << std::string(value.begin(), value.end())
+                  << " from buffer: " << (value.data() >= buffer && value.data() < buffer + sizeof(buffer))
+                  << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        typedef Typed::Traits<Typed::IntegerCodec<size_t>, Typed::StringCodec> counter_traits_t;
+
+        Typed::Database<counter_traits_t> counters(typed_env, "counters");
+
+        for (size_t i = 0; i < 5; ++i)
+        {
+            counters.put(i, "counter_" + std::to_string(i));
+        }
+
+        const auto [get_error, value] = counters.get(3);
+
+        std::cout << "Typed value: " << value << std::endl;
+
+        try
+        {
+            Typed::Database<Typed::Traits<Typed::StringCodec, Typed::StringCodec>> mismatched(typed_env, "counters");
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "Typed mismatch: " << e.what() << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto db = env->database("test");
+
+        ResultSet results;
+
+        db->scan(
+            results,
+            Predicates::all_of(
+                Predicates::Contains(Predicates::PREDICATE_KEY, std::string("buffered_")),
+                Predicates::negate(Predicates::FieldEquals(Predicates::PREDICATE_KEY, 9, std::string("0")))));
+
+        for (const auto &[key, value] : results)
+        {
+            std::cout << "Scanned Key: " << std::string(key.begin(), key.end()) << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        Typed::Database<Typed::Traits<Typed::IntegerCodec<size_t>, Typed::FixedCodec<uint32_t>>> amounts(
+            typed_env, "amounts");
+
+        for (size_t i = 0; i < 100; ++i)
+        {
+            amounts.put(i, static_cast<uint32_t>(i * 10));
+        }
+
+        AggregateOptions<uint32_t> options;
+
+        options.histogram_bounds = {250, 500, 750};
+
+        const auto [aggregate_error, aggregate] = amounts.database()->aggregate(options);
+
+        std::cout << "Aggregate count: " << aggregate.count << " sum: " << aggregate.sum << " min: " << aggregate.min
+                  << " max: " << aggregate.max << " histogram: " << aggregate.histogram[0] << "/"
+                  << aggregate.histogram[1] << "/" << aggregate.histogram[2] << "/" << aggregate.histogram[3]
+                  << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        auto amounts = typed_env->database("amounts", false, MDB_INTEGERKEY);
+
+        const auto points = amounts->split_points(4);
+
+        std::atomic<size_t> scanned(0);
+
+        std::atomic<uint64_t> total(0);
+
+        const auto scan_error = amounts->parallel_scan(
+            [&](size_t, const MDB_val &, const MDB_val &value)
+            {
+                uint32_t amount;
+
+                std::memcpy(&amount, value.mv_data, sizeof(amount));
+
+                scanned++;
+
+                total += amount;
+
+                return true;
+            },
+            4);
+
+        std::cout << "Split points: " << points.size() << " parallel scanned: " << scanned << " total: " << total
+                  << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        auto amounts = typed_env->database("amounts", false, MDB_INTEGERKEY);
+
+        const size_t begin = 10, end = 90;
+
+        const auto [estimate_error, estimate] =
+            amounts->estimate_range(&begin, sizeof(begin), &end, sizeof(end), 4, 8);
+
+        std::cout << "Estimated entries: " << estimate.entries << " bytes: " << estimate.bytes
+                  << " exact: " << estimate.exact << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        auto amounts = typed_env->database("amounts", false, MDB_INTEGERKEY);
+
+        ResultSet samples;
+
+        const auto sample_error = amounts->sample(5, samples);
+
+        for (const auto &[key, value] : samples)
+        {
+            size_t sampled_key;
+
+            std::memcpy(&sampled_key, key.data, sizeof(sampled_key));
+
+            std::cout << "Sampled Key: " << sampled_key << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        auto amounts = typed_env->database("amounts", false, MDB_INTEGERKEY);
+
+        const size_t begin = 10, end = 20;
+
+        size_t keys = 0;
+
+        const auto keys_error = amounts->scan_keys(
+            [&](const MDB_val &)
+            {
+                keys++;
+
+                return true;
+            },
+            &begin,
+            sizeof(begin),
+            &end,
+            sizeof(end));
+
+        ResultSet values;
+
+        const auto values_error = amounts->list_values(values);
+
+        std::cout << "Scanned keys: " << keys << " listed values: " << values.size() << " count: " << amounts->count()
+                  << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto tags = env->database("tags", false, MDB_DUPSORT);
+
+        tags->put(std::string("a"), std::string("1"));
+
+        tags->put(std::string("a"), std::string("2"));
+
+        tags->put(std::string("b"), std::string("1"));
+
+        ResultSet results;
+
+        const auto list_error = tags->list_keys(results, false);
+
+        size_t scanned = 0;
+
+        const auto scan_error = tags->scan_keys(
+            [&](const MDB_val &)
+            {
+                scanned++;
+
+                return true;
+            },
+            nullptr,
+            0,
+            nullptr,
+            0,
+            false);
+
+        std::cout << "Duplicate keys: " << tags->list_keys(false).size() << " arena: " << results.size()
+                  << " scanned: " << scanned << " unique: " << tags->list_keys().size() << std::endl;
+    }
+
+    std::cout << std::endl << std::endl;
+
+    {
+        auto typed_env = Environment::instance("test_typed.db");
+
+        typedef Typed::Traits<Typed::IntegerCodec<size_t>, Typed::IntegerCodec<unsigned int>, false, true>
+            readings_traits_t;
+
+        Typed::Database<readings_traits_t> readings(typed_env, "readings");
+
+        for (unsigned int i = 0; i < 1000; ++i)
+        {
+            readings.put(i % 2, i);
+        }
+
+        const auto [count_error, count] = readings.count(1);
+
+        const auto [all_error, values] = readings.get_all(0);
+
+        size_t in_range = 0;
+
+        const auto range_error = readings.transaction(true)->duplicates(
+            1,
+            100,
+            200,
+            [&](const MDB_val &)
+            {
+                in_range++;
+
+                return true;
+            });
+
+        std::cout << "Duplicates: " << count << " bulk read: " << values.size() << " in range: " << in_range
+                  << std::endl;
+    }
+
     env->copy("test2.db");
 }